@@ -2,19 +2,35 @@
 // --------------------------------------------------
 // Author: Soumy - IoT Developer & Embedded Systems Engineer
 // Features:
-// - Serves beautiful custom HTML dashboard
-// - REST API endpoints for live sensor and relay data
-// - JS in HTML fetches and displays real values
+// - Serves beautiful custom HTML dashboard (gzipped in flash, ETag/304)
+// - REST API endpoints for live sensor and relay data (async, callback-driven server,
+//   JSON streamed in chunks without building a document)
+// - JS in HTML shows real values, pushed over Server-Sent Events (/api/stream)
 // - All automation, relay, and settings logic preserved
+// - Binary framed sensor data from the ESP8266 (text fallback)
+// - Several ESP8266 sensor nodes at once (connection table)
+// - FreeRTOS tasks on both cores: ingest/automation vs. HTTP/LCD/Telegram
+// - Leveled, non-blocking Serial logging (LG_LOG_LEVEL)
+// - Per-stage latency histograms (/api/latency)
+// - Versioned /api/snapshot with ETag and ?since= for polling clients
+// - Multi-resolution sensor history (compressed raw samples, 1 min, 30 min) behind /api/chart
+// - History, event log and stats kept in a LittleFS segment store across restarts
 
 #include <WiFi.h>
-#include <WebServer.h>
+#include <ESPAsyncWebServer.h>
 #include <EEPROM.h>
 #include <ESPmDNS.h>
 #include <HTTPClient.h>
 #include <ArduinoJson.h>
 #include <Wire.h>
 #include <LiquidCrystal_I2C.h>
+#include <LabGuardProtocol.h>
+#include <LabGuardText.h>
+#include <LabGuardLog.h>
+#include <LabGuardStore.h>
+#include <LittleFS.h>
+#include <memory>
+#include "web_assets.h"
 
 // I2C LCD Display (0x27 is the default I2C address for most LCD displays)
 LiquidCrystal_I2C lcd(0x27, 16, 2); // 16x2 LCD display
@@ -41,8 +57,8 @@ String chatID = "1351262356";
 
 // TCP + Web Server
 WiFiServer tcpServer(8080);
-WiFiClient client;
-WebServer server(80);
+AsyncWebServer server(80);
+AsyncEventSource events("/api/stream");
 
 // Relay Pins
 #define RELAY1 14   // Relay 1: Exhaust Fan (GPIO 14 / D5)
@@ -63,6 +79,13 @@ WebServer server(80);
 #define ADDR_THRESH_TEMP 5
 #define ADDR_THRESH_GAS 6
 #define ADDR_THRESH_SOUND 7
+#define ADDR_RBE 42            // 0xFF = never saved, use defaults
+#define ADDR_DB_TEMP 43        // Tenths of °C
+#define ADDR_DB_GAS 44
+#define ADDR_DB_LIGHT 45
+#define ADDR_DB_DIST 46
+#define ADDR_HEARTBEAT 47      // Seconds
+#define ADDR_ALERT_REARM 48    // Seconds, 0xFF = never saved
 
 // Other Variables
 bool autoMode = true;
@@ -73,21 +96,43 @@ unsigned long lastSensorUpdate = 0;
 bool isOnline = false;
 #define SENSOR_TIMEOUT 10000 // 10 seconds
 
+// First/last activation in the last window, ms from its start (-1 = none)
+struct EventTiming {
+  int firstMs = -1;
+  int lastMs = -1;
+};
+
 // Sensor Data Storage
 struct SensorData {
   float temperature = 0.0;
+  int temperatureAge = 0;   // Seconds since the ESP8266 took the DHT reading
   int gasLevel = 0;
   int soundLevel = 0;
   bool motionDetected = false;
   bool irTriggered = false;
   int lightLevel = 0;
   long distance = 0;
+  // Activations counted by the ESP8266 during the last reporting window
+  int soundEvents = 0;
+  int motionEvents = 0;
+  int irEvents = 0;
+  EventTiming soundAt, motionAt, irAt;
+  int windowSamples = 0;
 } sensorData;
 
 // Threshold Defaults
 int TEMP_THRESHOLD = 40;
 int GAS_THRESHOLD = 350;
 int SOUND_THRESHOLD = 80;
+int ALERT_REARM_SEC = 30;   // Minimum time before the ESP8266 re-fires a cleared alert
+
+// Report-by-exception deadbands (pushed to the ESP8266 with DEADBANDS:)
+bool RBE_ENABLED = false;
+float TEMP_DEADBAND = 0.5;
+int GAS_DEADBAND = 15;
+int LIGHT_DEADBAND = 50;
+int DIST_DEADBAND = 10;
+int HEARTBEAT_SEC = 60;
 
 // Sensor Stats
 struct SensorStats {
@@ -100,24 +145,627 @@ struct SensorStats {
 };
 SensorStats tempStats, gasStats, soundStats, lightStats, distStats;
 
-// Active Alerts
-std::vector<String> activeAlerts;
+// Active Alerts (one bit per ACTIVE_ALERT_NAMES entry)
+const char* const ACTIVE_ALERT_NAMES[] = {
+  "TEMP_HIGH", "GAS_LEAK", "SOUND_EVENT", "MOTION_PIR", "IR_TRIGGERED", "PRESENCE_DETECTED", "ROOM_DARK",
+};
+#define ACTIVE_ALERT_COUNT (sizeof(ACTIVE_ALERT_NAMES) / sizeof(ACTIVE_ALERT_NAMES[0]))
+uint8_t activeAlerts = 0;
 
 // Add at the top:
 unsigned long dataPoints = 0;
 
-// --- Sensor History Circular Buffers ---
-#define HISTORY_SIZE 100
-struct SensorHistoryEntry {
-  float value;
-  unsigned long timestamp;
+// Binary protocol counters (totals over all sensor nodes)
+unsigned long framesReceived = 0;
+unsigned long framesLost = 0;    // Gaps in the sequence number
+unsigned long frameErrors = 0;   // CRC/version/length failures
+unsigned long textErrors = 0;    // Malformed KEY=VALUE text lines
+unsigned long backlogRecords = 0; // Windows replayed by the ESP8266 after an outage
+
+// Last gas filter report from the ESP8266 (GASFILTER_STATE:OS=..,MEDIAN=..,...)
+struct GasFilterReport {
+  long oversample = 0, median = 0, average = 0, ewmaShift = 0, raw = 0, filtered = 0;
+  bool reported = false;
+};
+GasFilterReport gasFilterReport;
+
+// ---------------------- Node Connections ----------------------
+// One slot per sensor node socket. Protocol state (negotiated at HELLO),
+// sequence tracking and the clock estimate are per connection; readings from
+// every node feed the shared sensorData/stats.
+#define MAX_NODES 4
+#define NODE_TIMEOUT_MS 30000        // Three missed PINGs
+#define NODE_RX_BUF 512              // Longest text line or frame, plus whatever else arrived with it
+
+// Edge alerts that hold an output on; an output follows the OR over all nodes
+#define HOLD_GAS      0x01  // RELAY1
+#define HOLD_TEMP     0x02  // RELAY3
+#define HOLD_MOTION   0x04  // RELAY2, together with
+#define HOLD_PRESENCE 0x08  //   presence
+#define HOLD_LIGHT    (HOLD_MOTION | HOLD_PRESENCE)
+
+struct NodeConn {
+  WiFiClient sock;
+  bool active = false;
+  uint8_t rx[NODE_RX_BUF];           // Bytes received but not yet a complete line/frame
+  size_t rxLen = 0;
+  String ip;                         // remoteIP(), replaced by the node's INFO:ESP8266_IP= report
+  unsigned long connectedAt = 0;
+  unsigned long lastSeen = 0;        // Last message of any kind
+  unsigned long messages = 0;
+  bool binary = false;               // Negotiated PROTO:BIN during HELLO
+  bool edgeAlerts = false;           // Sends ALERT:/CLEAR: transitions (EDGE=1)
+  uint8_t heldAlerts = 0;            // HOLD_* bits of its alerts still between ALERT: and CLEAR:
+  uint16_t lastSeq = 0;
+  bool haveSeq = false;
+  unsigned long framesLost = 0;
+  long clockOffsetMs = 0;            // Node millis() ≈ our millis() + clockOffsetMs
+  unsigned long clockRttMs = ULONG_MAX;  // Round trip of the sample behind clockOffsetMs
+  bool clockSynced = false;
+  unsigned long clockSamples = 0;
+};
+NodeConn nodes[MAX_NODES];
+NodeConn* rxNode = nullptr;          // Connection whose message is being handled
+
+// ---------------------- Latency Tracing ----------------------
+// The ESP8266 stamps every message with its millis() (T=, or nodeMs in an
+// aggregate frame) and the age of the newest sample (AGE=). PING:ESP32,T=..
+// is echoed back in the PONG, which gives a round trip and a clock offset
+// estimate (the sample with the smallest round trip wins). Each stage of
+// acquire → send → receive → parse → actuation → HTTP publish goes into a
+// log-spaced histogram, served by /api/latency.
+#define LAT_BUCKETS 16
+const uint32_t LAT_BUCKET_US[LAT_BUCKETS - 1] = {
+  100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+  100000, 250000, 500000, 1000000, 2500000, 5000000,
+};  // Upper bounds; the last bucket catches everything slower
+
+enum LatencyStage { LAT_ACQUIRE_TO_SEND, LAT_NETWORK, LAT_PARSE, LAT_ACTUATION, LAT_PUBLISH, LAT_END_TO_END, LAT_STAGE_COUNT };
+
+struct LatencyHistogram {
+  const char* name;
+  uint32_t buckets[LAT_BUCKETS];
+  uint32_t count;
+  uint64_t sumUs;
+  uint32_t maxUs;
+};
+LatencyHistogram latency[LAT_STAGE_COUNT] = {
+  {"acquireToSend"}, {"network"}, {"parse"}, {"actuation"}, {"publish"}, {"endToEnd"},
+};
+
+// The message being handled right now
+struct RxTrace {
+  unsigned long rxUs;      // micros() when it came out of the receive buffer
+  unsigned long rxMs;
+  unsigned long parsedUs;  // micros() once its values were applied
+  uint32_t nodeMs;         // ESP8266 send time, if haveTime
+  uint32_t ageMs;          // Sample age at send, if haveAge
+  bool haveTime;           // Older ESP8266 firmware sends neither
+  bool haveAge;
+};
+RxTrace rxTrace;
+
+// Newest reading not yet served by /api/sensors
+bool publishPending = false;
+unsigned long publishParsedUs = 0;
+unsigned long publishAcquireMs = 0;  // Our millis() at acquisition (when known)
+bool publishAcquireKnown = false;
+portMUX_TYPE latencyLock = portMUX_INITIALIZER_UNLOCKED;  // Histograms and publish*: both cores
+
+// ---------------------- Tasks ----------------------
+// Core 1 (APP_CPU): ingestTask - node sockets, parsing, automation
+//                   loop()     - reset button, log drain, uptime, Wi-Fi,
+//                                and the only EEPROM writer after setup()
+// Core 0 (PRO_CPU, shared with the Wi-Fi stack):
+//                   async_tcp   - HTTP callbacks (CONFIG_ASYNC_TCP_RUNNING_CORE)
+//                   streamTask  - /api/stream broadcasts
+//                   displayTask - LCD
+//                   notifyTask  - Telegram over HTTPS
+// ingestTask owns sensorData, the stats, nodes[] and the protocol counters;
+// every other task reads them from the published Snapshot. It also owns the
+// relays, autoMode and the thresholds: the HTTP handlers post their changes
+// to outputQueue. Lines for the ESP8266 go through nodeCommandQueue, Telegram
+// messages through notifyQueue and LCD messages through lcdQueue. All queues
+// are bounded: a full queue drops the message rather than block the sender.
+#define INGEST_STACK 6144
+#define DISPLAY_STACK 3072
+#define NOTIFY_STACK 8192               // HTTPS handshake
+#define STREAM_STACK 4096
+#define NODE_COMMAND_QUEUE_LEN 8
+#define OUTPUT_QUEUE_LEN 8
+#define NOTIFY_QUEUE_LEN 8
+#define LCD_QUEUE_LEN 4
+
+struct NodeCommand {
+  char line[LG_LINE_MAX];
+};
+// A change to the outputs or settings, applied by ingestTask
+enum OutputOp : uint8_t { OUT_TOGGLE_RELAY, OUT_SET_ALL, OUT_TOGGLE_MODE, OUT_SETTINGS };
+struct OutputCommand {
+  OutputOp op;
+  uint8_t relay;    // OUT_TOGGLE_RELAY: 1-4
+  bool on;          // OUT_SET_ALL
+  bool viaApi;      // Only changes the event log text
+  // OUT_SETTINGS: every value, the current one where the request left it out
+  int temp, gas, sound, rearmSec;
+  bool rbe;
+  float tempDeadband;
+  int gasDeadband, lightDeadband, distDeadband, heartbeatSec;
+};
+struct TelegramMessage {
+  char text[128];
+};
+struct LcdMessage {
+  char line1[17];
+  char line2[17];
+  uint16_t durationMs;
+};
+QueueHandle_t nodeCommandQueue = nullptr;
+QueueHandle_t outputQueue = nullptr;
+QueueHandle_t notifyQueue = nullptr;
+QueueHandle_t lcdQueue = nullptr;
+SemaphoreHandle_t eventLogMutex = nullptr;
+SemaphoreHandle_t settingsMutex = nullptr;  // esp8266_ip/esp8266_port
+// Longest an HTTP callback waits for a mutex before it answers 503: async_tcp
+// also serves every other connection
+#define HTTP_LOCK_WAIT_MS 50
+
+bool lockForHttp(SemaphoreHandle_t m) {
+  return xSemaphoreTake(m, pdMS_TO_TICKS(HTTP_LOCK_WAIT_MS)) == pdTRUE;
+}
+// Set by ingestTask and the HTTP handlers, saved by loop() so nobody waits
+// for a flash commit
+volatile bool relaySavePending = false;     // Relay states, mode and thresholds
+volatile bool deadbandSavePending = false;
+volatile bool esp8266SavePending = false;
+unsigned long queueDrops = 0;
+
+struct NodeSummary {
+  char ip[16];
+  unsigned long connectedAt, lastSeen, messages, framesLost;
+  bool binary;
+  bool clockSynced;
+  long clockOffsetMs;
+  unsigned long clockRttMs, clockSamples;
+};
+
+// Everything the other tasks may read of ingestTask's state, as one
+// consistent copy (readings, stats and counters from the same moment)
+struct Snapshot {
+  uint32_t version;              // Bumped on every publish
+  SensorData sensors;
+  SensorStats temp, gas, sound, light, dist;
+  uint8_t activeAlerts;          // Bits of ACTIVE_ALERT_NAMES
+  bool isOnline;
+  bool nodeConnected;
+  char nodeIp[16];               // Shown on the LCD
+  unsigned long dataPoints, framesReceived, framesLost, frameErrors, textErrors, backlogRecords;
+  GasFilterReport gasFilter;
+  uint8_t nodeCount;
+  NodeSummary nodes[MAX_NODES];
+};
+Snapshot published;
+portMUX_TYPE snapshotLock = portMUX_INITIALIZER_UNLOCKED;
+bool snapshotDirty = true;       // ingestTask only
+
+// ------------------------ Timeline --------------------------
+// History and log times, in seconds. Epoch seconds once setup() has SNTP
+// time (beginClock()). Without a clock it continues across restarts:
+// beginStore() sets the offset just past the newest record in the flash
+// store, and as the downtime itself is unknown a restart adds no gap.
+#define NTP_SERVER "pool.ntp.org"
+#define TIME_ZONE "UTC0"              // POSIX TZ for the clock times in the log
+#define SNTP_WAIT_MS 10000
+#define EPOCH_VALID 1600000000UL      // Earlier: the RTC still counting from 1970
+uint32_t timelineOffset = 0;
+
+uint32_t timelineAt(unsigned long ms) {
+  return timelineOffset + ms / 1000;
+}
+
+uint32_t timelineNow() {
+  return timelineAt(millis());
+}
+
+// ------------------------ Sensor History --------------------------
+// Fed by every reading (text, binary, aggregate and backlog). Live samples go
+// into a compressed raw stream per channel; each rollup tier keeps
+// min/max/avg per fixed-width bucket and is updated on every sample, so a
+// chart query only reads finished buckets. Values are stored as int16
+// (value * HIST_SCALE). Written by ingestTask, read by the HTTP handlers,
+// under historyLock.
+// Static DRAM, next to the web server and the TLS client of notifyTask:
+//   raw streams   5 x (8 x 256 + 16)  = 10320 bytes
+//   1 min tier    5 x 360 x 8          = 14400 bytes (6 hours)
+//   30 min tier   5 x 336 x 8          = 13440 bytes (7 days)
+//   store batch   LG_STORE_BATCH_MAX   =  1024 bytes
+// about 39 KB; /api/sensors reports freeHeap and minFreeHeap to check the
+// headroom under load.
+enum HistChannel : uint8_t { HIST_TEMP, HIST_GAS, HIST_SOUND, HIST_LIGHT, HIST_DIST, HIST_CHANNELS };
+const float HIST_SCALE[HIST_CHANNELS] = {100, 1, 1, 1, 1};  // Temperature in centi-degrees
+
+// ---- Raw stream ----
+// Append-only blocks in the style of Gorilla: the first sample of a block is
+// stored plainly, every later one as the delta-of-delta of its timestamp and
+// the delta of its value, each a zigzag integer behind a 1-4 bit prefix
+// (0 | 10 | 110 | 1110 | 1111, see HIST_DOD_BITS / HIST_VAL_BITS). A steady
+// cadence costs one bit for the time, an unchanged value one bit more.
+// Values are already quantized, so a plain delta does what XOR does for floats.
+// When the newest block is full the oldest one is recycled.
+#define HIST_BLOCK_BYTES 240
+#define HIST_RAW_BLOCKS 8          // Per channel, 256 bytes each with header
+#define HIST_SAMPLE_MAX_BITS (4 + 32 + 4 + 17)
+
+const uint8_t HIST_DOD_BITS[] = {0, 7, 9, 12, 32};
+const uint8_t HIST_VAL_BITS[] = {0, 4, 7, 10, 17};
+
+struct HistBlock {
+  uint32_t seq;                // Position in the stream, 0 = unused
+  uint32_t t0;                 // First sample, timeline seconds
+  int16_t v0;
+  uint16_t count;              // Samples in the block
+  uint16_t bits;               // Bits of data used
+  uint8_t data[HIST_BLOCK_BYTES];
+};
+
+struct HistStream {
+  HistBlock blocks[HIST_RAW_BLOCKS];  // Block seq lives at seq % HIST_RAW_BLOCKS
+  uint32_t seq;                // Newest block, 0 = empty
+  uint32_t lastT;              // Decoder state at the end of the newest block
+  int32_t lastDelta;
+  int16_t lastV;
+};
+
+// Reads one stream oldest first; a block recycled under it is skipped
+struct HistCursor {
+  uint32_t seq;
+  uint16_t index;              // Samples of the block already returned
+  uint16_t pos;                // Bit position in the block
+  uint32_t t;
+  int32_t delta;
+  int16_t v;
+};
+
+struct HistBucket {
+  int16_t min, max, avg;
+  uint16_t count;              // Samples merged, 0 = no data
+};
+
+struct HistTier {
+  uint16_t widthSec;
+  uint16_t size;               // Buckets per channel
+  HistBucket* buckets;         // [HIST_CHANNELS][size], bucket id % size
+  uint32_t headId;             // Newest bucket id (t / widthSec) in the ring
+  float headSum[HIST_CHANNELS];  // Exact sum behind the head bucket's avg
+};
+
+HistStream histRaw[HIST_CHANNELS];
+HistBucket hist1m[HIST_CHANNELS * 360];    // 6 hours
+HistBucket hist30m[HIST_CHANNELS * 336];   // 7 days
+HistTier histTiers[] = {{60, 360, hist1m}, {1800, 336, hist30m}};
+#define HIST_TIER_COUNT (sizeof(histTiers) / sizeof(histTiers[0]))
+portMUX_TYPE historyLock = portMUX_INITIALIZER_UNLOCKED;
+
+int16_t histQuantize(HistChannel ch, float v) {
+  float q = roundf(v * HIST_SCALE[ch]);
+  return (int16_t)constrain(q, -32767.0f, 32767.0f);
+}
+
+float histValue(HistChannel ch, int16_t q) {
+  return q / HIST_SCALE[ch];
+}
+
+void histPutBits(HistBlock &b, uint32_t v, uint8_t n) {
+  while (n--) {
+    if ((v >> n) & 1) b.data[b.bits >> 3] |= 0x80 >> (b.bits & 7);
+    b.bits++;
+  }
+}
+
+uint32_t histGetBits(const HistBlock &b, uint16_t &pos, uint8_t n) {
+  uint32_t v = 0;
+  for (; n; n--, pos++) v = (v << 1) | ((b.data[pos >> 3] >> (7 - (pos & 7))) & 1);
+  return v;
+}
+
+void histPutInt(HistBlock &b, int32_t x, const uint8_t* widths) {
+  uint32_t z = ((uint32_t)x << 1) ^ (uint32_t)(x >> 31);
+  uint8_t k = 0;
+  while (k < 4 && z >= (1UL << widths[k])) k++;
+  if (k < 4) histPutBits(b, ((1u << k) - 1) << 1, k + 1);
+  else histPutBits(b, 0xF, 4);
+  histPutBits(b, z, widths[k]);
+}
+
+int32_t histGetInt(const HistBlock &b, uint16_t &pos, const uint8_t* widths) {
+  uint8_t k = 0;
+  while (k < 4 && histGetBits(b, pos, 1)) k++;
+  uint32_t z = histGetBits(b, pos, widths[k]);
+  return (int32_t)(z >> 1) ^ -(int32_t)(z & 1);
+}
+
+void histStreamAppend(HistStream &s, uint32_t t, int16_t v) {
+  HistBlock* b = s.seq ? &s.blocks[s.seq % HIST_RAW_BLOCKS] : nullptr;
+  if (!b || b->bits + HIST_SAMPLE_MAX_BITS > HIST_BLOCK_BYTES * 8) {
+    b = &s.blocks[++s.seq % HIST_RAW_BLOCKS];
+    memset(b->data, 0, sizeof(b->data));
+    b->seq = s.seq;
+    b->t0 = t;
+    b->v0 = v;
+    b->count = 1;
+    b->bits = 0;
+    s.lastT = t;
+    s.lastDelta = 0;
+    s.lastV = v;
+    return;
+  }
+  int32_t delta = t - s.lastT;
+  histPutInt(*b, delta - s.lastDelta, HIST_DOD_BITS);
+  histPutInt(*b, v - s.lastV, HIST_VAL_BITS);
+  b->count++;
+  s.lastT = t;
+  s.lastDelta = delta;
+  s.lastV = v;
+}
+
+uint32_t histOldestSeq(const HistStream &s) {
+  return s.seq >= HIST_RAW_BLOCKS ? s.seq - HIST_RAW_BLOCKS + 1 : 1;
+}
+
+// Positions `c` on the last block starting at or before `from`
+void histSeek(const HistStream &s, HistCursor &c, uint32_t from) {
+  c.seq = histOldestSeq(s);
+  while (c.seq < s.seq && s.blocks[(c.seq + 1) % HIST_RAW_BLOCKS].t0 <= from) c.seq++;
+  c.index = 0;
+}
+
+// Next sample, oldest first; false once it has caught up with the writer
+bool histNext(const HistStream &s, HistCursor &c, uint32_t &t, int16_t &v) {
+  for (; c.seq && c.seq <= s.seq; c.seq++, c.index = 0) {
+    if (c.seq < histOldestSeq(s)) {
+      c.seq = histOldestSeq(s);
+      c.index = 0;
+    }
+    const HistBlock &b = s.blocks[c.seq % HIST_RAW_BLOCKS];
+    if (c.index >= b.count) {
+      if (c.seq == s.seq) return false;  // More may still be appended here
+      continue;
+    }
+    if (c.index == 0) {
+      c.t = b.t0;
+      c.delta = 0;
+      c.v = b.v0;
+      c.pos = 0;
+    } else {
+      c.delta += histGetInt(b, c.pos, HIST_DOD_BITS);
+      c.t += c.delta;
+      c.v += histGetInt(b, c.pos, HIST_VAL_BITS);
+    }
+    c.index++;
+    t = c.t;
+    v = c.v;
+    return true;
+  }
+  return false;
+}
+
+// ---- Rollup tiers ----
+// Moves the head forward to `id`, emptying the buckets it passes over
+void histAdvance(HistTier &tier, uint32_t id) {
+  uint32_t gap = min(id - tier.headId, (uint32_t)tier.size);
+  for (uint32_t k = 1; k <= gap; k++) {
+    uint32_t slot = (tier.headId + k) % tier.size;
+    for (uint8_t c = 0; c < HIST_CHANNELS; c++) tier.buckets[c * tier.size + slot].count = 0;
+  }
+  tier.headId = id;
+  for (auto &s : tier.headSum) s = 0;
+}
+
+// n samples with the given mean and extremes (n > 1 when replaying a bucket)
+void histAddToTier(HistTier &tier, HistChannel ch, uint32_t t, float mean, int16_t q, int16_t lo, int16_t hi, uint16_t n = 1) {
+  uint32_t id = t / tier.widthSec;
+  if (id > tier.headId) histAdvance(tier, id);
+  else if (tier.headId - id >= tier.size) return;  // Older than the ring
+  HistBucket &b = tier.buckets[ch * tier.size + id % tier.size];
+  bool head = id == tier.headId;
+  if (b.count == 0) {
+    b = {lo, hi, q, n};
+    if (head) tier.headSum[ch] = mean * n;
+    return;
+  }
+  if (lo < b.min) b.min = lo;
+  if (hi > b.max) b.max = hi;
+  if (head) {
+    tier.headSum[ch] += mean * n;
+    b.avg = histQuantize(ch, tier.headSum[ch] / (b.count + n));
+  } else {
+    // A late (backlog) sample for an older bucket: weight by what is there
+    b.avg = (int16_t)(((int64_t)b.avg * b.count + (int64_t)q * n) / (b.count + n));
+  }
+  b.count = min((uint32_t)b.count + n, (uint32_t)UINT16_MAX);
+}
+
+// One reading (or one window's mean and extremes) taken at timeline second `t`. Only live samples go into the raw stream, which must stay in time order.
+void historyAdd(HistChannel ch, uint32_t t, float mean, float lo, float hi, bool live = true) {
+  if (isnan(mean)) return;
+  int16_t q = histQuantize(ch, mean);
+  int16_t qlo = isnan(lo) ? q : histQuantize(ch, lo);
+  int16_t qhi = isnan(hi) ? q : histQuantize(ch, hi);
+  portENTER_CRITICAL(&historyLock);
+  if (live) histStreamAppend(histRaw[ch], t, q);
+  for (auto &tier : histTiers) histAddToTier(tier, ch, t, mean, q, qlo, qhi);
+  portEXIT_CRITICAL(&historyLock);
+}
+
+void historyAdd(HistChannel ch, float value) {
+  historyAdd(ch, timelineNow(), value, value, value);
+}
+
+// A 1 minute bucket from the flash store, replayed into the rollup tiers
+void historyAddBucket(HistChannel ch, uint32_t t, const HistBucket &b) {
+  portENTER_CRITICAL(&historyLock);
+  for (auto &tier : histTiers) histAddToTier(tier, ch, t, histValue(ch, b.avg), b.avg, b.min, b.max, b.count);
+  portEXIT_CRITICAL(&historyLock);
+}
+
+// ---- Queries ----
+#define CHART_MAX_POINTS 720
+#define HIST_DECODE_BUDGET 256     // Raw samples decoded per read, bounds time under the lock
+
+struct HistPoint {
+  uint32_t t;                  // Bucket start
+  int16_t avg, min, max;
+  uint16_t count;
 };
-SensorHistoryEntry tempHistory[HISTORY_SIZE];
-SensorHistoryEntry gasHistory[HISTORY_SIZE];
-SensorHistoryEntry soundHistory[HISTORY_SIZE];
-SensorHistoryEntry lightHistory[HISTORY_SIZE];
-SensorHistoryEntry distHistory[HISTORY_SIZE];
-int tempHistIdx = 0, gasHistIdx = 0, soundHistIdx = 0, lightHistIdx = 0, distHistIdx = 0;
+
+// Cursor over one channel, oldest first; survives appends between reads
+struct HistQuery {
+  HistChannel ch;
+  int8_t tier;                 // -1 = raw stream, bucketed while decoding
+  uint16_t bucketSec;
+  uint32_t from;               // Oldest time wanted (timeline seconds)
+  uint32_t next, end;          // tier: bucket ids
+  HistCursor cursor;           // raw
+  HistPoint pending;           // raw: bucket being filled, count 0 = none
+  int32_t pendingSum;
+  bool done;
+};
+
+// The raw stream while it still reaches back far enough, else the finest
+// tier holding the whole range in at most CHART_MAX_POINTS buckets. Until it
+// wraps the raw stream has everything since boot; history restored from
+// flash is only in the tiers. An empty raw stream (seq 0) covers nothing.
+int8_t historyPickTier(HistChannel ch, uint32_t rangeSec, uint32_t from) {
+  const HistStream &s = histRaw[ch];
+  if (s.seq) {
+    bool sinceBoot = s.seq < HIST_RAW_BLOCKS && from >= timelineOffset;
+    if (sinceBoot || s.blocks[histOldestSeq(s) % HIST_RAW_BLOCKS].t0 <= from) return -1;
+  }
+  for (uint8_t i = 0; i < HIST_TIER_COUNT; i++) {
+    const HistTier &tier = histTiers[i];
+    if ((uint32_t)tier.size * tier.widthSec >= rangeSec && rangeSec / tier.widthSec <= CHART_MAX_POINTS) return i;
+  }
+  return HIST_TIER_COUNT - 1;
+}
+
+void historyBeginQuery(HistQuery &q, HistChannel ch, uint32_t rangeSec, uint32_t now) {
+  portENTER_CRITICAL(&historyLock);
+  q.ch = ch;
+  q.from = now > rangeSec ? now - rangeSec : 0;
+  q.tier = historyPickTier(ch, rangeSec, q.from);
+  q.done = false;
+  if (q.tier < 0) {
+    q.bucketSec = max((rangeSec + CHART_MAX_POINTS - 1) / CHART_MAX_POINTS, (uint32_t)1);
+    q.pending.count = 0;
+    histSeek(histRaw[ch], q.cursor, q.from);
+  } else {
+    const HistTier &tier = histTiers[q.tier];
+    q.bucketSec = tier.widthSec;
+    q.end = tier.headId;
+    q.next = q.from / tier.widthSec;
+    if (q.next > tier.headId) q.next = tier.headId + 1;  // Nothing recorded in range
+    else if (tier.headId - q.next >= tier.size) q.next = tier.headId - tier.size + 1;
+  }
+  portEXIT_CRITICAL(&historyLock);
+}
+
+// Up to `max` points (possibly none while decoding); q.done once finished
+size_t historyRead(HistQuery &q, HistPoint* out, size_t max) {
+  size_t n = 0;
+  if (q.done) return 0;
+  portENTER_CRITICAL(&historyLock);
+  if (q.tier < 0) {
+    HistPoint &p = q.pending;
+    uint32_t t;
+    int16_t v;
+    for (uint16_t budget = HIST_DECODE_BUDGET; n < max && budget; budget--) {
+      if (!histNext(histRaw[q.ch], q.cursor, t, v)) {
+        q.done = true;
+        break;
+      }
+      if (t < q.from) continue;
+      uint32_t start = t - t % q.bucketSec;
+      if (p.count && p.t != start) {
+        p.avg = q.pendingSum / p.count;
+        out[n++] = p;
+        p.count = 0;
+      }
+      if (!p.count) {
+        p = {start, v, v, v, 0};
+        q.pendingSum = 0;
+      }
+      if (v < p.min) p.min = v;
+      if (v > p.max) p.max = v;
+      q.pendingSum += v;
+      p.count++;
+    }
+    // The last bucket is only complete once the stream has run out
+    if (q.done && p.count) {
+      p.avg = q.pendingSum / p.count;
+      out[n++] = p;
+    }
+  } else {
+    const HistTier &tier = histTiers[q.tier];
+    for (; q.next <= q.end && n < max; q.next++) {
+      if (tier.headId - q.next >= tier.size) continue;  // Recycled since the query began
+      const HistBucket &b = tier.buckets[q.ch * tier.size + q.next % tier.size];
+      if (b.count) out[n++] = {q.next * tier.widthSec, b.avg, b.min, b.max, b.count};
+    }
+    q.done = q.next > q.end;
+  }
+  portEXIT_CRITICAL(&historyLock);
+  return n;
+}
+
+// ------------------------ Snapshot --------------------------
+// ingestTask: copies its state out after every pass that changed something
+void publishSnapshot() {
+  static Snapshot next;            // Too big for comfort on the task stack
+  next.sensors = sensorData;
+  next.temp = tempStats; next.gas = gasStats; next.sound = soundStats;
+  next.light = lightStats; next.dist = distStats;
+  next.activeAlerts = activeAlerts;
+  next.isOnline = isOnline;
+  next.nodeConnected = esp8266_connected;
+  next.dataPoints = dataPoints;
+  next.framesReceived = framesReceived;
+  next.framesLost = framesLost;
+  next.frameErrors = frameErrors;
+  next.textErrors = textErrors;
+  next.backlogRecords = backlogRecords;
+  next.gasFilter = gasFilterReport;
+  next.nodeCount = 0;
+  for (auto &n : nodes) {
+    if (!n.active) continue;
+    NodeSummary &o = next.nodes[next.nodeCount++];
+    strlcpy(o.ip, n.ip.c_str(), sizeof(o.ip));
+    o.connectedAt = n.connectedAt;
+    o.lastSeen = n.lastSeen;
+    o.messages = n.messages;
+    o.framesLost = n.framesLost;
+    o.binary = n.binary;
+    o.clockSynced = n.clockSynced;
+    o.clockOffsetMs = n.clockOffsetMs;
+    o.clockRttMs = n.clockRttMs;
+    o.clockSamples = n.clockSamples;
+  }
+  // The LCD shows the address the ESP8266 reported, else the socket's peer
+  const char* ip = esp8266_actual_ip.length() ? esp8266_actual_ip.c_str() : next.nodeCount ? next.nodes[0].ip : "";
+  strlcpy(next.nodeIp, ip, sizeof(next.nodeIp));
+
+  portENTER_CRITICAL(&snapshotLock);
+  next.version = published.version + 1;
+  published = next;
+  portEXIT_CRITICAL(&snapshotLock);
+  snapshotDirty = false;
+}
+
+// Any task: a consistent copy of the latest snapshot
+void readSnapshot(Snapshot &out) {
+  portENTER_CRITICAL(&snapshotLock);
+  out = published;
+  portEXIT_CRITICAL(&snapshotLock);
+}
 
 // ------------------------ Utility Functions --------------------------
 void setRelay(int pin, bool state) {
@@ -137,6 +785,7 @@ void saveRelayStates() {
   EEPROM.write(ADDR_THRESH_TEMP, TEMP_THRESHOLD);
   EEPROM.write(ADDR_THRESH_GAS, GAS_THRESHOLD);
   EEPROM.write(ADDR_THRESH_SOUND, SOUND_THRESHOLD);
+  EEPROM.write(ADDR_ALERT_REARM, constrain(ALERT_REARM_SEC, 0, 254));
   EEPROM.commit();
 }
 
@@ -149,24 +798,65 @@ void loadRelayStates() {
   TEMP_THRESHOLD = EEPROM.read(ADDR_THRESH_TEMP);
   GAS_THRESHOLD = EEPROM.read(ADDR_THRESH_GAS);
   SOUND_THRESHOLD = EEPROM.read(ADDR_THRESH_SOUND);
+  if (EEPROM.read(ADDR_ALERT_REARM) != 0xFF) ALERT_REARM_SEC = EEPROM.read(ADDR_ALERT_REARM);
+}
+
+void saveDeadbands() {
+  EEPROM.write(ADDR_RBE, RBE_ENABLED);
+  EEPROM.write(ADDR_DB_TEMP, constrain((int)lroundf(TEMP_DEADBAND * 10), 0, 255));
+  EEPROM.write(ADDR_DB_GAS, constrain(GAS_DEADBAND, 0, 255));
+  EEPROM.write(ADDR_DB_LIGHT, constrain(LIGHT_DEADBAND, 0, 255));
+  EEPROM.write(ADDR_DB_DIST, constrain(DIST_DEADBAND, 0, 255));
+  EEPROM.write(ADDR_HEARTBEAT, constrain(HEARTBEAT_SEC, 1, 255));
+  EEPROM.commit();
+}
+
+void loadDeadbands() {
+  if (EEPROM.read(ADDR_RBE) == 0xFF) return;
+  RBE_ENABLED = EEPROM.read(ADDR_RBE);
+  TEMP_DEADBAND = EEPROM.read(ADDR_DB_TEMP) / 10.0;
+  GAS_DEADBAND = EEPROM.read(ADDR_DB_GAS);
+  LIGHT_DEADBAND = EEPROM.read(ADDR_DB_LIGHT);
+  DIST_DEADBAND = EEPROM.read(ADDR_DB_DIST);
+  HEARTBEAT_SEC = EEPROM.read(ADDR_HEARTBEAT);
+}
+
+String thresholdsMessage() {
+  return "THRESHOLDS:TEMP=" + String(TEMP_THRESHOLD) + ",GAS=" + String(GAS_THRESHOLD) + ",SOUND=" + String(SOUND_THRESHOLD) +
+         ",REARM=" + String(ALERT_REARM_SEC);
+}
+
+String deadbandsMessage() {
+  return "DEADBANDS:RBE=" + String(RBE_ENABLED ? 1 : 0) + ",TEMP=" + String(TEMP_DEADBAND, 1) + ",GAS=" + String(GAS_DEADBAND) +
+         ",LIGHT=" + String(LIGHT_DEADBAND) + ",DIST=" + String(DIST_DEADBAND) + ",HEARTBEAT=" + String(HEARTBEAT_SEC);
+}
+
+// With report-by-exception a quiet node only checks in once per heartbeat
+unsigned long sensorTimeoutMs() {
+  return RBE_ENABLED ? max((unsigned long)SENSOR_TIMEOUT, HEARTBEAT_SEC * 1000UL + 5000) : SENSOR_TIMEOUT;
 }
 
 // Save ESP8266 connection settings to EEPROM
 void saveESP8266Settings() {
+  xSemaphoreTake(settingsMutex, portMAX_DELAY);
+  String ip = esp8266_ip;
+  uint16_t port = esp8266_port;
+  xSemaphoreGive(settingsMutex);
+
   // Save IP address length first
-  EEPROM.write(ADDR_ESP8266_IP_LEN, esp8266_ip.length());
+  EEPROM.write(ADDR_ESP8266_IP_LEN, ip.length());
   
   // Save IP address as bytes
-  for (int i = 0; i < esp8266_ip.length(); i++) {
-    EEPROM.write(ADDR_ESP8266_IP + i, esp8266_ip.charAt(i));
+  for (int i = 0; i < ip.length(); i++) {
+    EEPROM.write(ADDR_ESP8266_IP + i, ip.charAt(i));
   }
   
   // Save port (2 bytes)
-  EEPROM.write(ADDR_ESP8266_PORT, esp8266_port & 0xFF);
-  EEPROM.write(ADDR_ESP8266_PORT + 1, (esp8266_port >> 8) & 0xFF);
+  EEPROM.write(ADDR_ESP8266_PORT, port & 0xFF);
+  EEPROM.write(ADDR_ESP8266_PORT + 1, (port >> 8) & 0xFF);
   
   EEPROM.commit();
-  Serial.println("ESP8266 settings saved: " + esp8266_ip + ":" + String(esp8266_port));
+  LG_INFO("ESP8266 settings saved: %s:%u", ip, port);
 }
 
 // Load ESP8266 connection settings from EEPROM
@@ -190,24 +880,33 @@ void loadESP8266Settings() {
     saveESP8266Settings();
   }
   
-  Serial.println("ESP8266 settings loaded: " + esp8266_ip + ":" + String(esp8266_port));
+  LG_INFO("ESP8266 settings loaded: %s:%u", esp8266_ip, esp8266_port);
 }
 
 // Add a struct for log entries
 struct LogEntry {
   unsigned long timestamp;
   String message;
+  uint32_t id;  // Increases by one per entry, survives the oldest being dropped
 };
+#define LOG_MAX_ENTRIES 100
 std::vector<LogEntry> logEntries;
+uint32_t logNextId = 1;
+volatile uint32_t logNewestId = 0;  // Read without the mutex, see newestLogId()
 
+// Called from every task; logEntries is guarded by eventLogMutex
 void logEvent(String msg) {
-  Serial.println(msg);
-  unsigned long now = millis() / 1000; // seconds since boot
-  logEntries.push_back({now, msg});
-  if (logEntries.size() > 100) logEntries.erase(logEntries.begin());
+  LG_INFO("%s", msg);
+  unsigned long now = timelineNow();
+  xSemaphoreTake(eventLogMutex, portMAX_DELAY);
+  logEntries.push_back({now, msg, logNextId++});
+  if (logEntries.size() > LOG_MAX_ENTRIES) logEntries.erase(logEntries.begin());
+  logNewestId = logEntries.back().id;
+  xSemaphoreGive(eventLogMutex);
 }
 
-void notifyTelegram(String msg) {
+// Runs on notifyTask: the HTTPS request takes seconds on a bad link
+void sendTelegram(const char* msg) {
   HTTPClient http;
   String url = "https://api.telegram.org/bot" + botToken + "/sendMessage?chat_id=" + chatID + "&text=" + msg;
   http.begin(url);
@@ -215,19 +914,39 @@ void notifyTelegram(String msg) {
   http.end();
 }
 
+// Queues a Telegram message for notifyTask; never blocks the caller
+void notifyTelegram(const char* msg) {
+  TelegramMessage m;
+  strlcpy(m.text, msg, sizeof(m.text));
+  if (xQueueSend(notifyQueue, &m, 0) != pdTRUE) {
+    queueDrops++;
+    LG_WARN("⚠️ Telegram queue full, dropped: %s", msg);
+  }
+}
+
 void setLEDs(bool red, bool white, bool green) {
   digitalWrite(LED_RED, red ? HIGH : LOW);
   digitalWrite(LED_WHITE, white ? HIGH : LOW);
   digitalWrite(LED_GREEN, green ? HIGH : LOW);
 }
 
+// Buzzer pattern, stepped by serviceBuzzer() so automation never sleeps
+int buzzerSteps = 0;
+int buzzerStepMs = 0;
+unsigned long buzzerLastStep = 0;
+
 void blinkBuzzer(int times, int delayMs) {
-  for (int i = 0; i < times; i++) {
-    setRelay(RELAY4, true);
-    delay(delayMs);
-    setRelay(RELAY4, false);
-    delay(delayMs);
-  }
+  setRelay(RELAY4, true);
+  buzzerSteps = times * 2 - 1;
+  buzzerStepMs = delayMs;
+  buzzerLastStep = millis();
+}
+
+void serviceBuzzer() {
+  if (buzzerSteps <= 0 || millis() - buzzerLastStep < (unsigned long)buzzerStepMs) return;
+  setRelay(RELAY4, !getRelayState(RELAY4));
+  buzzerSteps--;
+  buzzerLastStep = millis();
 }
 
 // LCD Display Functions
@@ -244,6 +963,8 @@ void initLCD() {
 }
 
 void updateLCD() {
+  Snapshot s;
+  readSnapshot(s);
   lcd.clear();
   
   // Line 1: ESP32 IP and status
@@ -253,1541 +974,2126 @@ void updateLCD() {
   
   // Line 2: ESP8266 connection status
   lcd.setCursor(0, 1);
-  if (esp8266_connected) {
+  if (s.nodeConnected) {
     lcd.print("ESP8266: ");
-    if (esp8266_actual_ip.length() > 0) {
-      lcd.print(esp8266_actual_ip);
-    } else {
-      lcd.print(esp8266_ip);
-    }
+    lcd.print(s.nodeIp);
   } else {
     lcd.print("ESP8266: Disconnected");
   }
 }
 
-void showLCDMessage(String line1, String line2, int duration = 3000) {
+void drawLCDMessage(const char* line1, const char* line2) {
   lcd.clear();
   lcd.setCursor(0, 0);
   lcd.print(line1);
   lcd.setCursor(0, 1);
   lcd.print(line2);
-  delay(duration);
-  updateLCD();
 }
 
-// Parse sensor data from ESP8266
-void parseSensorData(String data) {
-  if (data.startsWith("DATA:")) {
-    data = data.substring(5); // Remove "DATA:" prefix
-    int tempIndex = data.indexOf("TEMP=");
-    if (tempIndex != -1) {
-      int commaIndex = data.indexOf(",", tempIndex);
-      if (commaIndex != -1) {
-        sensorData.temperature = data.substring(tempIndex + 5, commaIndex).toFloat();
-        tempStats.current = sensorData.temperature;
-        tempStats.sum += sensorData.temperature;
-        tempStats.count++;
-        if (isnan(tempStats.maximum) || sensorData.temperature > tempStats.maximum) tempStats.maximum = sensorData.temperature;
-        if (isnan(tempStats.minimum) || sensorData.temperature < tempStats.minimum) tempStats.minimum = sensorData.temperature;
-        tempStats.average = tempStats.sum / tempStats.count;
-      }
-    }
-    int gasIndex = data.indexOf("GAS=");
-    if (gasIndex != -1) {
-      int commaIndex = data.indexOf(",", gasIndex);
-      if (commaIndex != -1) {
-        sensorData.gasLevel = data.substring(gasIndex + 4, commaIndex).toInt();
-        gasStats.current = sensorData.gasLevel;
-        gasStats.sum += sensorData.gasLevel;
-        gasStats.count++;
-        if (isnan(gasStats.maximum) || sensorData.gasLevel > gasStats.maximum) gasStats.maximum = sensorData.gasLevel;
-        if (isnan(gasStats.minimum) || sensorData.gasLevel < gasStats.minimum) gasStats.minimum = sensorData.gasLevel;
-        gasStats.average = gasStats.sum / gasStats.count;
-      }
-    }
-    int soundIndex = data.indexOf("SOUND=");
-    if (soundIndex != -1) {
-      int commaIndex = data.indexOf(",", soundIndex);
-      if (commaIndex != -1) {
-        sensorData.soundLevel = data.substring(soundIndex + 6, commaIndex).toInt();
-        soundStats.current = sensorData.soundLevel;
-        soundStats.sum += sensorData.soundLevel;
-        soundStats.count++;
-        if (isnan(soundStats.maximum) || sensorData.soundLevel > soundStats.maximum) soundStats.maximum = sensorData.soundLevel;
-        if (isnan(soundStats.minimum) || sensorData.soundLevel < soundStats.minimum) soundStats.minimum = sensorData.soundLevel;
-        soundStats.average = soundStats.sum / soundStats.count;
-      }
-    }
-    int pirIndex = data.indexOf("PIR=");
-    if (pirIndex != -1) {
-      int commaIndex = data.indexOf(",", pirIndex);
-      if (commaIndex != -1) sensorData.motionDetected = (data.substring(pirIndex + 4, commaIndex).toInt() == 1);
-    }
-    int irIndex = data.indexOf("IR=");
-    if (irIndex != -1) {
-      int commaIndex = data.indexOf(",", irIndex);
-      if (commaIndex != -1) sensorData.irTriggered = (data.substring(irIndex + 3, commaIndex).toInt() == 0);
-    }
-    int lightIndex = data.indexOf("LIGHT=");
-    if (lightIndex != -1) {
-      int commaIndex = data.indexOf(",", lightIndex);
-      if (commaIndex != -1) {
-        sensorData.lightLevel = data.substring(lightIndex + 6, commaIndex).toInt();
-        lightStats.current = sensorData.lightLevel;
-        lightStats.sum += sensorData.lightLevel;
-        lightStats.count++;
-        if (isnan(lightStats.maximum) || sensorData.lightLevel > lightStats.maximum) lightStats.maximum = sensorData.lightLevel;
-        if (isnan(lightStats.minimum) || sensorData.lightLevel < lightStats.minimum) lightStats.minimum = sensorData.lightLevel;
-        lightStats.average = lightStats.sum / lightStats.count;
-      }
-    }
-    int distIndex = data.indexOf("DIST=");
-    if (distIndex != -1) {
-      sensorData.distance = data.substring(distIndex + 5).toInt();
-      distStats.current = sensorData.distance;
-      distStats.sum += sensorData.distance;
-      distStats.count++;
-      if (isnan(distStats.maximum) || sensorData.distance > distStats.maximum) distStats.maximum = sensorData.distance;
-      if (isnan(distStats.minimum) || sensorData.distance < distStats.minimum) distStats.minimum = sensorData.distance;
-      distStats.average = distStats.sum / distStats.count;
-    }
-    lastSensorUpdate = millis();
-    isOnline = true;
-    dataPoints++;
+// Before the tasks start this draws and waits; afterwards it hands the
+// message to displayTask and returns at once
+void showLCDMessage(String line1, String line2, int duration = 3000) {
+  if (!lcdQueue) {
+    drawLCDMessage(line1.c_str(), line2.c_str());
+    delay(duration);
+    updateLCD();
+    return;
   }
-  // Alerts
-  activeAlerts.clear();
-  if (sensorData.temperature > TEMP_THRESHOLD) activeAlerts.push_back("TEMP_HIGH");
-  if (sensorData.gasLevel > GAS_THRESHOLD) activeAlerts.push_back("GAS_LEAK");
-  if (sensorData.soundLevel == SOUND_THRESHOLD) activeAlerts.push_back("SOUND_EVENT");
-  if (sensorData.motionDetected) activeAlerts.push_back("MOTION_PIR");
-  if (sensorData.irTriggered) activeAlerts.push_back("IR_TRIGGERED");
-  if (sensorData.distance > 0 && sensorData.distance < 200) activeAlerts.push_back("PRESENCE_DETECTED");
-  if (sensorData.lightLevel < 100) activeAlerts.push_back("ROOM_DARK");
+  LcdMessage m;
+  strlcpy(m.line1, line1.c_str(), sizeof(m.line1));
+  strlcpy(m.line2, line2.c_str(), sizeof(m.line2));
+  m.durationMs = duration;
+  if (xQueueSend(lcdQueue, &m, 0) != pdTRUE) queueDrops++;
 }
 
-// ------------------------ API Endpoints --------------------------
-void handleApiSensors() {
-  DynamicJsonDocument doc(1024);
-  doc["temperature"] = isnan(sensorData.temperature) ? NAN : sensorData.temperature;
-  doc["gasLevel"] = isnan(sensorData.gasLevel) ? -1 : sensorData.gasLevel;
-  doc["soundLevel"] = isnan(sensorData.soundLevel) ? -1 : sensorData.soundLevel;
-  doc["motionDetected"] = sensorData.motionDetected;
-  doc["irTriggered"] = sensorData.irTriggered;
-  doc["lightLevel"] = isnan(sensorData.lightLevel) ? -1 : sensorData.lightLevel;
-  doc["distance"] = isnan(sensorData.distance) ? -1 : sensorData.distance;
-  doc["isOnline"] = isOnline;
-  doc["dataPoints"] = dataPoints;
-  JsonArray alerts = doc.createNestedArray("activeAlerts");
-  for (auto &a : activeAlerts) alerts.add(a);
-  // Stats
-  JsonObject stats = doc.createNestedObject("stats");
-  stats["temperature"] = tempStats.count ? tempStats.current : NAN;
-  stats["temperature_avg"] = tempStats.count ? tempStats.average : NAN;
-  stats["temperature_max"] = tempStats.count ? tempStats.maximum : NAN;
-  stats["temperature_min"] = tempStats.count ? tempStats.minimum : NAN;
-  stats["gas"] = gasStats.count ? gasStats.current : NAN;
-  stats["gas_avg"] = gasStats.count ? gasStats.average : NAN;
-  stats["gas_max"] = gasStats.count ? gasStats.maximum : NAN;
-  stats["gas_min"] = gasStats.count ? gasStats.minimum : NAN;
-  stats["sound"] = soundStats.count ? soundStats.current : NAN;
-  stats["sound_avg"] = soundStats.count ? soundStats.average : NAN;
-  stats["sound_max"] = soundStats.count ? soundStats.maximum : NAN;
-  stats["sound_min"] = soundStats.count ? soundStats.minimum : NAN;
-  stats["light"] = lightStats.count ? lightStats.current : NAN;
-  stats["light_avg"] = lightStats.count ? lightStats.average : NAN;
-  stats["light_max"] = lightStats.count ? lightStats.maximum : NAN;
-  stats["light_min"] = lightStats.count ? lightStats.minimum : NAN;
-  stats["distance"] = distStats.count ? distStats.current : NAN;
-  stats["distance_avg"] = distStats.count ? distStats.average : NAN;
-  stats["distance_max"] = distStats.count ? distStats.maximum : NAN;
-  stats["distance_min"] = distStats.count ? distStats.minimum : NAN;
-  // System status
-  String systemStatus = "Normal";
-  if (!isOnline) systemStatus = "Offline";
-  else if (activeAlerts.size() > 0) systemStatus = "Alert";
-  doc["systemStatus"] = systemStatus;
-  // Uptime as human readable
-  int mins = systemUptimeMinutes;
-  String uptimeStr = String(mins) + " minute" + (mins == 1 ? "" : "s");
-  if (mins >= 60) {
-    int hours = mins / 60;
-    int rem = mins % 60;
-    uptimeStr = String(hours) + " hour" + (hours == 1 ? "" : "s");
-    if (rem > 0) uptimeStr += ", " + String(rem) + " min";
-  }
-  doc["uptimeStr"] = uptimeStr;
-  String json;
-  serializeJson(doc, json);
-  server.send(200, "application/json", json);
-}
-
-void handleApiRelays() {
-  DynamicJsonDocument doc(128);
-  doc["relay1"] = getRelayState(RELAY1);
-  doc["relay2"] = getRelayState(RELAY2);
-  doc["relay3"] = getRelayState(RELAY3);
-  doc["relay4"] = getRelayState(RELAY4);
-  doc["autoMode"] = autoMode;
-  String json;
-  serializeJson(doc, json);
-  server.send(200, "application/json", json);
-}
-
-void handleApiLog() {
-  // Return log data as JSON array
-  DynamicJsonDocument doc(1024);
-  JsonArray logs = doc.createNestedArray("logs");
-  for (auto &entry : logEntries) {
-    JsonObject log = logs.createNestedObject();
-    unsigned long mins = entry.timestamp / 60;
-    unsigned long secs = entry.timestamp % 60;
-    char timeStr[8];
-    sprintf(timeStr, "%02lu:%02lu", mins, secs);
-    log["time"] = String(timeStr);
-    log["message"] = entry.message;
-    log["type"] = entry.message.indexOf("ALERT") != -1 ? "alert" : "info";
-  }
-  String json;
-  serializeJson(doc, json);
-  server.send(200, "application/json", json);
-}
-
-void handleApiUptime() {
-  DynamicJsonDocument doc(128);
-  doc["uptime"] = String(systemUptimeMinutes) + " minutes";
-  String json;
-  serializeJson(doc, json);
-  server.send(200, "application/json", json);
+void updateSensorStats(SensorStats &stats, float value) {
+  stats.current = value;
+  stats.sum += value;
+  stats.count++;
+  if (isnan(stats.maximum) || value > stats.maximum) stats.maximum = value;
+  if (isnan(stats.minimum) || value < stats.minimum) stats.minimum = value;
+  stats.average = stats.sum / stats.count;
 }
 
-// Handle relay toggle via API
-void handleApiRelayToggle() {
-  String uri = server.uri();
-  int relayNumber = 0;
-  if (uri.indexOf("/api/relay/1/toggle") != -1) relayNumber = 1;
-  else if (uri.indexOf("/api/relay/2/toggle") != -1) relayNumber = 2;
-  else if (uri.indexOf("/api/relay/3/toggle") != -1) relayNumber = 3;
-  else if (uri.indexOf("/api/relay/4/toggle") != -1) relayNumber = 4;
-  
-  if (relayNumber > 0 && !autoMode) {
-    int pin = (relayNumber == 1) ? RELAY1 : (relayNumber == 2) ? RELAY2 : (relayNumber == 3) ? RELAY3 : RELAY4;
-    bool newState = !getRelayState(pin);
-    setRelay(pin, newState);
-    saveRelayStates();
-    logEvent("Relay " + String(relayNumber) + " toggled via API");
-    
-    DynamicJsonDocument doc(128);
-    doc["state"] = newState;
-    doc["relay"] = relayNumber;
-    String json;
-    serializeJson(doc, json);
-    server.send(200, "application/json", json);
-  } else {
-    server.send(400, "text/plain", "Invalid request or auto mode active");
-  }
+void updateActiveAlerts() {
+  uint8_t a = 0;
+  if (sensorData.temperature > TEMP_THRESHOLD) a |= 1 << 0;
+  if (sensorData.gasLevel > GAS_THRESHOLD) a |= 1 << 1;
+  if (sensorData.soundLevel == SOUND_THRESHOLD) a |= 1 << 2;
+  if (sensorData.motionDetected) a |= 1 << 3;
+  if (sensorData.irTriggered) a |= 1 << 4;
+  if (sensorData.distance > 0 && sensorData.distance < 200) a |= 1 << 5;
+  if (sensorData.lightLevel < 100) a |= 1 << 6;
+  activeAlerts = a;
 }
 
-// Handle mode toggle via API
-void handleApiModeToggle() {
-  autoMode = !autoMode;
-  EEPROM.write(ADDR_MODE, autoMode);
-  EEPROM.commit();
-  logEvent("Mode changed to " + String(autoMode ? "Auto" : "Manual"));
-  
-  DynamicJsonDocument doc(128);
-  doc["mode"] = autoMode ? "Auto" : "Manual";
-  String json;
-  serializeJson(doc, json);
-  server.send(200, "application/json", json);
+// Parse sensor data from ESP8266
+// Parses a KEY=VALUE body, counting and logging malformed lines
+bool parseTextFields(const char* body, const LgKvField* fields, uint8_t count, uint32_t* seen) {
+  const char* errorAt = nullptr;
+  LgKvStatus status = lgParseKv(body, fields, count, seen, &errorAt);
+  if (status == LG_KV_OK) return true;
+  textErrors++;
+  logEvent("Malformed message from ESP8266 (" + String(lgKvStatusName(status)) + "): " + String(errorAt));
+  return false;
 }
 
-// Handle all relays ON via API
-void handleApiAllOn() {
-  if (!autoMode) {
-    setRelay(RELAY1, true);
-    setRelay(RELAY2, true);
-    setRelay(RELAY3, true);
-    setRelay(RELAY4, true);
-    saveRelayStates();
-    logEvent("All relays turned ON via API");
-  }
-  server.send(200, "text/plain", "OK");
+// ---------------------- Latency Tracing ----------------------
+void recordLatency(LatencyStage stage, unsigned long us) {
+  LatencyHistogram &h = latency[stage];
+  uint8_t b = 0;
+  while (b < LAT_BUCKETS - 1 && us > LAT_BUCKET_US[b]) b++;
+  portENTER_CRITICAL(&latencyLock);
+  h.buckets[b]++;
+  h.count++;
+  h.sumUs += us;
+  if (us > h.maxUs) h.maxUs = us;
+  portEXIT_CRITICAL(&latencyLock);
 }
 
-// Handle all relays OFF via API
-void handleApiAllOff() {
-  if (!autoMode) {
-    setRelay(RELAY1, false);
-    setRelay(RELAY2, false);
-    setRelay(RELAY3, false);
-    setRelay(RELAY4, false);
-    saveRelayStates();
-    logEvent("All relays turned OFF via API");
+void resetLatency() {
+  portENTER_CRITICAL(&latencyLock);
+  for (auto &h : latency) {
+    memset(h.buckets, 0, sizeof(h.buckets));
+    h.count = 0;
+    h.sumUs = 0;
+    h.maxUs = 0;
   }
-  server.send(200, "text/plain", "OK");
+  portEXIT_CRITICAL(&latencyLock);
 }
 
-// Handle settings save via API
-void handleApiSettings() {
-  if (server.hasArg("plain")) {
-    String body = server.arg("plain");
-    DynamicJsonDocument doc(512);
-    deserializeJson(doc, body);
-    
-    if (doc.containsKey("tempThreshold")) TEMP_THRESHOLD = doc["tempThreshold"];
-    if (doc.containsKey("gasThreshold")) GAS_THRESHOLD = doc["gasThreshold"];
-    if (doc.containsKey("soundThreshold")) SOUND_THRESHOLD = doc["soundThreshold"];
-    
-    EEPROM.write(ADDR_THRESH_TEMP, TEMP_THRESHOLD);
-    EEPROM.write(ADDR_THRESH_GAS, GAS_THRESHOLD);
-    EEPROM.write(ADDR_THRESH_SOUND, SOUND_THRESHOLD);
-    EEPROM.commit();
-    
-    logEvent("Settings updated via API");
-    // Send new thresholds to ESP8266 if connected
-    if (client && client.connected()) {
-      String threshMsg = "THRESHOLDS:TEMP=" + String(TEMP_THRESHOLD) + ",GAS=" + String(GAS_THRESHOLD) + ",SOUND=" + String(SOUND_THRESHOLD);
-      client.println(threshMsg);
-    }
-    server.send(200, "application/json", "{\"status\":\"saved\"}");
-  } else {
-    server.send(400, "text/plain", "Invalid request");
+// Sequence numbers are shared by text lines and binary frames
+void noteNodeSeq(uint16_t seq) {
+  if (rxNode->haveSeq) {
+    uint16_t gap = seq - rxNode->lastSeq - 1;
+    rxNode->framesLost += gap;
+    framesLost += gap;
   }
+  rxNode->lastSeq = seq;
+  rxNode->haveSeq = true;
 }
 
-// Handle chart data requests (placeholder responses)
-void handleApiChart() {
-  String uri = server.uri();
-  String sensorType = "";
-  String timeRange = "1h";
-  
-  if (uri.indexOf("/temperature") != -1) sensorType = "temperature";
-  else if (uri.indexOf("/gas") != -1) sensorType = "gas";
-  else if (uri.indexOf("/light") != -1) sensorType = "light";
-  else if (uri.indexOf("/sound") != -1) sensorType = "sound";
-  else if (uri.indexOf("/distance") != -1) sensorType = "distance";
-  
-  if (uri.indexOf("/1h") != -1) timeRange = "1h";
-  else if (uri.indexOf("/6h") != -1) timeRange = "6h";
-  else if (uri.indexOf("/24h") != -1) timeRange = "24h";
-  else if (uri.indexOf("/7d") != -1) timeRange = "7d";
-  
-  // Return sample chart data
-  DynamicJsonDocument doc(2048);
-  JsonArray labels = doc.createNestedArray("labels");
-  JsonArray values = doc.createNestedArray("values");
-  unsigned long now = millis()/1000;
-  SensorHistoryEntry* hist = nullptr;
-  int idx = 0;
-  if (sensorType == "temperature") { hist = tempHistory; idx = tempHistIdx; doc["unit"] = "°C"; doc["color"] = "#ef4444"; }
-  else if (sensorType == "gas") { hist = gasHistory; idx = gasHistIdx; doc["unit"] = "ppm"; doc["color"] = "#f59e0b"; }
-  else if (sensorType == "light") { hist = lightHistory; idx = lightHistIdx; doc["unit"] = "lux"; doc["color"] = "#f97316"; }
-  else if (sensorType == "sound") { hist = soundHistory; idx = soundHistIdx; doc["unit"] = "dB"; doc["color"] = "#8b5cf6"; }
-  else if (sensorType == "distance") { hist = distHistory; idx = distHistIdx; doc["unit"] = "cm"; doc["color"] = "#6366f1"; }
-  doc["label"] = sensorType;
-  if (hist) {
-    for (int i = 0; i < HISTORY_SIZE; i++) {
-      int realIdx = (idx + i) % HISTORY_SIZE;
-      if (!isnan(hist[realIdx].value) && hist[realIdx].timestamp > 0) {
-        labels.add(String(hist[realIdx].timestamp));
-        values.add(hist[realIdx].value);
-      }
-    }
-  }
-  String json;
-  serializeJson(doc, json);
-  server.send(200, "application/json", json);
+// Send and network stages, once rxTrace.nodeMs/ageMs are known
+// (millis() values wrap: differences are taken in uint32_t)
+void traceReceived() {
+  if (rxTrace.haveAge) recordLatency(LAT_ACQUIRE_TO_SEND, rxTrace.ageMs * 1000UL);
+  if (!rxTrace.haveTime || !rxNode->clockSynced) return;
+  uint32_t sentAt = rxTrace.nodeMs - (uint32_t)rxNode->clockOffsetMs;  // Our millis()
+  int32_t network = (int32_t)((uint32_t)rxTrace.rxMs - sentAt);
+  recordLatency(LAT_NETWORK, max(network, (int32_t)0) * 1000UL);
 }
 
-// Handle trend data requests (placeholder responses)
-void handleApiTrend() {
-  DynamicJsonDocument doc(1024);
-  doc["labels"] = JsonArray();
-  doc["datasets"] = JsonArray();
-  
-  JsonObject dataset = doc["datasets"].createNestedObject();
-  dataset["label"] = "Current Values";
-  dataset["data"] = JsonArray();
-  dataset["backgroundColor"] = JsonArray();
-  dataset["borderColor"] = JsonArray();
-  
-  // Add sensor data
-  dataset["data"].add(sensorData.temperature);
-  dataset["data"].add(sensorData.gasLevel);
-  dataset["data"].add(sensorData.lightLevel);
-  dataset["data"].add(sensorData.soundLevel);
-  
-  // Add colors
-  dataset["backgroundColor"].add("#ef4444");
-  dataset["backgroundColor"].add("#f59e0b");
-  dataset["backgroundColor"].add("#f97316");
-  dataset["backgroundColor"].add("#8b5cf6");
-  dataset["borderColor"].add("#ef4444");
-  dataset["borderColor"].add("#f59e0b");
-  dataset["borderColor"].add("#f97316");
-  dataset["borderColor"].add("#8b5cf6");
-  
-  String response;
-  serializeJson(doc, response);
-  server.send(200, "application/json", response);
+// A reading has been applied: starts the actuation and publish stages
+void traceParsed() {
+  rxTrace.parsedUs = micros();
+  recordLatency(LAT_PARSE, rxTrace.parsedUs - rxTrace.rxUs);
+  bool known = rxTrace.haveTime && rxTrace.haveAge && rxNode->clockSynced;
+  portENTER_CRITICAL(&latencyLock);
+  publishPending = true;
+  publishParsedUs = rxTrace.parsedUs;
+  publishAcquireKnown = known;
+  if (known) publishAcquireMs = rxTrace.nodeMs - rxTrace.ageMs - (uint32_t)rxNode->clockOffsetMs;
+  portEXIT_CRITICAL(&latencyLock);
 }
 
-// Handle ESP8266 configuration
-void handleApiESP8266Config() {
-  if (server.method() == HTTP_POST) {
-    // Save new ESP8266 settings
-    String newIP = server.arg("ip");
-    int newPort = server.arg("port").toInt();
-    
-    if (newIP.length() > 0 && newPort > 0) {
-      esp8266_ip = newIP;
-      esp8266_port = newPort;
-      saveESP8266Settings();
-      
-      DynamicJsonDocument doc(256);
-      doc["success"] = true;
-      doc["message"] = "ESP8266 settings updated";
-      doc["ip"] = esp8266_ip;
-      doc["port"] = esp8266_port;
-      
-      String response;
-      serializeJson(doc, response);
-      server.send(200, "application/json", response);
-      
-      showLCDMessage("ESP8266 Config", "Updated Successfully");
-    } else {
-      server.send(400, "application/json", "{\"success\":false,\"message\":\"Invalid IP or port\"}");
-    }
-  } else {
-    // Return current ESP8266 settings
-    DynamicJsonDocument doc(256);
-    doc["ip"] = esp8266_ip;
-    doc["port"] = esp8266_port;
-    doc["connected"] = esp8266_connected;
-    
-    String response;
-    serializeJson(doc, response);
-    server.send(200, "application/json", response);
-  }
+// A relay/buzzer was switched in response to the current message
+void traceActuation() {
+  recordLatency(LAT_ACTUATION, micros() - rxTrace.rxUs);
 }
 
-// ------------------------ Modern HTML Dashboard --------------------------
-String htmlPage() {
-  String html = R"rawliteral(
-<!DOCTYPE html>
-<html lang="en">
-<head>
-  <meta charset="UTF-8">
-  <meta name="viewport" content="width=device-width, initial-scale=1.0">
-  <title>LabGuard+ Dashboard</title>
-  <link href="https://fonts.googleapis.com/css2?family=Inter:wght@300;400;500;600;700&display=swap" rel="stylesheet">
-  <link href="https://cdnjs.cloudflare.com/ajax/libs/font-awesome/6.4.0/css/all.min.css" rel="stylesheet">
-  <script src="https://cdn.jsdelivr.net/npm/chart.js"></script>
-  <style>
-    :root{--primary-color:#2563eb;--primary-dark:#1d4ed8;--secondary-color:#64748b;--success-color:#10b981;--warning-color:#f59e0b;--danger-color:#ef4444;--background:#f8fafc;--surface:#ffffff;--text-primary:#1e293b;--text-secondary:#64748b;--border-color:#e2e8f0;--shadow-sm:0 1px 2px 0 rgb(0 0 0/0.05);--shadow-md:0 4px 6px-1px rgb(0 0 0/0.1),0 2px 4px-2px rgb(0 0 0/0.1);--shadow-lg:0 10px 15px-3px rgb(0 0 0/0.1),0 4px 6px-4px rgb(0 0 0/0.1);--shadow-xl:0 20px 25px-5px rgb(0 0 0/0.1),0 8px 10px-6px rgb(0 0 0/0.1)}*{margin:0;padding:0;box-sizing:border-box}
-body{font-family:'Inter',-apple-system,BlinkMacSystemFont,'Segoe UI',Roboto,sans-serif;background:var(--background);color:var(--text-primary);line-height:1.6;overflow-x:hidden}.container{max-width:1400px;margin:0 auto;padding:2rem}.header{text-align:center;margin-bottom:3rem;position:relative}.header::after{content:'';position:absolute;bottom:-1rem;left:50%;transform:translateX(-50%);width:60px;height:4px;background:linear-gradient(90deg,var(--primary-color),var(--success-color));border-radius:2px}.logo{display:flex;align-items:center;justify-content:center;gap:1rem;margin-bottom:1rem}.logo-icon{width:48px;height:48px;background:linear-gradient(135deg,var(--primary-color),var(--primary-dark));border-radius:12px;display:flex;align-items:center;justify-content:center;color:white;font-size:1.5rem;box-shadow:var(--shadow-lg)}
-h1{font-size:2.5rem;font-weight:700;background:linear-gradient(135deg,var(--primary-color),var(--primary-dark));-webkit-background-clip:text;-webkit-text-fill-color:transparent;background-clip:text;margin:0}.subtitle{color:var(--text-secondary);font-size:1.1rem;font-weight:400;margin-top:0.5rem}.dashboard{display:grid;grid-template-columns:repeat(auto-fit,minmax(350px,1fr));gap:2rem;margin-bottom:2rem}.card{background:var(--surface);border-radius:16px;padding:1.5rem;box-shadow:var(--shadow-md);border:1px solid var(--border-color);transition:all 0.3s cubic-bezier(0.4,0,0.2,1);position:relative;overflow:hidden}.card::before{content:'';position:absolute;top:0;left:0;right:0;height:4px;background:linear-gradient(90deg,var(--primary-color),var(--success-color))}.card:hover{transform:translateY(-4px);box-shadow:var(--shadow-xl)}.card-header{display:flex;align-items:center;gap:0.75rem;margin-bottom:1.5rem}.card-icon{width:40px;height:40px;border-radius:10px;display:flex;align-items:center;justify-content:center;color:white;font-size:1.1rem}.card-icon.primary{background:linear-gradient(135deg,var(--primary-color),var(--primary-dark))}.card-icon.success{background:linear-gradient(135deg,var(--success-color),#059669)}.card-icon.warning{background:linear-gradient(135deg,var(--warning-color),#d97706)}.card-icon.danger{background:linear-gradient(135deg,var(--danger-color),#dc2626)}.card-icon.analytics{background:linear-gradient(135deg,#8b5cf6,#7c3aed)}.card-icon.trends{background:linear-gradient(135deg,#06b6d4,#0891b2)}.card h3{font-size:1.25rem;font-weight:600;color:var(--text-primary);margin:0}.relay-grid{display:grid;gap:1rem}.relay-item{display:flex;align-items:center;justify-content:space-between;padding:1rem;background:var(--background);border-radius:12px;border:1px solid var(--border-color);transition:all 0.2s ease}.relay-item:hover{border-color:var(--primary-color);background:#f1f5f9}.relay-info{display:flex;align-items:center;gap:0.75rem}.relay-name{font-weight:500;color:var(--text-primary)}.status-indicator{display:flex;align-items:center;gap:0.5rem;font-weight:600}.status-on{color:var(--success-color)}.status-off{color:var(--text-secondary)}.status-dot{width:8px;height:8px;border-radius:50%;background:currentColor;animation:pulse 2s infinite}
-@keyframes pulse{0%,100%{opacity:1}
-50%{opacity:0.5}}.btn{padding:0.75rem 1.5rem;border:none;border-radius:8px;font-weight:500;font-size:0.875rem;cursor:pointer;transition:all 0.2s ease;display:inline-flex;align-items:center;gap:0.5rem;text-decoration:none}.btn-primary{background:var(--primary-color);color:white}.btn-primary:hover{background:var(--primary-dark);transform:translateY(-1px);box-shadow:var(--shadow-md)}.btn-secondary{background:var(--secondary-color);color:white}.btn-secondary:hover{background:#475569;transform:translateY(-1px);box-shadow:var(--shadow-md)}.btn-outline{background:transparent;color:var(--primary-color);border:1px solid var(--primary-color)}.btn-outline:hover{background:var(--primary-color);color:white}.btn-sm{padding:0.5rem 1rem;font-size:0.75rem}.sensor-grid{display:grid;grid-template-columns:repeat(2,1fr);gap:1rem}.sensor-item{display:flex;align-items:center;gap:0.75rem;padding:1rem;background:var(--background);border-radius:12px;border:1px solid var(--border-color)}.sensor-icon{width:32px;height:32px;border-radius:8px;display:flex;align-items:center;justify-content:center;color:white;font-size:0.875rem}.sensor-data{flex:1}.sensor-label{font-size:0.875rem;color:var(--text-secondary);font-weight:500}.sensor-value{font-size:1.125rem;font-weight:600;color:var(--text-primary)}.log-container{max-height:200px;overflow-y:auto;background:var(--background);border-radius:12px;padding:1rem;border:1px solid var(--border-color)}.log-entry{display:flex;align-items:flex-start;gap:0.75rem;padding:0.5rem 0;border-bottom:1px solid var(--border-color);font-size:0.875rem}.log-entry:last-child{border-bottom:none}.log-time{color:var(--text-secondary);font-weight:500;min-width:60px}.log-message{color:var(--text-primary);flex:1}.log-alert{color:var(--danger-color);font-weight:600}.form-group{margin-bottom:1rem}.form-label{display:block;font-weight:500;color:var(--text-primary);margin-bottom:0.5rem}.form-input{width:100%;padding:0.75rem;border:1px solid var(--border-color);border-radius:8px;font-size:0.875rem;transition:border-color 0.2s ease;background:var(--surface)}.form-input:focus{outline:none;border-color:var(--primary-color);box-shadow:0 0 0 3px rgb(37 99 235/0.1)}.footer{text-align:center;padding:2rem 0;color:var(--text-secondary);font-size:0.875rem}.uptime{display:inline-flex;align-items:center;gap:0.5rem;padding:0.5rem 1rem;background:var(--surface);border-radius:20px;box-shadow:var(--shadow-sm);border:1px solid var(--border-color)}.uptime-icon{color:var(--success-color)}
-@media(max-width:768px){.container{padding:1rem}.dashboard{grid-template-columns:1fr;gap:1.5rem}.sensor-grid{grid-template-columns:1fr}
-h1{font-size:2rem}}.log-container::-webkit-scrollbar{width:6px}.log-container::-webkit-scrollbar-track{background:var(--background);border-radius:3px}.log-container::-webkit-scrollbar-thumb{background:var(--border-color);border-radius:3px}.log-container::-webkit-scrollbar-thumb:hover{background:var(--secondary-color)}
-@keyframes fadeInUp{from{opacity:0;transform:translateY(30px)}
-to{opacity:1;transform:translateY(0)}}
-@keyframes slideInLeft{from{opacity:0;transform:translateX(-30px)}
-to{opacity:1;transform:translateX(0)}}
-@keyframes glow{0%,100%{box-shadow:0 0 5px rgba(37,99,235,0.3)}
-50%{box-shadow:0 0 20px rgba(37,99,235,0.6)}}.card{animation:fadeInUp 0.6s ease-out}.card:nth-child(1){animation-delay:0.1s}.card:nth-child(2){animation-delay:0.2s}.card:nth-child(3){animation-delay:0.3s}.card:nth-child(4){animation-delay:0.4s}.header{animation:slideInLeft 0.8s ease-out}.sensor-item:hover{transform:translateY(-2px);box-shadow:var(--shadow-lg);border-color:var(--primary-color)}.sensor-item:hover.sensor-icon{animation:glow 2s infinite}.status-badge{display:inline-flex;align-items:center;gap:0.25rem;padding:0.25rem 0.75rem;border-radius:20px;font-size:0.75rem;font-weight:600;text-transform:uppercase;letter-spacing:0.5px}.status-badge.online{background:rgba(16,185,129,0.1);color:var(--success-color);border:1px solid rgba(16,185,129,0.2)}.status-badge.offline{background:rgba(100,116,139,0.1);color:var(--text-secondary);border:1px solid rgba(100,116,139,0.2)}.status-badge.warning{background:rgba(245,158,11,0.1);color:var(--warning-color);border:1px solid rgba(245,158,11,0.2)}.status-badge.danger{background:rgba(239,68,68,0.1);color:var(--danger-color);border:1px solid rgba(239,68,68,0.2)}.progress-bar{width:100%;height:6px;background:var(--border-color);border-radius:3px;overflow:hidden;margin-top:0.5rem}.progress-fill{height:100%;border-radius:3px;transition:width 0.3s ease}.progress-fill.temp{background:linear-gradient(90deg,#ef4444,#f97316)}.progress-fill.gas{background:linear-gradient(90deg,#f59e0b,#eab308)}.progress-fill.sound{background:linear-gradient(90deg,#8b5cf6,#a855f7)}.progress-fill.light{background:linear-gradient(90deg,#f97316,#ea580c)}.btn-group{display:flex;gap:0.5rem;margin-top:1rem}.btn-sm{padding:0.5rem 1rem;font-size:0.75rem}.loading{display:inline-block;width:16px;height:16px;border:2px solid var(--border-color);border-radius:50%;border-top-color:var(--primary-color);animation:spin 1s ease-in-out infinite}
-@keyframes spin{to{transform:rotate(360deg)}}.tooltip{position:relative;cursor:help}.tooltip::after{content:attr(data-tooltip);position:absolute;bottom:100%;left:50%;transform:translateX(-50%);background:var(--text-primary);color:white;padding:0.5rem;border-radius:6px;font-size:0.75rem;white-space:nowrap;opacity:0;pointer-events:none;transition:opacity 0.2s ease;z-index:1000}.tooltip:hover::after{opacity:1}.theme-toggle{position:fixed;top:2rem;right:2rem;z-index:1000}.theme-toggle.btn{width:48px;height:48px;border-radius:50%;padding:0;display:flex;align-items:center;justify-content:center;background:var(--surface);border:1px solid var(--border-color);box-shadow:var(--shadow-md)}
-@media(max-width:1024px){.dashboard{grid-template-columns:repeat(2,1fr)}}
-@media(max-width:768px){.container{padding:1rem}.dashboard{grid-template-columns:1fr;gap:1.5rem}.sensor-grid{grid-template-columns:1fr}
-h1{font-size:2rem}.theme-toggle{top:1rem;right:1rem}}
-body.dark-theme{--background:#0f172a;--surface:#1e293b;--text-primary:#f1f5f9;--text-secondary:#94a3b8;--border-color:#334155}
-body.dark-theme.card{background:var(--surface);border-color:var(--border-color)}
-body.dark-theme.sensor-item,body.dark-theme.relay-item,body.dark-theme.log-container{background:var(--background);border-color:var(--border-color)}
-body.dark-theme.form-input{background:var(--background);border-color:var(--border-color);color:var(--text-primary)}
-body.dark-theme.uptime{background:var(--surface);border-color:var(--border-color)}.chart-container{position:relative;height:300px;margin-top:1rem}.chart-tabs{display:flex;gap:0.5rem;margin-bottom:1rem;border-bottom:1px solid var(--border-color);padding-bottom:0.5rem}.chart-tab{padding:0.5rem 1rem;border:none;background:transparent;color:var(--text-secondary);border-radius:6px;cursor:pointer;font-size:0.875rem;font-weight:500;transition:all 0.2s ease}.chart-tab.active{background:var(--primary-color);color:white}.chart-tab:hover:not(.active){background:var(--background);color:var(--text-primary)}.chart-tab.active{background:var(--primary-color);color:white}.chart-stats{display:grid;grid-template-columns:repeat(auto-fit,minmax(120px,1fr));gap:1rem;margin-top:1rem;padding-top:1rem;border-top:1px solid var(--border-color)}.stat-item{text-align:center;padding:0.75rem;background:var(--background);border-radius:8px;border:1px solid var(--border-color)}.stat-value{font-size:1.5rem;font-weight:700;color:var(--primary-color);margin-bottom:0.25rem}.stat-label{font-size:0.75rem;color:var(--text-secondary);text-transform:uppercase;letter-spacing:0.5px}.chart-controls{display:flex;gap:0.5rem;margin-bottom:1rem}.chart-btn{padding:0.25rem 0.75rem;border:1px solid var(--border-color);background:var(--surface);color:var(--text-primary);border-radius:4px;font-size:0.75rem;cursor:pointer;transition:all 0.2s ease}.chart-btn:hover,.chart-btn.active{background:var(--primary-color);color:white;border-color:var(--primary-color)}
-  </style>
-</head>
-<body>
-  <div class="theme-toggle">
-    <button class="btn" onclick="toggleTheme()" data-tooltip="Toggle Dark Mode">
-      <i class="fas fa-moon"></i>
-    </button>
-  </div>
-
-  <div class="container">
-    <header class="header">
-      <div class="logo">
-        <div class="logo-icon">
-          <i class="fas fa-shield-alt"></i>
-        </div>
-        <h1>LabGuard+</h1>
-      </div>
-      <p class="subtitle">Advanced Laboratory Monitoring&Control System</p>
-      <div style="margin-top: 1rem;">
-        <span class="status-badge online">
-          <i class="fas fa-circle" style="font-size: 0.5rem;"></i>
-          System Online
-        </span>
-        <span class="status-badge warning" style="margin-left: 0.5rem;">
-          <i class="fas fa-exclamation-triangle" style="font-size: 0.5rem;"></i>
-          2 Alerts Active
-        </span>
-      </div>
-    </header>
-
-    <div class="dashboard">
-      <div class="card">
-        <div class="card-header">
-          <div class="card-icon primary">
-            <i class="fas fa-toggle-on"></i>
-          </div>
-          <h3>Relay Control (<span id="modeDisplay">Auto</span>)</h3>
-        </div>
-        <div class="relay-grid">
-          <div class="relay-item">
-            <div class="relay-info">
-              <i class="fas fa-plug" id="relay1Icon" style="color: var(--primary-color);"></i>
-              <span class="relay-name">Relay 1</span>
-            </div>
-            <div class="relay-controls">
-              <span class="status-indicator status-on" id="relay1Status">
-                <span class="status-dot"></span>ON
-              </span>
-              <button class="btn btn-outline" onclick="toggleRelay(1)" style="margin-left: 1rem;">
-                <i class="fas fa-sync-alt"></i>Toggle
-              </button>
-            </div>
-          </div>
-          
-          <div class="relay-item">
-            <div class="relay-info">
-              <i class="fas fa-plug" id="relay2Icon" style="color: var(--text-secondary);"></i>
-              <span class="relay-name">Relay 2</span>
-            </div>
-            <div class="relay-controls">
-              <span class="status-indicator status-off" id="relay2Status">
-                <span class="status-dot"></span>OFF
-              </span>
-              <button class="btn btn-outline" onclick="toggleRelay(2)" style="margin-left: 1rem;">
-                <i class="fas fa-sync-alt"></i>Toggle
-              </button>
-            </div>
-          </div>
-          
-          <div class="relay-item">
-            <div class="relay-info">
-              <i class="fas fa-plug" id="relay3Icon" style="color: var(--primary-color);"></i>
-              <span class="relay-name">Relay 3</span>
-            </div>
-            <div class="relay-controls">
-              <span class="status-indicator status-on" id="relay3Status">
-                <span class="status-dot"></span>ON
-              </span>
-              <button class="btn btn-outline" onclick="toggleRelay(3)" style="margin-left: 1rem;">
-                <i class="fas fa-sync-alt"></i>Toggle
-              </button>
-            </div>
-          </div>
-          
-          <div class="relay-item">
-            <div class="relay-info">
-              <i class="fas fa-plug" id="relay4Icon" style="color: var(--text-secondary);"></i>
-              <span class="relay-name">Relay 4</span>
-            </div>
-            <div class="relay-controls">
-              <span class="status-indicator status-off" id="relay4Status">
-                <span class="status-dot"></span>OFF
-              </span>
-              <button class="btn btn-outline" onclick="toggleRelay(4)" style="margin-left: 1rem;">
-                <i class="fas fa-sync-alt"></i>Toggle
-              </button>
-            </div>
-          </div>
-        </div>
-        <div class="btn-group">
-          <button class="btn btn-primary btn-sm" onclick="toggleMode()">
-            <i class="fas fa-cogs"></i>Toggle Mode
-          </button>
-          <button class="btn btn-secondary btn-sm" onclick="allOn()">
-            <i class="fas fa-power-off"></i>All ON
-          </button>
-          <button class="btn btn-outline btn-sm" onclick="allOff()">
-            <i class="fas fa-stop"></i>All OFF
-          </button>
-        </div>
-      </div>
-
-      <div class="card">
-        <div class="card-header">
-          <div class="card-icon success">
-            <i class="fas fa-chart-line"></i>
-          </div>
-          <h3>Sensor Data</h3>
-        </div>
-        <div class="sensor-grid">
-          <div class="sensor-item tooltip" data-tooltip="Current ambient temperature">
-            <div class="sensor-icon" style="background: linear-gradient(135deg, #ef4444, #dc2626);">
-              <i class="fas fa-thermometer-half"></i>
-            </div>
-            <div class="sensor-data">
-              <div class="sensor-label">Temperature</div>
-              <div class="sensor-value" id="tempValue">No Data</div>
-              <div class="progress-bar">
-                <div class="progress-fill temp" id="tempProgress" style="width: 0%;"></div>
-              </div>
-            </div>
-          </div>
-          
-          <div class="sensor-item tooltip" data-tooltip="Gas concentration in parts per million">
-            <div class="sensor-icon" style="background: linear-gradient(135deg, #f59e0b, #d97706);">
-              <i class="fas fa-wind"></i>
-            </div>
-            <div class="sensor-data">
-              <div class="sensor-label">Gas Level</div>
-              <div class="sensor-value" id="gasValue">No Data</div>
-              <div class="progress-bar">
-                <div class="progress-fill gas" id="gasProgress" style="width: 0%;"></div>
-              </div>
-            </div>
-          </div>
-          
-          <div class="sensor-item tooltip" data-tooltip="Ambient sound level in decibels">
-            <div class="sensor-icon" style="background: linear-gradient(135deg, #8b5cf6, #7c3aed);">
-              <i class="fas fa-volume-up"></i>
-            </div>
-            <div class="sensor-data">
-              <div class="sensor-label">Sound Level</div>
-              <div class="sensor-value" id="soundValue">No Data</div>
-              <div class="progress-bar">
-                <div class="progress-fill sound" id="soundProgress" style="width: 0%;"></div>
-              </div>
-            </div>
-          </div>
-          
-          <div class="sensor-item tooltip" data-tooltip="Passive Infrared motion detection">
-            <div class="sensor-icon" style="background: linear-gradient(135deg, #06b6d4, #0891b2);">
-              <i class="fas fa-user"></i>
-            </div>
-            <div class="sensor-data">
-              <div class="sensor-label">Motion (PIR)</div>
-              <div class="sensor-value" id="pirValue">No Data</div>
-            </div>
-          </div>
-          
-          <div class="sensor-item tooltip" data-tooltip="Infrared proximity sensor">
-            <div class="sensor-icon" style="background: linear-gradient(135deg, #84cc16, #65a30d);">
-              <i class="fas fa-eye"></i>
-            </div>
-            <div class="sensor-data">
-              <div class="sensor-label">IR Sensor</div>
-              <div class="sensor-value" id="irValue">No Data</div>
-            </div>
-          </div>
-          
-          <div class="sensor-item tooltip" data-tooltip="Ambient light intensity in lux">
-            <div class="sensor-icon" style="background: linear-gradient(135deg, #f97316, #ea580c);">
-              <i class="fas fa-sun"></i>
-            </div>
-            <div class="sensor-data">
-              <div class="sensor-label">Light Level</div>
-              <div class="sensor-value" id="lightValue">No Data</div>
-              <div class="progress-bar">
-                <div class="progress-fill light" id="lightProgress" style="width: 0%;"></div>
-              </div>
-            </div>
-          </div>
-          
-          <div class="sensor-item tooltip" data-tooltip="Ultrasonic distance measurement" style="grid-column: span 2;">
-            <div class="sensor-icon" style="background: linear-gradient(135deg, #6366f1, #4f46e5);">
-              <i class="fas fa-ruler-vertical"></i>
-            </div>
-            <div class="sensor-data">
-              <div class="sensor-label">Distance</div>
-              <div class="sensor-value" id="distanceValue">No Data</div>
-              <div class="progress-bar">
-                <div class="progress-fill" id="distanceProgress" style="width: 0%; background: linear-gradient(90deg, #6366f1, #4f46e5);"></div>
-              </div>
-            </div>
-          </div>
-        </div>
-      </div>
-
-      <div class="card">
-        <div class="card-header">
-          <div class="card-icon warning">
-            <i class="fas fa-terminal"></i>
-          </div>
-          <h3>System Log</h3>
-        </div>
-        <div class="log-container" id="logContainer">
-          <!-- No demo log entries, will be filled by JS -->
-        </div>
-      </div>
-
-      <!-- ESP8266 Configuration Card -->
-      <div class="card">
-        <div class="card-header">
-          <div class="card-icon primary">
-            <i class="fas fa-network-wired"></i>
-          </div>
-          <h3>ESP8266 Configuration</h3>
-        </div>
-        <form id="esp8266ConfigForm" onsubmit="saveESP8266Config(event)">
-          <div class="form-group">
-            <label class="form-label">
-              <i class="fas fa-server" style="margin-right: 0.5rem; color: var(--primary-color);"></i>
-              ESP8266 IP Address
-            </label>
-            <input type="text" class="form-input" id="esp8266IP" placeholder="192.168.4.1" required>
-          </div>
-          
-          <div class="form-group">
-            <label class="form-label">
-              <i class="fas fa-plug" style="margin-right: 0.5rem; color: var(--secondary-color);"></i>
-              ESP8266 Port
-            </label>
-            <input type="number" class="form-input" id="esp8266Port" placeholder="8080" min="1" max="65535" required>
-          </div>
-          
-          <div class="form-group">
-            <label class="form-label">
-              <i class="fas fa-circle" style="margin-right: 0.5rem; color: var(--success-color);"></i>
-              Connection Status
-            </label>
-            <div id="esp8266Status" class="status-badge offline">
-              <i class="fas fa-circle" style="font-size: 0.5rem;"></i>
-              Disconnected
-            </div>
-          </div>
-          
-          <button type="submit" class="btn btn-primary" style="width: 100%;">
-            <i class="fas fa-save"></i>Save Configuration
-          </button>
-        </form>
-      </div>
-
-      <div class="card">
-        <div class="card-header">
-          <div class="card-icon danger">
-            <i class="fas fa-cog"></i>
-          </div>
-          <h3>System Settings</h3>
-        </div>
-        <form onsubmit="saveSettings(event)">
-          <div class="form-group">
-            <label class="form-label">
-              <i class="fas fa-thermometer-half" style="margin-right: 0.5rem; color: var(--danger-color);"></i>
-              Temperature Threshold
-            </label>
-            <input type="number" class="form-input" id="tempThreshold" value="40" min="0" max="100" step="0.1">
-          </div>
-          
-          <div class="form-group">
-            <label class="form-label">
-              <i class="fas fa-wind" style="margin-right: 0.5rem; color: var(--warning-color);"></i>
-              Gas Level Threshold
-            </label>
-            <input type="number" class="form-input" id="gasThreshold" value="350" min="0" max="1000" step="1">
-          </div>
-          
-          <div class="form-group">
-            <label class="form-label">
-              <i class="fas fa-volume-up" style="margin-right: 0.5rem; color: var(--secondary-color);"></i>
-              Sound Threshold
-            </label>
-            <input type="number" class="form-input" id="soundThreshold" value="80" min="0" max="120" step="1">
-          </div>
-          
-          <button type="submit" class="btn btn-primary" style="width: 100%;">
-            <i class="fas fa-save"></i>Save Settings
-          </button>
-        </form>
-      </div>
-
-      <!-- Analytics Charts -->
-      <div class="card">
-        <div class="card-header">
-          <div class="card-icon analytics">
-            <i class="fas fa-chart-line"></i>
-          </div>
-          <h3>Sensor Analytics</h3>
-        </div>
-        
-        <div class="chart-tabs">
-          <button class="chart-tab active" onclick="switchChart('temperature')">Temperature</button>
-          <button class="chart-tab" onclick="switchChart('gas')">Gas Level</button>
-          <button class="chart-tab" onclick="switchChart('light')">Light Level</button>
-          <button class="chart-tab" onclick="switchChart('sound')">Sound Level</button>
-        </div>
-
-        <div class="chart-controls">
-          <button class="chart-btn active" onclick="setTimeRange('1h')">1H</button>
-          <button class="chart-btn" onclick="setTimeRange('6h')">6H</button>
-          <button class="chart-btn" onclick="setTimeRange('24h')">24H</button>
-          <button class="chart-btn" onclick="setTimeRange('7d')">7D</button>
-        </div>
-
-        <div class="chart-container">
-          <canvas id="sensorChart"></canvas>
-        </div>
-
-        <div class="chart-stats">
-          <div class="stat-item">
-            <div class="stat-value" id="currentValue">32.4°C</div>
-            <div class="stat-label">Current</div>
-          </div>
-          <div class="stat-item">
-            <div class="stat-value" id="avgValue">31.2°C</div>
-            <div class="stat-label">Average</div>
-          </div>
-          <div class="stat-item">
-            <div class="stat-value" id="maxValue">35.8°C</div>
-            <div class="stat-label">Maximum</div>
-          </div>
-          <div class="stat-item">
-            <div class="stat-value" id="minValue">28.1°C</div>
-            <div class="stat-label">Minimum</div>
-          </div>
-        </div>
-      </div>
-
-      <div class="card">
-        <div class="card-header">
-          <div class="card-icon trends">
-            <i class="fas fa-chart-area"></i>
-          </div>
-          <h3>System Trends</h3>
-        </div>
-        
-        <div class="chart-tabs">
-          <button class="chart-tab active" onclick="switchTrendChart('all')">All Sensors</button>
-          <button class="chart-tab" onclick="switchTrendChart('environmental')">Environmental</button>
-          <button class="chart-tab" onclick="switchTrendChart('safety')">Safety</button>
-        </div>
-
-        <div class="chart-container">
-          <canvas id="trendChart"></canvas>
-        </div>
-
-        <div class="chart-stats">
-          <div class="stat-item">
-            <div class="stat-value" id="alertCount">Error</div>
-            <div class="stat-label">ACTIVE ALERTS</div>
-          </div>
-          <div class="stat-item">
-            <div class="stat-value" id="systemStatus">Error</div>
-            <div class="stat-label">SYSTEM STATUS</div>
-          </div>
-          <div class="stat-item">
-            <div class="stat-value" id="dataPoints">Error</div>
-            <div class="stat-label">DATA POINTS</div>
-          </div>
-          <div class="stat-item">
-            <div class="stat-value" id="uptimePercent">Error</div>
-            <div class="stat-label">UPTIME</div>
-          </div>
-        </div>
-      </div>
-    </div>
-
-    <footer class="footer">
-      <div class="uptime">
-        <i class="fas fa-clock uptime-icon"></i>
-        <span id="uptimeDisplay">System Uptime: 12 minutes</span>
-      </div>
-    </footer>
-  </div>
-
-  <script>
-    // Global variables for charts
-    let sensorChart, trendChart;
-    let currentSensorType = 'temperature';
-    let currentTimeRange = '1h';
-
-    // Theme toggle functionality
-    function toggleTheme() {
-      const body = document.body;
-      const themeToggle = document.querySelector('.theme-toggle .btn i');
-      
-      if (body.classList.contains('dark-theme')) {
-        body.classList.remove('dark-theme');
-        themeToggle.className = 'fas fa-moon';
-        localStorage.setItem('theme', 'light');
-      } else {
-        body.classList.add('dark-theme');
-        themeToggle.className = 'fas fa-sun';
-        localStorage.setItem('theme', 'dark');
-      }
-    }
+// HTTP: /api/sensors is about to serve the newest reading
+void tracePublished() {
+  portENTER_CRITICAL(&latencyLock);
+  bool pending = publishPending, known = publishAcquireKnown;
+  unsigned long parsedUs = publishParsedUs, acquireMs = publishAcquireMs;
+  publishPending = false;
+  portEXIT_CRITICAL(&latencyLock);
+  if (!pending) return;
+  recordLatency(LAT_PUBLISH, micros() - parsedUs);
+  if (known) recordLatency(LAT_END_TO_END, (millis() - acquireMs) * 1000UL);
+}
 
-    // Load saved theme
-    const savedTheme = localStorage.getItem('theme');
-    if (savedTheme === 'dark') {
-      document.body.classList.add('dark-theme');
-      document.querySelector('.theme-toggle .btn i').className = 'fas fa-sun';
-    }
+// PONG:ESP8266,ECHO=<our T from the PING> with the node's T= in the trailer
+void handlePong(const char* body) {
+  uint32_t echo = 0;
+  const LgKvField fields[] = {{"ECHO", LG_KV_U32, &echo}};
+  const char* caps = strchr(body, ',');
+  uint32_t seen;
+  if (!caps || !parseTextFields(caps + 1, fields, 1, &seen) || !(seen & 1) || !rxTrace.haveTime) return;
+  uint32_t rtt = (uint32_t)rxTrace.rxMs - echo;
+  NodeConn &n = *rxNode;
+  n.clockSamples++;
+  if (rtt > n.clockRttMs) return;
+  // The node stamped T roughly half way through the round trip
+  n.clockOffsetMs = (int32_t)(rxTrace.nodeMs - (echo + rtt / 2));
+  n.clockRttMs = rtt;
+  n.clockSynced = true;
+}
 
-    // Relay control functions
-    function toggleRelay(relayNumber) {
-      const button = event.target.closest('.btn');
-      const originalText = button.innerHTML;
-      button.innerHTML = '<span class="loading"></span>';
-      button.disabled = true;
-
-      fetch(`/api/relay/${relayNumber}/toggle`, {
-        method: 'POST',
-        headers: { 'Content-Type': 'application/json' }
-      })
-      .then(response => response.json())
-      .then(data => {
-        updateRelayDisplay(relayNumber, data.state);
-        addLogEntry(`Relay ${relayNumber} toggled ${data.state ? 'ON' : 'OFF'}`);
-        button.innerHTML = originalText;
-        button.disabled = false;
-      })
-      .catch(error => {
-        console.error('Error toggling relay:', error);
-        button.innerHTML = originalText;
-        button.disabled = false;
-      });
-    }
+// DATA:TEMP=..,GAS=..,... (report-by-exception lines carry only changed keys)
+void parseSensorData(const char* body) {
+  float temp = NAN;
+  long gas = 0, sound = 0, pir = 0, ir = 0, light = 0, dist = 0;
+  const LgKvField fields[] = {
+    {"TEMP", LG_KV_FLOAT, &temp}, {"GAS", LG_KV_INT, &gas}, {"SOUND", LG_KV_INT, &sound}, {"PIR", LG_KV_INT, &pir},
+    {"IR", LG_KV_INT, &ir}, {"LIGHT", LG_KV_INT, &light}, {"DIST", LG_KV_INT, &dist},
+  };
+  uint32_t seen;
+  if (!parseTextFields(body, fields, 7, &seen)) return;
+
+  // The ESP8266 sends "nan" when its cached DHT reading is stale
+  if ((seen & (1 << 0)) && !isnan(temp)) {
+    sensorData.temperature = temp;
+    updateSensorStats(tempStats, temp);
+    historyAdd(HIST_TEMP, temp);
+  }
+  if (seen & (1 << 1)) {
+    sensorData.gasLevel = gas;
+    updateSensorStats(gasStats, gas);
+    historyAdd(HIST_GAS, gas);
+  }
+  if (seen & (1 << 2)) {
+    sensorData.soundLevel = sound;
+    updateSensorStats(soundStats, sound);
+    historyAdd(HIST_SOUND, sound);
+  }
+  if (seen & (1 << 3)) sensorData.motionDetected = pir == 1;
+  if (seen & (1 << 4)) sensorData.irTriggered = ir == 0;
+  if (seen & (1 << 5)) {
+    sensorData.lightLevel = light;
+    updateSensorStats(lightStats, light);
+    historyAdd(HIST_LIGHT, light);
+  }
+  if (seen & (1 << 6)) {
+    sensorData.distance = dist;
+    updateSensorStats(distStats, dist);
+    historyAdd(HIST_DIST, dist);
+  }
+  lastSensorUpdate = millis();
+  isOnline = true;
+  dataPoints++;
+  updateActiveAlerts();
+}
 
-    function updateRelayDisplay(relayNumber, state) {
-      const relayItem = document.querySelector(`#relay${relayNumber}Status`).closest('.relay-item');
-      const statusIndicator = relayItem.querySelector('.status-indicator');
-      const icon = relayItem.querySelector('.relay-info i');
-      
-      if (state) {
-        statusIndicator.className = 'status-indicator status-on';
-        statusIndicator.innerHTML = '<span class="status-dot"></span>ON';
-        icon.style.color = 'var(--primary-color)';
-      } else {
-        statusIndicator.className = 'status-indicator status-off';
-        statusIndicator.innerHTML = '<span class="status-dot"></span>OFF';
-        icon.style.color = 'var(--text-secondary)';
-      }
-    }
+// Apply a decoded binary DATA frame (same effect as a text DATA: line)
+void applySensorFrame(const LgSensorData &frame) {
+  float temp = lgCentiToTemp(frame.tempCenti);
+  if (!isnan(temp)) {
+    sensorData.temperature = temp;
+    sensorData.temperatureAge = frame.tempAge;
+    updateSensorStats(tempStats, temp);
+    historyAdd(HIST_TEMP, temp);
+  }
+  sensorData.gasLevel = frame.gas;
+  updateSensorStats(gasStats, sensorData.gasLevel);
+  historyAdd(HIST_GAS, sensorData.gasLevel);
+  sensorData.soundLevel = frame.sound;
+  updateSensorStats(soundStats, sensorData.soundLevel);
+  historyAdd(HIST_SOUND, sensorData.soundLevel);
+  sensorData.motionDetected = frame.pir == 1;
+  sensorData.irTriggered = frame.ir == 0;
+  sensorData.lightLevel = frame.light;
+  updateSensorStats(lightStats, sensorData.lightLevel);
+  historyAdd(HIST_LIGHT, sensorData.lightLevel);
+  sensorData.distance = frame.distCm;
+  updateSensorStats(distStats, sensorData.distance);
+  historyAdd(HIST_DIST, sensorData.distance);
+  lastSensorUpdate = millis();
+  isOnline = true;
+  dataPoints++;
+  updateActiveAlerts();
+}
 
-    function toggleMode() {
-      fetch('/api/mode/toggle', { method: 'POST' })
-        .then(response => response.json())
-        .then(data => {
-          document.getElementById('modeDisplay').textContent = data.mode;
-          addLogEntry(`System mode changed to ${data.mode}`);
-        });
-    }
+// A window's mean counts as one data point; its extremes still reach max/min
+void updateSensorStatsWindow(SensorStats &stats, float mean, float lo, float hi) {
+  updateSensorStats(stats, mean);
+  if (hi > stats.maximum) stats.maximum = hi;
+  if (lo < stats.minimum) stats.minimum = lo;
+}
 
-    function allOn() {
-      fetch('/api/relay/all/on', { method: 'POST' })
-        .then(response => response.json())
-        .then(data => {
-          for (let i = 1; i <= 4; i++) {
-            updateRelayDisplay(i, true);
-          }
-          addLogEntry('All relays turned ON');
-        });
-    }
+void updateSensorStatsWindow(SensorStats &stats, const LgAnalogWindow &w) {
+  updateSensorStatsWindow(stats, w.mean, w.min, w.max);
+}
 
-    function allOff() {
-      fetch('/api/relay/all/off', { method: 'POST' })
-        .then(response => response.json())
-        .then(data => {
-          for (let i = 1; i <= 4; i++) {
-            updateRelayDisplay(i, false);
-          }
-          addLogEntry('All relays turned OFF');
-        });
-    }
+// Replayed windows are history: they count toward avg/min/max but not current
+void foldSensorStatsWindow(SensorStats &stats, float mean, float lo, float hi) {
+  float current = stats.current;
+  updateSensorStatsWindow(stats, mean, lo, hi);
+  stats.current = current;
+}
 
-    // Settings functions
-    function saveSettings(event) {
-      event.preventDefault();
-      const submitBtn = event.target.querySelector('button[type="submit"]');
-      const originalText = submitBtn.innerHTML;
-      submitBtn.innerHTML = '<span class="loading"></span> Saving...';
-      submitBtn.disabled = true;
-
-      const settings = {
-        tempThreshold: document.getElementById('tempThreshold').value,
-        gasThreshold: document.getElementById('gasThreshold').value,
-        soundThreshold: document.getElementById('soundThreshold').value
-      };
-
-      fetch('/api/settings', {
-        method: 'POST',
-        headers: { 'Content-Type': 'application/json' },
-        body: JSON.stringify(settings)
-      })
-      .then(response => response.json())
-      .then(data => {
-        submitBtn.innerHTML = '<i class="fas fa-check"></i> Saved!';
-        addLogEntry('Settings updated successfully');
-        setTimeout(() => {
-          submitBtn.innerHTML = originalText;
-          submitBtn.disabled = false;
-        }, 2000);
-      })
-      .catch(error => {
-        console.error('Error saving settings:', error);
-        submitBtn.innerHTML = originalText;
-        submitBtn.disabled = false;
-      });
-    }
+// Apply a decoded AGGREGATE frame (one reporting window from the ESP8266)
+EventTiming eventTiming(const LgEventTiming &t) {
+  EventTiming out;
+  if (t.firstMs != LG_EVENT_NONE) {
+    out.firstMs = t.firstMs;
+    out.lastMs = t.lastMs;
+  }
+  return out;
+}
 
-    // Log functions
-    function addLogEntry(message) {
-      const logContainer = document.querySelector('.log-container');
-      const time = new Date().toLocaleTimeString('en-US', {
-        hour12: false,
-        hour: '2-digit',
-        minute: '2-digit'
-      });
-      
-      const logEntry = document.createElement('div');
-      logEntry.className = 'log-entry';
-      logEntry.innerHTML = `
-        <span class="log-time">${time}</span>
-        <span class="log-message">${message}</span>
-      `;
-      
-      logContainer.insertBefore(logEntry, logContainer.firstChild);
-      
-      // Keep only last 10 entries
-      const entries = logContainer.querySelectorAll('.log-entry');
-      if (entries.length > 10) {
-        entries[entries.length - 1].remove();
-      }
-    }
+// A window into the history: mean plus the extremes seen during it
+void historyAddWindow(HistChannel ch, uint32_t t, const LgAnalogWindow &w, bool live) {
+  historyAdd(ch, t, w.mean, w.min, w.max, live);
+}
 
-    // Data fetching functions
-    function fetchSensorData() {
-      fetch('/api/sensors')
-        .then(response => response.json())
-        .then(data => {
-          updateSystemStatus(data);
-          updateSensorDisplay(data);
-          updateStats(data.stats || {});
-          updateBottomStats(data);
-        })
-        .catch(error => {
-          updateSystemStatus({isOnline: false, activeAlerts: []});
-          updateSensorDisplay({});
-          updateStats({});
-        });
-    }
+void applyAggregateFrame(const LgAggregate &agg) {
+  uint32_t now = timelineNow();
+  // Report-by-exception frames only carry the channels that changed
+  if ((agg.channels & LG_CH_TEMP) && agg.temp.mean != LG_TEMP_INVALID) {
+    sensorData.temperature = lgCentiToTemp(agg.temp.mean);
+    sensorData.temperatureAge = agg.tempAge;
+    updateSensorStatsWindow(tempStats, sensorData.temperature, lgCentiToTemp(agg.temp.min), lgCentiToTemp(agg.temp.max));
+    historyAdd(HIST_TEMP, now, sensorData.temperature, lgCentiToTemp(agg.temp.min), lgCentiToTemp(agg.temp.max));
+  }
+  if (agg.channels & LG_CH_GAS) {
+    sensorData.gasLevel = agg.gas.mean;
+    updateSensorStatsWindow(gasStats, agg.gas);
+    historyAddWindow(HIST_GAS, now, agg.gas, true);
+  }
+  if (agg.channels & LG_CH_LIGHT) {
+    sensorData.lightLevel = agg.light.mean;
+    updateSensorStatsWindow(lightStats, agg.light);
+    historyAddWindow(HIST_LIGHT, now, agg.light, true);
+  }
+  if (agg.channels & LG_CH_DIST) {
+    sensorData.distance = agg.dist.mean;
+    updateSensorStatsWindow(distStats, agg.dist);
+    historyAddWindow(HIST_DIST, now, agg.dist, true);
+  }
+  if (agg.channels & LG_CH_SOUND) {
+    sensorData.soundLevel = agg.sound;
+    sensorData.soundEvents = agg.soundEvents;
+    sensorData.soundAt = eventTiming(agg.soundAt);
+    updateSensorStats(soundStats, sensorData.soundLevel);
+    historyAdd(HIST_SOUND, sensorData.soundLevel);
+  }
+  if (agg.channels & LG_CH_PIR) {
+    sensorData.motionDetected = agg.pirEvents > 0 || agg.pir == 1;
+    sensorData.motionEvents = agg.pirEvents;
+    sensorData.motionAt = eventTiming(agg.pirAt);
+  }
+  if (agg.channels & LG_CH_IR) {
+    sensorData.irTriggered = agg.irEvents > 0 || agg.ir == 0;
+    sensorData.irEvents = agg.irEvents;
+    sensorData.irAt = eventTiming(agg.irAt);
+  }
+  sensorData.windowSamples = agg.samples;
+  lastSensorUpdate = millis();
+  isOnline = true;
+  dataPoints++;
+  updateActiveAlerts();
+}
 
-    function fetchRelayData() {
-      fetch('/api/relays')
-        .then(response => response.json())
-        .then(data => {
-          for (let i = 1; i <= 4; i++) {
-            updateRelayDisplay(i, data[`relay${i}`]);
-          }
-        });
-    }
+// Apply a BACKLOG frame: a window the ESP8266 buffered while the link was down.
+// Only the statistics and the history (dated when the window closed) see it;
+// live readings and alerts are left alone.
+void applyBacklogFrame(uint32_t ageMs, const LgAggregate &agg) {
+  bool dated = ageMs <= millis();
+  uint32_t at = timelineAt(millis() - ageMs);
+  if ((agg.channels & LG_CH_TEMP) && agg.temp.mean != LG_TEMP_INVALID) {
+    foldSensorStatsWindow(tempStats, lgCentiToTemp(agg.temp.mean), lgCentiToTemp(agg.temp.min), lgCentiToTemp(agg.temp.max));
+    if (dated) historyAdd(HIST_TEMP, at, lgCentiToTemp(agg.temp.mean), lgCentiToTemp(agg.temp.min), lgCentiToTemp(agg.temp.max), false);
+  }
+  if (agg.channels & LG_CH_GAS) {
+    foldSensorStatsWindow(gasStats, agg.gas.mean, agg.gas.min, agg.gas.max);
+    if (dated) historyAddWindow(HIST_GAS, at, agg.gas, false);
+  }
+  if (agg.channels & LG_CH_LIGHT) {
+    foldSensorStatsWindow(lightStats, agg.light.mean, agg.light.min, agg.light.max);
+    if (dated) historyAddWindow(HIST_LIGHT, at, agg.light, false);
+  }
+  if (agg.channels & LG_CH_DIST) {
+    foldSensorStatsWindow(distStats, agg.dist.mean, agg.dist.min, agg.dist.max);
+    if (dated) historyAddWindow(HIST_DIST, at, agg.dist, false);
+  }
+  backlogRecords++;
+  dataPoints++;
+}
 
-    function fetchLogData() {
-      fetch('/api/log')
-        .then(response => response.json())
-        .then(data => {
-          updateLogDisplay(data.logs);
-        })
-        .catch(error => console.error('Error fetching log data:', error));
+// One binary frame from the ESP8266, already CRC-checked by lgParseFrame
+bool handleSensorFrame(const LgFrame &frame) {
+  noteNodeSeq(frame.seq);
+  framesReceived++;
+
+  if (frame.type == LG_MSG_BACKLOG) {
+    uint32_t ageMs;
+    LgAggregate agg;
+    if (!lgDecodeBacklog(frame, ageMs, agg)) return false;
+    applyBacklogFrame(ageMs, agg);
+    return true;
+  }
+  if (frame.type == LG_MSG_AGGREGATE) {
+    LgAggregate agg;
+    if (!lgDecodeAggregate(frame, agg)) return false;
+    if (agg.acquireAgeMs != LG_AGE_UNKNOWN) {
+      rxTrace.nodeMs = agg.nodeMs;
+      rxTrace.ageMs = agg.acquireAgeMs;
+      rxTrace.haveTime = rxTrace.haveAge = true;
+      traceReceived();
     }
+    applyAggregateFrame(agg);
+    traceParsed();
+    return true;
+  }
+  LgSensorData data;
+  if (!lgDecodeSensorData(frame, data)) return false;
+  applySensorFrame(data);
+  traceParsed();
+  return true;
+}
+
+// ------------------------ Node Connections --------------------------
+int activeNodeCount() {
+  int count = 0;
+  for (auto &n : nodes) if (n.active) count++;
+  return count;
+}
+
+// ingestTask only. Returns the number of nodes the line was sent to
+int sendToNodes(const char* line) {
+  int sent = 0;
+  for (auto &n : nodes) {
+    if (!n.active || !n.sock.connected()) continue;
+    n.sock.println(line);
+    sent++;
+  }
+  return sent;
+}
+
+// Alerts held by all connected edge-alert nodes (HOLD_* bits)
+uint8_t heldByNodes() {
+  uint8_t held = 0;
+  for (auto &n : nodes) {
+    if (n.active && n.edgeAlerts) held |= n.heldAlerts;
+  }
+  return held;
+}
+
+// Switches the outputs whose held state changed from `before` to `after`
+void applyHeldOutputs(uint8_t before, uint8_t after) {
+  uint8_t changed = before ^ after;
+  if (changed & HOLD_GAS) {
+    bool on = after & HOLD_GAS;
+    setRelay(RELAY1, on);
+    traceActuation();
+    notifyTelegram(on ? "⚠️ GAS Leak detected! Exhaust Fan ON" : "✅ Gas level back to normal. Exhaust Fan OFF");
+  }
+  if (changed & HOLD_TEMP) {
+    bool on = after & HOLD_TEMP;
+    setRelay(RELAY3, on);
+    traceActuation();
+    notifyTelegram(on ? "🔥 High Temperature detected! Cooling Fan ON" : "✅ Temperature back to normal. Cooling Fan OFF");
+  }
+  if (!(before & HOLD_LIGHT) != !(after & HOLD_LIGHT)) {
+    bool on = after & HOLD_LIGHT;
+    setRelay(RELAY2, on);
+    traceActuation();
+    notifyTelegram(on ? "👁️ Motion Detected! Lights ON" : "✅ Room empty. Lights OFF");
+  }
+  if (changed) relaySavePending = true;
+}
+
+// A node that went away (or reconnected after an outage) may never send the
+// CLEAR: for what it holds. Drops only that node's alerts; an output stays on
+// while another node still holds it, and a node still in alarm re-announces
+// after its HELLO.
+void dropNodeAlerts(NodeConn &node) {
+  if (!node.heldAlerts) return;
+  uint8_t before = heldByNodes();
+  node.heldAlerts = 0;
+  if (!autoMode) return;
+  uint8_t after = heldByNodes();
+  if (before == after) return;
+  applyHeldOutputs(before, after);
+  logEvent("Edge alerts of " + node.ip + " released (reconnected or gone)");
+}
+
+void closeNode(NodeConn &n, const char* why) {
+  LG_INFO("🔌 ESP8266 %s disconnected (%s)", n.ip, why);
+  dropNodeAlerts(n);
+  n.sock.stop();
+  n.active = false;
+  if (!activeNodeCount()) esp8266_connected = false;
+  snapshotDirty = true;
+}
+
+// Other tasks: sendToNodes() by way of ingestTask. False if the queue is full.
+bool queueToNodes(const String &line) {
+  NodeCommand c;
+  strlcpy(c.line, line.c_str(), sizeof(c.line));
+  if (xQueueSend(nodeCommandQueue, &c, 0) == pdTRUE) return true;
+  queueDrops++;
+  LG_WARN("⚠️ Node command queue full, dropped: %s", c.line);
+  return false;
+}
 
-    function fetchUptime() {
-      fetch('/api/uptime')
-        .then(response => response.json())
-        .then(data => {
-          document.getElementById('uptimeDisplay').textContent = `System Uptime: ${data.uptime}`;
-        })
-        .catch(error => console.error('Error fetching uptime:', error));
+void processNodeCommands() {
+  NodeCommand c;
+  while (xQueueReceive(nodeCommandQueue, &c, 0) == pdTRUE) sendToNodes(c.line);
+}
+
+// Other tasks: a change to the relays, mode or settings. False if the queue is full.
+bool queueOutputs(const OutputCommand &c) {
+  if (xQueueSend(outputQueue, &c, 0) == pdTRUE) return true;
+  queueDrops++;
+  LG_WARN("⚠️ Output queue full, dropped op %u", c.op);
+  return false;
+}
+
+// The current settings, for a request that changes only some of them
+OutputCommand currentSettings() {
+  OutputCommand c = {};
+  c.op = OUT_SETTINGS;
+  c.temp = TEMP_THRESHOLD; c.gas = GAS_THRESHOLD; c.sound = SOUND_THRESHOLD; c.rearmSec = ALERT_REARM_SEC;
+  c.rbe = RBE_ENABLED; c.tempDeadband = TEMP_DEADBAND; c.gasDeadband = GAS_DEADBAND;
+  c.lightDeadband = LIGHT_DEADBAND; c.distDeadband = DIST_DEADBAND; c.heartbeatSec = HEARTBEAT_SEC;
+  return c;
+}
+
+// ingestTask: manual changes are checked against autoMode here, where
+// automation cannot switch it in between
+void applyOutputCommand(const OutputCommand &c) {
+  const char* via = c.viaApi ? " via API" : "";
+  switch (c.op) {
+    case OUT_TOGGLE_RELAY: {
+      if (autoMode) return;
+      int pin = (c.relay == 1) ? RELAY1 : (c.relay == 2) ? RELAY2 : (c.relay == 3) ? RELAY3 : RELAY4;
+      setRelay(pin, !getRelayState(pin));
+      logEvent("Relay " + String(c.relay) + " toggled" + (c.viaApi ? via : " manually"));
+      break;
     }
+    case OUT_SET_ALL:
+      if (autoMode) return;
+      setRelay(RELAY1, c.on); setRelay(RELAY2, c.on);
+      setRelay(RELAY3, c.on); setRelay(RELAY4, c.on);
+      logEvent(String("All relays turned ") + (c.on ? "ON" : "OFF") + via);
+      break;
+    case OUT_TOGGLE_MODE:
+      autoMode = !autoMode;
+      logEvent("Mode changed to " + String(autoMode ? "Auto" : "Manual"));
+      break;
+    case OUT_SETTINGS:
+      TEMP_THRESHOLD = c.temp; GAS_THRESHOLD = c.gas; SOUND_THRESHOLD = c.sound; ALERT_REARM_SEC = c.rearmSec;
+      RBE_ENABLED = c.rbe; TEMP_DEADBAND = c.tempDeadband; GAS_DEADBAND = c.gasDeadband;
+      LIGHT_DEADBAND = c.lightDeadband; DIST_DEADBAND = c.distDeadband; HEARTBEAT_SEC = c.heartbeatSec;
+      deadbandSavePending = true;
+      // Send new thresholds and deadbands to every connected ESP8266
+      sendToNodes(thresholdsMessage().c_str());
+      sendToNodes(deadbandsMessage().c_str());
+      break;
+  }
+  relaySavePending = true;      // Thresholds are saved with the relay states
+}
 
-    // Update display functions
-    function updateSensorDisplay(data) {
-      // Update temperature
-      if (data.temperature !== undefined && !isNaN(data.temperature)) {
-        document.getElementById('tempValue').textContent = `${data.temperature.toFixed(1)}°C`;
-        const tempPercent = Math.min((data.temperature / 50) * 100, 100);
-        document.getElementById('tempProgress').style.width = `${tempPercent}%`;
-      } else {
-        document.getElementById('tempValue').textContent = 'Error';
-        document.getElementById('tempProgress').style.width = '0%';
-      }
+void processOutputCommands() {
+  OutputCommand c;
+  while (xQueueReceive(outputQueue, &c, 0) == pdTRUE) applyOutputCommand(c);
+}
 
-      // Update gas level
-      if (data.gasLevel !== undefined && !isNaN(data.gasLevel)) {
-        document.getElementById('gasValue').textContent = `${data.gasLevel} ppm`;
-        const gasPercent = Math.min((data.gasLevel / 1000) * 100, 100);
-        document.getElementById('gasProgress').style.width = `${gasPercent}%`;
-      } else {
-        document.getElementById('gasValue').textContent = 'Error';
-        document.getElementById('gasProgress').style.width = '0%';
-      }
+// ------------------------ Streaming JSON --------------------------
+// API responses are written piece by piece into a chunked response: no
+// JsonDocument and no String holding the whole body. A handler passes a
+// step function that emits one small piece per call (a group of fields, one
+// log entry, a run of chart points) and returns false after the last one.
+// The JsonWriter keeps the nesting between calls, so each piece only writes
+// its own content; it must fit in JSON_PIECE_MAX bytes.
+
+#define JSON_PIECE_MAX 512
+#define JSON_DEPTH_MAX 8
+#define JSON_STR_RESERVE 32  // Kept free while copying strings, for the tokens after them
+
+struct JsonWriter {
+  char buf[JSON_PIECE_MAX];
+  size_t len = 0;
+  uint8_t depth = 0;
+  bool first[JSON_DEPTH_MAX];  // Nothing written yet at this level
+  bool afterKey = false;
+  bool overflow = false;
+
+  void raw(const char* p, size_t n) {
+    if (len + n > sizeof(buf)) { overflow = true; return; }
+    memcpy(buf + len, p, n);
+    len += n;
+  }
+  void raw(const char* p) { raw(p, strlen(p)); }
+
+  // Comma before every value but the first at its level (keys carry their own)
+  void separate() {
+    if (afterKey) { afterKey = false; return; }
+    if (depth == 0) return;
+    if (!first[depth - 1]) raw(",", 1);
+    first[depth - 1] = false;
+  }
 
-      // Update sound level
-      if (data.soundLevel !== undefined && !isNaN(data.soundLevel)) {
-        document.getElementById('soundValue').textContent = `${data.soundLevel} dB`;
-        const soundPercent = Math.min((data.soundLevel / 120) * 100, 100);
-        document.getElementById('soundProgress').style.width = `${soundPercent}%`;
-      } else {
-        document.getElementById('soundValue').textContent = 'Error';
-        document.getElementById('soundProgress').style.width = '0%';
-      }
+  void open(const char* bracket) {
+    separate();
+    raw(bracket, 1);
+    if (depth < JSON_DEPTH_MAX) first[depth] = true;
+    depth++;
+  }
+  void close(const char* bracket) {
+    if (depth) depth--;
+    raw(bracket, 1);
+  }
 
-      // Update PIR motion
-      if (data.motionDetected !== undefined) {
-        const pirElement = document.getElementById('pirValue');
-        if (data.motionDetected) {
-          pirElement.innerHTML = '<span class="status-badge online">Detected</span>';
-        } else {
-          pirElement.innerHTML = '<span class="status-badge offline">Clear</span>';
-        }
-      } else {
-        document.getElementById('pirValue').textContent = 'Error';
-      }
+  void quoted(const char* str) {
+    raw("\"", 1);
+    for (const char* c = str; *c; c++) {
+      if (len > sizeof(buf) - JSON_STR_RESERVE) { overflow = true; break; }  // Truncate, keep the JSON valid
+      if (*c == '"' || *c == '\\') { char e[2] = {'\\', *c}; raw(e, 2); }
+      else if ((uint8_t)*c < 0x20) { char e[8]; snprintf(e, sizeof(e), "\\u%04x", *c); raw(e); }
+      else raw(c, 1);
+    }
+    raw("\"", 1);
+  }
+
+  void beginObject() { open("{"); }
+  void beginObject(const char* k) { key(k); open("{"); }
+  void endObject() { close("}"); }
+  void beginArray() { open("["); }
+  void beginArray(const char* k) { key(k); open("["); }
+  void endArray() { close("]"); }
+
+  void key(const char* k) {
+    separate();
+    quoted(k);
+    raw(":", 1);
+    afterKey = true;
+  }
+
+  void value(const char* v) { separate(); quoted(v); }
+  void value(const String& v) { value(v.c_str()); }
+  void value(bool v) { separate(); raw(v ? "true" : "false"); }
+  void value(int v) { value((long)v); }
+  void value(unsigned v) { value((unsigned long)v); }
+  void value(long v) { char n[16]; snprintf(n, sizeof(n), "%ld", v); separate(); raw(n); }
+  void value(unsigned long v) { char n[16]; snprintf(n, sizeof(n), "%lu", v); separate(); raw(n); }
+  // NaN and infinity have no JSON form: null, as ArduinoJson writes them
+  void value(double v) {
+    separate();
+    if (isnan(v) || isinf(v)) { raw("null"); return; }
+    char n[24];
+    snprintf(n, sizeof(n), "%.7g", v);
+    raw(n);
+  }
+  void null() { separate(); raw("null"); }
+
+  template <typename T>
+  void field(const char* k, T v) { key(k); value(v); }
+};
+
+// Returns true while more pieces follow
+typedef std::function<bool(JsonWriter& w, size_t step)> JsonStep;
+
+struct JsonStream {
+  JsonWriter w;
+  JsonStep step;
+  size_t next = 0;  // Index of the next piece
+  size_t off = 0;   // Bytes of w.buf already sent
+  bool done = false;
+};
 
-      // Update IR sensor
-      if (data.irTriggered !== undefined) {
-        const irElement = document.getElementById('irValue');
-        if (data.irTriggered) {
-          irElement.innerHTML = '<span class="status-badge warning">Triggered</span>';
-        } else {
-          irElement.innerHTML = '<span class="status-badge offline">Clear</span>';
+// A chunked response that sends the pieces of `step` as fast as the socket
+// takes them. Peak memory is one JsonStream, whatever the response size.
+AsyncWebServerResponse* beginJson(AsyncWebServerRequest* request, JsonStep step) {
+  std::shared_ptr<JsonStream> st = std::make_shared<JsonStream>();
+  st->step = step;
+  return request->beginChunkedResponse("application/json",
+    [st](uint8_t* buffer, size_t maxLen, size_t) -> size_t {
+      size_t n = 0;
+      while (n < maxLen) {
+        if (st->off == st->w.len) {
+          if (st->done) break;
+          st->w.len = st->off = 0;
+          st->done = !st->step(st->w, st->next++);
+          if (st->w.overflow) {
+            LG_WARN("⚠️ JSON piece %u over %d bytes, truncated", (unsigned)(st->next - 1), JSON_PIECE_MAX);
+            st->w.overflow = false;
+          }
+          continue;
         }
-      } else {
-        document.getElementById('irValue').textContent = 'Error';
+        size_t chunk = min(maxLen - n, st->w.len - st->off);
+        memcpy(buffer + n, st->w.buf + st->off, chunk);
+        n += chunk;
+        st->off += chunk;
       }
+      return n;  // 0 ends the response
+    });
+}
 
-      // Update light level
-      if (data.lightLevel !== undefined && !isNaN(data.lightLevel)) {
-        document.getElementById('lightValue').textContent = `${data.lightLevel} lux`;
-        const lightPercent = Math.min((data.lightLevel / 1000) * 100, 100);
-        document.getElementById('lightProgress').style.width = `${lightPercent}%`;
-      } else {
-        document.getElementById('lightValue').textContent = 'Error';
-        document.getElementById('lightProgress').style.width = '0%';
-      }
+void sendJson(AsyncWebServerRequest* request, JsonStep step) {
+  request->send(beginJson(request, step));
+}
 
-      // Update distance
-      if (data.distance !== undefined && !isNaN(data.distance)) {
-        document.getElementById('distanceValue').textContent = `${data.distance} cm`;
-        const distancePercent = Math.min((data.distance / 200) * 100, 100);
-        document.getElementById('distanceProgress').style.width = `${distancePercent}%`;
+// ------------------------ API Endpoints --------------------------
+// Handlers run on the async_tcp task and must not block: they read the
+// published Snapshot, queue node commands and flag EEPROM writes for loop().
+
+#define MAX_BODY_LEN 1024
+
+// Body callback for POST routes: the server hands us the body in chunks,
+// we assemble it in _tempObject (freed with the request)
+void collectBody(AsyncWebServerRequest* request, uint8_t* data, size_t len, size_t index, size_t total) {
+  if (total > MAX_BODY_LEN) return;
+  if (index == 0) {
+    free(request->_tempObject);
+    request->_tempObject = malloc(total + 1);
+    if (!request->_tempObject) return;
+  }
+  if (!request->_tempObject || index + len > total) return;
+  char* body = (char*)request->_tempObject;
+  memcpy(body + index, data, len);
+  body[index + len] = '\0';
+}
+
+// Request body collected by collectBody(), nullptr if there was none
+const char* requestBody(AsyncWebServerRequest* request) {
+  return (const char*)request->_tempObject;
+}
+
+void writeStats(JsonWriter& w, const char* name, const SensorStats& st) {
+  char k[24];
+  w.field(name, st.count ? st.current : NAN);
+  snprintf(k, sizeof(k), "%s_avg", name); w.field(k, st.count ? st.average : NAN);
+  snprintf(k, sizeof(k), "%s_max", name); w.field(k, st.count ? st.maximum : NAN);
+  snprintf(k, sizeof(k), "%s_min", name); w.field(k, st.count ? st.minimum : NAN);
+}
+
+// Pieces of the /api/sensors body (also the "sensors" stream event)
+bool writeSensors(JsonWriter& w, size_t step, const Snapshot& s) {
+  switch (step) {
+    case 0:
+      w.beginObject();
+      w.field("temperature", s.sensors.temperature);
+      w.field("temperatureAge", s.sensors.temperatureAge);
+      w.field("gasLevel", isnan(s.sensors.gasLevel) ? -1 : s.sensors.gasLevel);
+      w.field("soundLevel", isnan(s.sensors.soundLevel) ? -1 : s.sensors.soundLevel);
+      w.field("motionDetected", s.sensors.motionDetected);
+      w.field("irTriggered", s.sensors.irTriggered);
+      w.field("lightLevel", isnan(s.sensors.lightLevel) ? -1 : s.sensors.lightLevel);
+      w.field("distance", isnan(s.sensors.distance) ? -1 : s.sensors.distance);
+      w.field("soundEvents", s.sensors.soundEvents);
+      w.field("motionEvents", s.sensors.motionEvents);
+      w.field("irEvents", s.sensors.irEvents);
+      return true;
+    case 1:
+      w.field("soundFirstMs", s.sensors.soundAt.firstMs);
+      w.field("soundLastMs", s.sensors.soundAt.lastMs);
+      w.field("motionFirstMs", s.sensors.motionAt.firstMs);
+      w.field("motionLastMs", s.sensors.motionAt.lastMs);
+      w.field("irFirstMs", s.sensors.irAt.firstMs);
+      w.field("irLastMs", s.sensors.irAt.lastMs);
+      w.field("windowSamples", s.sensors.windowSamples);
+      w.field("isOnline", s.isOnline);
+      w.field("dataPoints", s.dataPoints);
+      return true;
+    case 2:
+      w.beginObject("protocol");
+      w.field("nodes", s.nodeCount);
+      w.field("frames", s.framesReceived);
+      w.field("framesLost", s.framesLost);
+      w.field("frameErrors", s.frameErrors);
+      w.field("textErrors", s.textErrors);
+      w.field("backlogRecords", s.backlogRecords);
+      w.field("queueDrops", queueDrops);
+      w.endObject();
+      w.beginObject("memory");
+      w.field("freeHeap", ESP.getFreeHeap());
+      w.field("minFreeHeap", ESP.getMinFreeHeap());  // Low-water mark since boot
+      w.endObject();
+      w.beginArray("activeAlerts");
+      for (uint8_t i = 0; i < ACTIVE_ALERT_COUNT; i++) {
+        if (s.activeAlerts & (1 << i)) w.value(ACTIVE_ALERT_NAMES[i]);
+      }
+      w.endArray();
+      return true;
+    case 3:
+      w.beginObject("stats");
+      writeStats(w, "temperature", s.temp);
+      writeStats(w, "gas", s.gas);
+      writeStats(w, "sound", s.sound);
+      return true;
+    case 4:
+      writeStats(w, "light", s.light);
+      writeStats(w, "distance", s.dist);
+      w.endObject();
+      return true;
+    default: {
+      // System status
+      w.field("systemStatus", !s.isOnline ? "Offline" : s.activeAlerts ? "Alert" : "Normal");
+      // Uptime as human readable
+      int mins = systemUptimeMinutes;
+      char uptimeStr[40];
+      if (mins < 60) {
+        snprintf(uptimeStr, sizeof(uptimeStr), "%d minute%s", mins, mins == 1 ? "" : "s");
       } else {
-        document.getElementById('distanceValue').textContent = 'Error';
-        document.getElementById('distanceProgress').style.width = '0%';
+        int hours = mins / 60;
+        int rem = mins % 60;
+        int n = snprintf(uptimeStr, sizeof(uptimeStr), "%d hour%s", hours, hours == 1 ? "" : "s");
+        if (rem > 0) snprintf(uptimeStr + n, sizeof(uptimeStr) - n, ", %d min", rem);
       }
+      w.field("uptimeStr", uptimeStr);
+      w.endObject();
+      return false;
     }
+  }
+}
 
-    function updateLogDisplay(logs) {
-      const logContainer = document.querySelector('.log-container');
-      logContainer.innerHTML = '';
-      
-      logs.forEach(log => {
-        const logEntry = document.createElement('div');
-        logEntry.className = 'log-entry';
-        if (log.type === 'alert') {
-          logEntry.innerHTML = `
-            <span class="log-time">${log.time}</span>
-            <span class="log-message log-alert">${log.message}</span>
-          `;
-        } else {
-          logEntry.innerHTML = `
-            <span class="log-time">${log.time}</span>
-            <span class="log-message">${log.message}</span>
-          `;
-        }
-        logContainer.appendChild(logEntry);
-      });
+void handleApiSensors(AsyncWebServerRequest* request) {
+  tracePublished();
+  Snapshot s;
+  readSnapshot(s);
+  sendJson(request, [s](JsonWriter& w, size_t step) { return writeSensors(w, step, s); });
+}
+
+bool writeRelays(JsonWriter& w, size_t) {
+  w.beginObject();
+  w.field("relay1", getRelayState(RELAY1));
+  w.field("relay2", getRelayState(RELAY2));
+  w.field("relay3", getRelayState(RELAY3));
+  w.field("relay4", getRelayState(RELAY4));
+  w.field("autoMode", autoMode);
+  w.endObject();
+  return false;
+}
+
+void handleApiRelays(AsyncWebServerRequest* request) {
+  sendJson(request, writeRelays);
+}
+
+// Caller holds eventLogMutex
+void writeLogEntry(JsonWriter& w, const LogEntry& entry) {
+  char timeStr[16];
+  if (entry.timestamp >= EPOCH_VALID) {
+    time_t t = entry.timestamp;
+    struct tm tm;
+    strftime(timeStr, sizeof(timeStr), "%H:%M:%S", localtime_r(&t, &tm));
+  } else {
+    snprintf(timeStr, sizeof(timeStr), "%02lu:%02lu", entry.timestamp / 60, entry.timestamp % 60);
+  }
+  w.beginObject();
+  w.field("id", entry.id);
+  w.field("time", timeStr);
+  w.field("message", entry.message);
+  w.field("type", entry.message.indexOf("ALERT") != -1 ? "alert" : "info");
+  w.endObject();
+}
+
+// One piece per entry; entries logged meanwhile are included, entries that
+// fall off the front are skipped without tearing the array. A busy mutex
+// answers 503 up front, and ends the array early once the response started.
+void handleApiLog(AsyncWebServerRequest* request) {
+  if (!lockForHttp(eventLogMutex)) {
+    request->send(503, "text/plain", "Busy");
+    return;
+  }
+  xSemaphoreGive(eventLogMutex);
+  uint32_t lastId = 0;
+  sendJson(request, [lastId](JsonWriter& w, size_t step) mutable {
+    if (step == 0) {
+      w.beginObject();
+      w.beginArray("logs");
+    }
+    if (!lockForHttp(eventLogMutex)) {
+      LG_WARN("⚠️ Event log busy, /api/log cut short");
+      w.endArray();
+      w.endObject();
+      return false;
+    }
+    const LogEntry* entry = nullptr;
+    for (auto &e : logEntries) {
+      if (e.id > lastId) { entry = &e; break; }
     }
+    if (entry) {
+      lastId = entry->id;
+      writeLogEntry(w, *entry);
+    }
+    xSemaphoreGive(eventLogMutex);
+    if (entry) return true;
+    w.endArray();
+    w.endObject();
+    return false;
+  });
+}
 
-    // Chart functions
-    function initCharts() {
-      const sensorCtx = document.getElementById('sensorChart').getContext('2d');
-      const trendCtx = document.getElementById('trendChart').getContext('2d');
-
-      sensorChart = new Chart(sensorCtx, {
-        type: 'line',
-        data: {
-          labels: [],
-          datasets: [{
-            label: 'Temperature',
-            data: [],
-            borderColor: '#ef4444',
-            backgroundColor: '#ef444420',
-            borderWidth: 3,
-            fill: true,
-            tension: 0.4,
-            pointBackgroundColor: '#ef4444',
-            pointBorderColor: '#ffffff',
-            pointBorderWidth: 2,
-            pointRadius: 4,
-            pointHoverRadius: 6
-          }]
-        },
-        options: {
-          responsive: true,
-          maintainAspectRatio: false,
-          plugins: {
-            legend: { display: false },
-            tooltip: {
-              backgroundColor: 'rgba(0, 0, 0, 0.8)',
-              titleColor: '#ffffff',
-              bodyColor: '#ffffff',
-              borderColor: '#ef4444',
-              borderWidth: 1,
-              cornerRadius: 8,
-              displayColors: false
-            }
-          },
-          scales: {
-            x: {
-              grid: { color: 'rgba(0, 0, 0, 0.1)' },
-              ticks: { color: 'var(--text-secondary)' }
-            },
-            y: {
-              grid: { color: 'rgba(0, 0, 0, 0.1)' },
-              ticks: { color: 'var(--text-secondary)' }
-            }
-          }
-        }
-      });
+bool writeUptime(JsonWriter& w, size_t) {
+  char uptime[24];
+  snprintf(uptime, sizeof(uptime), "%d minutes", systemUptimeMinutes);
+  w.beginObject();
+  w.field("uptime", uptime);
+  w.endObject();
+  return false;
+}
 
-      trendChart = new Chart(trendCtx, {
-        type: 'bar',
-        data: {
-          labels: ['Temperature', 'Gas Level', 'Light Level', 'Sound Level'],
-          datasets: [{
-            label: 'Current Values',
-            data: [0, 0, 0, 0],
-            backgroundColor: ['#ef4444', '#f59e0b', '#f97316', '#8b5cf6'],
-            borderColor: ['#ef4444', '#f59e0b', '#f97316', '#8b5cf6'],
-            borderWidth: 2
-          }]
-        },
-        options: {
-          responsive: true,
-          maintainAspectRatio: false,
-          plugins: {
-            legend: {
-              display: true,
-              position: 'top',
-              labels: {
-                color: 'var(--text-primary)',
-                usePointStyle: true,
-                padding: 20
-              }
-            },
-            tooltip: {
-              backgroundColor: 'rgba(0, 0, 0, 0.8)',
-              titleColor: '#ffffff',
-              bodyColor: '#ffffff',
-              cornerRadius: 8
-            }
-          },
-          scales: {
-            x: {
-              grid: { color: 'rgba(0, 0, 0, 0.1)' },
-              ticks: { color: 'var(--text-secondary)' }
-            },
-            y: {
-              grid: { color: 'rgba(0, 0, 0, 0.1)' },
-              ticks: { color: 'var(--text-secondary)' }
-            }
-          }
-        }
-      });
+void handleApiUptime(AsyncWebServerRequest* request) {
+  sendJson(request, writeUptime);
+}
+
+// Handle relay toggle via API
+void handleApiRelayToggle(AsyncWebServerRequest* request) {
+  String uri = request->url();
+  int relayNumber = 0;
+  if (uri.indexOf("/api/relay/1/toggle") != -1) relayNumber = 1;
+  else if (uri.indexOf("/api/relay/2/toggle") != -1) relayNumber = 2;
+  else if (uri.indexOf("/api/relay/3/toggle") != -1) relayNumber = 3;
+  else if (uri.indexOf("/api/relay/4/toggle") != -1) relayNumber = 4;
+  
+  if (relayNumber > 0 && !autoMode) {
+    int pin = (relayNumber == 1) ? RELAY1 : (relayNumber == 2) ? RELAY2 : (relayNumber == 3) ? RELAY3 : RELAY4;
+    bool newState = !getRelayState(pin);  // What ingestTask will switch it to
+    OutputCommand c = {};
+    c.op = OUT_TOGGLE_RELAY; c.relay = relayNumber; c.viaApi = true;
+    if (!queueOutputs(c)) { request->send(503, "text/plain", "Busy"); return; }
+    
+    sendJson(request, [newState, relayNumber](JsonWriter& w, size_t) {
+      w.beginObject();
+      w.field("state", newState);
+      w.field("relay", relayNumber);
+      w.endObject();
+      return false;
+    });
+  } else {
+    request->send(400, "text/plain", "Invalid request or auto mode active");
+  }
+}
+
+// Handle mode toggle via API
+void handleApiModeToggle(AsyncWebServerRequest* request) {
+  OutputCommand c = {};
+  c.op = OUT_TOGGLE_MODE;
+  bool mode = !autoMode;
+  if (!queueOutputs(c)) { request->send(503, "text/plain", "Busy"); return; }
+  
+  sendJson(request, [mode](JsonWriter& w, size_t) {
+    w.beginObject();
+    w.field("mode", mode ? "Auto" : "Manual");
+    w.endObject();
+    return false;
+  });
+}
+
+// Handle all relays ON via API
+void handleApiAllOn(AsyncWebServerRequest* request) {
+  OutputCommand c = {};
+  c.op = OUT_SET_ALL; c.on = true; c.viaApi = true;
+  if (!autoMode && !queueOutputs(c)) { request->send(503, "text/plain", "Busy"); return; }
+  request->send(200, "text/plain", "OK");
+}
+
+// Handle all relays OFF via API
+void handleApiAllOff(AsyncWebServerRequest* request) {
+  OutputCommand c = {};
+  c.op = OUT_SET_ALL; c.on = false; c.viaApi = true;
+  if (!autoMode && !queueOutputs(c)) { request->send(503, "text/plain", "Busy"); return; }
+  request->send(200, "text/plain", "OK");
+}
+
+// Handle settings save via API
+void handleApiSettings(AsyncWebServerRequest* request) {
+  const char* body = requestBody(request);
+  if (body) {
+    DynamicJsonDocument doc(512);
+    deserializeJson(doc, body);
+    
+    OutputCommand c = currentSettings();
+    if (doc.containsKey("tempThreshold")) c.temp = doc["tempThreshold"];
+    if (doc.containsKey("gasThreshold")) c.gas = doc["gasThreshold"];
+    if (doc.containsKey("soundThreshold")) c.sound = doc["soundThreshold"];
+    if (doc.containsKey("reportByException")) c.rbe = doc["reportByException"];
+    if (doc.containsKey("tempDeadband")) c.tempDeadband = doc["tempDeadband"];
+    if (doc.containsKey("gasDeadband")) c.gasDeadband = doc["gasDeadband"];
+    if (doc.containsKey("lightDeadband")) c.lightDeadband = doc["lightDeadband"];
+    if (doc.containsKey("distDeadband")) c.distDeadband = doc["distDeadband"];
+    if (doc.containsKey("heartbeatSec")) c.heartbeatSec = doc["heartbeatSec"];
+    if (doc.containsKey("alertRearmSec")) c.rearmSec = doc["alertRearmSec"];
+    if (!queueOutputs(c)) { request->send(503, "text/plain", "Busy"); return; }
+    
+    logEvent("Settings updated via API");
+    request->send(200, "application/json", "{\"status\":\"saved\"}");
+  } else {
+    request->send(400, "text/plain", "Invalid request");
+  }
+}
+
+// Older ESP8266 firmware repeats ALERT: every window: the outputs it switches
+// on are released LEGACY_PULSE_MS later by serviceAutomation()
+#define LEGACY_PULSE_MS 2000
+unsigned long legacyPulseAt = 0;
+bool legacyPulseActive = false;
+
+// ingestTask: finishes what automation started, without sleeping
+void serviceAutomation() {
+  serviceBuzzer();
+  if (legacyPulseActive && millis() - legacyPulseAt >= LEGACY_PULSE_MS) {
+    legacyPulseActive = false;
+    setRelay(RELAY1, false); setRelay(RELAY2, false);
+    setRelay(RELAY3, false); setRelay(RELAY4, false);
+    relaySavePending = true;
+  }
+}
+
+// Edge-triggered alerts: a relay follows its alert from ALERT: until CLEAR:,
+// OR-ed over the nodes, and Telegram hears about each incident once.
+void handleAlertTransition(NodeConn &node, bool on, const char* name) {
+  uint8_t bit = 0;
+  if (!strcmp(name, "GAS_LEAK")) bit = HOLD_GAS;
+  else if (!strcmp(name, "TEMP_HIGH")) bit = HOLD_TEMP;
+  else if (!strcmp(name, "MOTION_PIR")) bit = HOLD_MOTION;
+  else if (!strcmp(name, "PRESENCE_DETECTED")) bit = HOLD_PRESENCE;
+  if (bit) {
+    // A repeated ALERT:/CLEAR: (e.g. after a reconnect) changes nothing
+    uint8_t before = heldByNodes();
+    if (on) node.heldAlerts |= bit; else node.heldAlerts &= ~bit;
+    applyHeldOutputs(before, heldByNodes());
+    return;
+  } else if (!strcmp(name, "SOUND_EVENT") || !strcmp(name, "IR_TRIGGERED")) {
+    if (!on) return;
+    blinkBuzzer(3, 200);
+    traceActuation();
+    notifyTelegram("🔊 Sound/IR Triggered! Alarm Blinking");
+  } else {
+    return;
+  }
+  relaySavePending = true;
+}
+
+// ---------------------- ESP8266 Text Messages ----------------------
+void handleHello(const char* body) {
+  // HELLO:ESP8266,PROTO=1,EDGE=1 - the board name comes first, then capabilities
+  long proto = 0, edge = 0;
+  const LgKvField fields[] = {{"PROTO", LG_KV_INT, &proto}, {"EDGE", LG_KV_INT, &edge}};
+  const char* caps = strchr(body, ',');
+  uint32_t seen;
+  if (caps && !parseTextFields(caps + 1, fields, 2, &seen)) return;
+
+  // Acknowledge the binary protocol if the ESP8266 offers it
+  rxNode->binary = proto == LG_PROTO_VERSION;
+  dropNodeAlerts(*rxNode);  // It re-announces what is still active
+  rxNode->edgeAlerts = edge == 1;
+  if (rxNode->binary) rxNode->sock.println(LG_PROTO_ACK + String(LG_PROTO_VERSION));
+  rxNode->sock.println(thresholdsMessage());
+  rxNode->sock.println(deadbandsMessage());
+}
+
+void handleGasFilterState(const char* body) {
+  GasFilterReport r;
+  const LgKvField fields[] = {
+    {"OS", LG_KV_INT, &r.oversample}, {"MEDIAN", LG_KV_INT, &r.median}, {"AVG", LG_KV_INT, &r.average},
+    {"EWMA", LG_KV_INT, &r.ewmaShift}, {"RAW", LG_KV_INT, &r.raw}, {"OUT", LG_KV_INT, &r.filtered},
+  };
+  uint32_t seen;
+  if (!parseTextFields(body, fields, 6, &seen)) return;
+  r.reported = true;
+  gasFilterReport = r;
+}
+
+// Cuts the ",SEQ=..,T=..[,AGE=..]" trailer off a text line into rxTrace.
+// Lines from older ESP8266 firmware have none and leave haveTime/haveAge unset.
+void stripLineTrailer(char* line) {
+  // A new connection restarts the sequence and may come from a rebooted node
+  if (lgKvBody(line, "HELLO:")) {
+    rxNode->haveSeq = false;
+    rxNode->clockSynced = false;
+    rxNode->clockRttMs = ULONG_MAX;
+  }
+  char* trailer = strstr(line, ",SEQ=");
+  if (!trailer) return;
+  *trailer = '\0';
+  uint32_t seq = 0, t = 0, age = 0;
+  const LgKvField fields[] = {{"SEQ", LG_KV_U32, &seq}, {"T", LG_KV_U32, &t}, {"AGE", LG_KV_U32, &age}};
+  uint32_t seen;
+  if (!parseTextFields(trailer + 1, fields, 3, &seen)) return;
+  if (seen & 1) noteNodeSeq(seq);
+  rxTrace.nodeMs = t;
+  rxTrace.ageMs = age;
+  rxTrace.haveTime = seen & 2;
+  rxTrace.haveAge = seen & 4;
+  traceReceived();
+}
+
+// One text line from the ESP8266 (binary frames are handled by readSensorFrame)
+void handleNodeLine(char* line) {
+  stripLineTrailer(line);
+  const char* body;
+  if ((body = lgKvBody(line, "DATA:"))) {
+    parseSensorData(body);
+    traceParsed();
+    esp8266_connected = true;
+    setLEDs(false, true, true); // Green LED on when ESP8266 connected
+  } else if ((body = lgKvBody(line, "INFO:ESP8266_IP="))) {
+    esp8266_actual_ip = body;
+    rxNode->ip = body;
+    logEvent("ESP8266 IP: " + esp8266_actual_ip);
+  } else if ((body = lgKvBody(line, "HELLO:"))) {
+    handleHello(body);
+  } else if ((body = lgKvBody(line, "GASFILTER_STATE:"))) {
+    handleGasFilterState(body);
+  } else if ((body = lgKvBody(line, "PONG:"))) {
+    // Keep-alive response from ESP8266
+    handlePong(body);
+    esp8266_connected = true;
+    lastSensorUpdate = millis();
+  }
+  // Periodic traffic stays out of the event log (it would push out everything else)
+  if (lgKvBody(line, "DATA:") || lgKvBody(line, "PONG:")) LG_DEBUG("From ESP8266: %s", line);
+  else logEvent("From ESP8266: " + String(line));
+
+  // Automation logic
+  if (!autoMode) return;
+  const char* alert = lgKvBody(line, "ALERT:");
+  const char* clear = lgKvBody(line, "CLEAR:");
+  if (rxNode->edgeAlerts && (alert || clear)) {
+    handleAlertTransition(*rxNode, alert != nullptr, alert ? alert : clear);
+  } else if (alert) {
+    // Older ESP8266 firmware repeats ALERT: every window: pulse the outputs
+    if (!strcmp(alert, "GAS_LEAK")) {
+      setRelay(RELAY1, true);
+      traceActuation();
+      notifyTelegram("⚠️ GAS Leak detected! Exhaust Fan ON");
+    } else if (!strcmp(alert, "TEMP_HIGH")) {
+      setRelay(RELAY3, true);
+      traceActuation();
+      notifyTelegram("🔥 High Temperature detected! Cooling Fan ON");
+    } else if (!strcmp(alert, "MOTION_PIR") || !strcmp(alert, "PRESENCE_DETECTED")) {
+      setRelay(RELAY2, true);
+      traceActuation();
+      notifyTelegram("👁️ Motion Detected! Lights ON");
+    } else if (!strcmp(alert, "SOUND_EVENT") || !strcmp(alert, "IR_TRIGGERED")) {
+      blinkBuzzer(3, 200);
+      traceActuation();
+      notifyTelegram("🔊 Sound/IR Triggered! Alarm Blinking");
     }
+    relaySavePending = true;
+    legacyPulseAt = millis();  // serviceAutomation() switches everything off again
+    legacyPulseActive = true;
+  }
+}
 
-    function switchChart(sensorType) {
-      currentSensorType = sensorType;
-      // Update chart data based on sensor type
-      fetch(`/api/chart/${sensorType}`)
-        .then(response => response.json())
-        .then(data => {
-          sensorChart.data.labels = data.labels;
-          sensorChart.data.datasets[0].data = data.values;
-          sensorChart.data.datasets[0].label = data.label;
-          sensorChart.data.datasets[0].borderColor = data.color;
-          sensorChart.data.datasets[0].backgroundColor = data.color + '20';
-          sensorChart.data.datasets[0].pointBackgroundColor = data.color;
-          sensorChart.options.plugins.tooltip.borderColor = data.color;
-          sensorChart.update();
-          
-          // Update stats
-          updateStats(data);
-        });
-
-      // Update active tab
-      document.querySelectorAll('.chart-tab').forEach(tab => tab.classList.remove('active'));
-      event.target.classList.add('active');
+// ------------------------ Node Polling --------------------------
+// Takes every pending connection; a full table turns the newcomer away
+void acceptNodes() {
+  while (WiFiClient c = tcpServer.available()) {
+    NodeConn* slot = nullptr;
+    for (auto &n : nodes) {
+      if (!n.active) { slot = &n; break; }
     }
+    if (!slot) {
+      LG_WARN("⚠️ Rejecting ESP8266 %s: all %d node slots in use", c.remoteIP().toString(), MAX_NODES);
+      c.stop();
+      continue;
+    }
+    *slot = NodeConn();
+    slot->sock = c;
+    slot->sock.setNoDelay(true);
+    slot->active = true;
+    slot->ip = c.remoteIP().toString();
+    slot->connectedAt = slot->lastSeen = millis();
+    snapshotDirty = true;
+    logEvent("ESP8266 connected from " + slot->ip);
+  }
+}
 
-    function switchTrendChart(trendType) {
-      fetch(`/api/trend/${trendType}`)
-        .then(response => response.json())
-        .then(data => {
-          trendChart.data.labels = data.labels;
-          trendChart.data.datasets = data.datasets;
-          trendChart.update();
-        });
-
-      document.querySelectorAll('.chart-card:nth-child(2) .chart-tab').forEach(tab => tab.classList.remove('active'));
-      event.target.classList.add('active');
+// Handles every complete line/frame at the start of n.rx and returns the
+// number of bytes used; a partial one stays in the buffer for the next pass.
+size_t extractNodeMessages(NodeConn &n) {
+  size_t off = 0;
+  while (off < n.rxLen) {
+    uint8_t* p = n.rx + off;
+    size_t len = n.rxLen - off;
+    rxTrace = {micros(), millis(), 0, 0, 0, false, false};
+
+    if (p[0] == LG_FRAME_SYNC) {
+      // Binary frame: no String, no per-message log entry
+      LgFrame frame;
+      size_t used;
+      LgFrameStatus status = lgParseFrame(p, len, frame, &used);
+      if (status == LG_FRAME_INCOMPLETE) break;
+      if (status != LG_FRAME_OK) {
+        frameErrors++;
+        off++;  // Resynchronise on the next byte
+        continue;
+      }
+      off += used;
+      if (handleSensorFrame(frame)) {
+        esp8266_connected = true;
+        setLEDs(false, true, true); // Green LED on when ESP8266 connected
+      }
+    } else {
+      uint8_t* nl = (uint8_t*)memchr(p, '\n', len);
+      if (!nl) {
+        if (off == 0 && n.rxLen == NODE_RX_BUF) {
+          // A full buffer without a newline will never become a line
+          textErrors++;
+          LG_WARN("⚠️ Dropping %d bytes of unterminated text from %s", NODE_RX_BUF, n.ip);
+          off = n.rxLen;
+        }
+        break;
+      }
+      off += nl - p + 1;
+      lgTerminateLine((char*)p, nl - p);
+      handleNodeLine((char*)p);
     }
+    n.lastSeen = millis();
+    n.messages++;
+  }
+  return off;
+}
 
-    function setTimeRange(range) {
-      currentTimeRange = range;
-      document.querySelectorAll('.chart-btn').forEach(btn => btn.classList.remove('active'));
-      event.target.classList.add('active');
-      
-      fetch(`/api/chart/${currentSensorType}/${range}`)
-        .then(response => response.json())
-        .then(data => {
-          sensorChart.data.labels = data.labels;
-          sensorChart.data.datasets[0].data = data.values;
-          sensorChart.update();
-        });
+// Takes whatever bytes have arrived without waiting for the rest of a message
+void readNode(NodeConn &n) {
+  int avail = n.sock.available();
+  if (avail <= 0) return;
+  size_t room = NODE_RX_BUF - n.rxLen;
+  int got = n.sock.read(n.rx + n.rxLen, min((size_t)avail, room));
+  if (got <= 0) return;
+  n.rxLen += got;
+
+  rxNode = &n;
+  size_t used = extractNodeMessages(n);
+  rxNode = nullptr;
+  if (used) {
+    memmove(n.rx, n.rx + used, n.rxLen - used);
+    n.rxLen -= used;
+    snapshotDirty = true;
+  }
+}
+
+// One non-blocking pass over the table, then drop dead sockets
+void serviceNodes() {
+  for (auto &n : nodes) {
+    if (!n.active) continue;
+    readNode(n);
+    if (!n.sock.connected() && !n.sock.available()) closeNode(n, "closed");
+    else if (millis() - n.lastSeen > NODE_TIMEOUT_MS) closeNode(n, "timeout");
+  }
+}
+
+// Gas filter tuning: GET returns the ESP8266's last report, POST pushes new parameters
+void handleApiGasFilter(AsyncWebServerRequest* request) {
+  if (request->method() == HTTP_POST) {
+    Snapshot s;
+    readSnapshot(s);
+    if (!requestBody(request) || !s.nodeCount) {
+      request->send(400, "application/json", "{\"success\":false,\"message\":\"ESP8266 not connected\"}");
+      return;
     }
+    DynamicJsonDocument doc(256);
+    deserializeJson(doc, requestBody(request));
+    String msg = "GASFILTER:";
+    if (doc.containsKey("oversample")) msg += "OS=" + String((int)doc["oversample"]) + ",";
+    if (doc.containsKey("median")) msg += "MEDIAN=" + String((int)doc["median"]) + ",";
+    if (doc.containsKey("average")) msg += "AVG=" + String((int)doc["average"]) + ",";
+    if (doc.containsKey("ewmaShift")) msg += "EWMA=" + String((int)doc["ewmaShift"]) + ",";
+    queueToNodes(msg);
+    logEvent("Gas filter update sent: " + msg);
+    request->send(200, "application/json", "{\"success\":true}");
+    return;
+  }
+
+  // The ESP8266 answers a bare GASFILTER: with its current state
+  queueToNodes("GASFILTER:");
+  Snapshot s;
+  readSnapshot(s);
+  GasFilterReport r = s.gasFilter;
+  sendJson(request, [r](JsonWriter& w, size_t) {
+    w.beginObject();
+    w.field("oversample", r.oversample);
+    w.field("median", r.median);
+    w.field("average", r.average);
+    w.field("ewmaShift", r.ewmaShift);
+    w.field("raw", r.raw);
+    w.field("filtered", r.filtered);
+    w.field("reported", r.reported);
+    w.endObject();
+    return false;
+  });
+}
 
-    function updateStats(data) {
-      document.getElementById('currentValue').textContent = data.current + data.unit;
-      document.getElementById('avgValue').textContent = data.average + data.unit;
-      document.getElementById('maxValue').textContent = data.maximum + data.unit;
-      document.getElementById('minValue').textContent = data.minimum + data.unit;
+// Per-stage latency histograms; ?reset=1 starts a new measurement
+void handleApiLatency(AsyncWebServerRequest* request) {
+  Snapshot s;
+  readSnapshot(s);
+  LatencyHistogram hist[LAT_STAGE_COUNT];
+  portENTER_CRITICAL(&latencyLock);
+  memcpy(hist, latency, sizeof(hist));
+  portEXIT_CRITICAL(&latencyLock);
+
+  if (request->hasArg("reset")) resetLatency();
+
+  // Pieces: head, one per clock, bucket bounds, one per stage
+  sendJson(request, [s, hist](JsonWriter& w, size_t step) {
+    if (step == 0) {
+      w.beginObject();
+      w.beginArray("clocks");
+      return true;
     }
+    if (step <= s.nodeCount) {
+      const NodeSummary &n = s.nodes[step - 1];
+      w.beginObject();
+      w.field("ip", n.ip);
+      w.field("synced", n.clockSynced);
+      w.field("offsetMs", n.clockOffsetMs);
+      w.field("rttMs", n.clockSynced ? (long)n.clockRttMs : -1);
+      w.field("samples", n.clockSamples);
+      w.endObject();
+      return true;
+    }
+    if (step == s.nodeCount + 1u) {
+      w.endArray();
+      w.field("framesLost", s.framesLost);
+      w.beginArray("bucketUpperUs");
+      for (uint32_t b : LAT_BUCKET_US) w.value(b);
+      w.endArray();
+      w.beginObject("stages");
+      return true;
+    }
+    size_t i = step - s.nodeCount - 2;
+    const LatencyHistogram &h = hist[i];
+    w.beginObject(h.name);
+    w.field("count", h.count);
+    w.field("meanUs", h.count ? (uint32_t)(h.sumUs / h.count) : 0);
+    w.field("maxUs", h.maxUs);
+    w.beginArray("buckets");
+    for (uint32_t n : h.buckets) w.value(n);
+    w.endArray();
+    w.endObject();
+    if (i + 1 < LAT_STAGE_COUNT) return true;
+    w.endObject();
+    w.endObject();
+    return false;
+  });
+}
 
-    // Initialize dashboard
-    document.addEventListener('DOMContentLoaded', function() {
-      // Animate progress bars
-      const progressBars = document.querySelectorAll('.progress-fill');
-      progressBars.forEach(bar => {
-        const width = bar.style.width;
-        bar.style.width = '0%';
-        setTimeout(() => {
-          bar.style.width = width;
-        }, 500);
-      });
+#define CHART_CHUNK 12  // History points per response piece
 
-      // Initialize charts
-      initCharts();
-
-      // Load ESP8266 configuration
-      loadESP8266Config();
-
-      // Initial data fetch
-      fetchSensorData();
-      fetchRelayData();
-      fetchLogData();
-      fetchUptime();
-
-      // Set up periodic updates
-      setInterval(() => {
-        fetchSensorData();
-        fetchRelayData();
-        fetchLogData();
-        fetchUptime();
-        loadESP8266Config(); // Update ESP8266 status periodically
-      }, 5000); // Update every 5 seconds
-    });
+struct ChartChannel {
+  const char* name;
+  HistChannel ch;
+  const char* unit;
+  const char* color;
+};
+const ChartChannel CHART_CHANNELS[] = {
+  {"temperature", HIST_TEMP, "°C", "#ef4444"}, {"gas", HIST_GAS, "ppm", "#f59e0b"},
+  {"light", HIST_LIGHT, "lux", "#f97316"}, {"sound", HIST_SOUND, "dB", "#8b5cf6"},
+  {"distance", HIST_DIST, "cm", "#6366f1"},
+};
 
-    function updateSystemStatus(data) {
-      // System Online/Offline
-      const statusBadge = document.querySelector('.status-badge.online');
-      if (data.isOnline) {
-        statusBadge.textContent = 'SYSTEM ONLINE';
-        statusBadge.classList.remove('offline');
-        statusBadge.classList.add('online');
-      } else {
-        statusBadge.textContent = 'SYSTEM OFFLINE';
-        statusBadge.classList.remove('online');
-        statusBadge.classList.add('offline');
+// /api/chart/<sensor>[/<1h|6h|24h|7d>]: [time, avg, min, max] points from the
+// raw stream or the tier that fits the range, plus current/average/maximum/minimum
+void handleApiChart(AsyncWebServerRequest* request) {
+  String uri = request->url();
+  const ChartChannel* chart = nullptr;
+  for (auto &c : CHART_CHANNELS) {
+    if (uri.indexOf(String("/") + c.name) != -1) chart = &c;
+  }
+  if (!chart) {
+    request->send(404, "text/plain", "Unknown sensor");
+    return;
+  }
+
+  uint32_t rangeSec = 3600;
+  if (uri.indexOf("/6h") != -1) rangeSec = 6 * 3600UL;
+  else if (uri.indexOf("/24h") != -1) rangeSec = 24 * 3600UL;
+  else if (uri.indexOf("/7d") != -1) rangeSec = 7 * 24 * 3600UL;
+
+  struct ChartState {
+    HistQuery q;
+    float sum = 0, minimum = NAN, maximum = NAN, current = NAN;
+    uint32_t samples = 0;
+  };
+  std::shared_ptr<ChartState> st = std::make_shared<ChartState>();
+  uint32_t now = timelineNow();
+  historyBeginQuery(st->q, chart->ch, rangeSec, now);
+
+  // Pieces: head, CHART_CHUNK points at a time, stats
+  sendJson(request, [st, chart, rangeSec, now](JsonWriter& w, size_t step) {
+    HistChannel ch = chart->ch;
+    if (step == 0) {
+      w.beginObject();
+      w.field("label", chart->name);
+      w.field("unit", chart->unit);
+      w.field("color", chart->color);
+      w.field("range", rangeSec);
+      w.field("bucketSec", st->q.bucketSec);
+      w.field("now", now);
+      w.beginArray("points");
+      return true;
+    }
+    HistPoint points[CHART_CHUNK];
+    size_t n = historyRead(st->q, points, CHART_CHUNK);
+    for (size_t i = 0; i < n; i++) {
+      const HistPoint &p = points[i];
+      float avg = histValue(ch, p.avg), lo = histValue(ch, p.min), hi = histValue(ch, p.max);
+      w.beginArray();
+      w.value(p.t);
+      w.value(avg);
+      w.value(lo);
+      w.value(hi);
+      w.endArray();
+      st->sum += avg * p.count;
+      st->samples += p.count;
+      if (isnan(st->minimum) || lo < st->minimum) st->minimum = lo;
+      if (isnan(st->maximum) || hi > st->maximum) st->maximum = hi;
+      st->current = avg;
+    }
+    if (!st->q.done) return true;
+    w.endArray();
+    w.field("current", st->current);
+    w.field("average", st->samples ? st->sum / st->samples : NAN);
+    w.field("maximum", st->maximum);
+    w.field("minimum", st->minimum);
+    w.endObject();
+    return false;
+  });
+}
+
+// Handle trend data requests (placeholder responses)
+void handleApiTrend(AsyncWebServerRequest* request) {
+  Snapshot s;
+  readSnapshot(s);
+  SensorData d = s.sensors;
+  sendJson(request, [d](JsonWriter& w, size_t) {
+    static const char* const COLORS[] = {"#ef4444", "#f59e0b", "#f97316", "#8b5cf6"};
+    w.beginObject();
+    w.beginArray("labels");
+    w.endArray();
+    w.beginArray("datasets");
+    w.beginObject();
+    w.field("label", "Current Values");
+    // Add sensor data
+    w.beginArray("data");
+    w.value(d.temperature);
+    w.value(d.gasLevel);
+    w.value(d.lightLevel);
+    w.value(d.soundLevel);
+    w.endArray();
+    // Add colors
+    w.beginArray("backgroundColor");
+    for (const char* c : COLORS) w.value(c);
+    w.endArray();
+    w.beginArray("borderColor");
+    for (const char* c : COLORS) w.value(c);
+    w.endArray();
+    w.endObject();
+    w.endArray();
+    w.endObject();
+    return false;
+  });
+}
+
+// Handle ESP8266 configuration
+void handleApiESP8266Config(AsyncWebServerRequest* request) {
+  if (request->method() == HTTP_POST) {
+    // Save new ESP8266 settings
+    String newIP = request->arg("ip");
+    int newPort = request->arg("port").toInt();
+    
+    if (newIP.length() > 0 && newPort > 0) {
+      if (!lockForHttp(settingsMutex)) {
+        request->send(503, "text/plain", "Busy");
+        return;
       }
-      // Alerts
-      const alertBadge = document.querySelector('.status-badge.warning');
-      if (data.activeAlerts && data.activeAlerts.length > 0) {
-        alertBadge.textContent = `${data.activeAlerts.length} ALERT${data.activeAlerts.length > 1 ? 'S' : ''} ACTIVE`;
-        alertBadge.classList.remove('no-alert');
-        alertBadge.classList.add('warning');
+      esp8266_ip = newIP;
+      esp8266_port = newPort;
+      xSemaphoreGive(settingsMutex);
+      esp8266SavePending = true;
+      
+      sendJson(request, [newIP, newPort](JsonWriter& w, size_t) {
+        w.beginObject();
+        w.field("success", true);
+        w.field("message", "ESP8266 settings updated");
+        w.field("ip", newIP);
+        w.field("port", newPort);
+        w.endObject();
+        return false;
+      });
+      
+      showLCDMessage("ESP8266 Config", "Updated Successfully");
+    } else {
+      request->send(400, "application/json", "{\"success\":false,\"message\":\"Invalid IP or port\"}");
+    }
+  } else {
+    // Return current ESP8266 settings and the connected sensor nodes
+    Snapshot s;
+    readSnapshot(s);
+    String ip = esp8266_ip;
+    uint16_t port = esp8266_port;
+    unsigned long now = millis();
+    // Pieces: settings, then one per node
+    sendJson(request, [s, ip, port, now](JsonWriter& w, size_t step) {
+      if (step == 0) {
+        w.beginObject();
+        w.field("ip", ip);
+        w.field("port", port);
+        w.field("connected", s.nodeConnected);
+        w.beginArray("nodes");
       } else {
-        alertBadge.textContent = 'NO ALERTS';
-        alertBadge.classList.remove('warning');
-        alertBadge.classList.add('no-alert');
+        const NodeSummary &n = s.nodes[step - 1];
+        w.beginObject();
+        w.field("ip", n.ip);
+        w.field("connectedSec", (now - n.connectedAt) / 1000);
+        w.field("lastSeenMs", now - n.lastSeen);
+        w.field("binary", n.binary);
+        w.field("messages", n.messages);
+        w.field("framesLost", n.framesLost);
+        w.endObject();
       }
-    }
+      if (step < s.nodeCount) return true;
+      w.endArray();
+      w.endObject();
+      return false;
+    });
+  }
+}
+
+// ------------------------ Event Stream --------------------------
+// /api/stream pushes what the dashboard used to poll for, as Server-Sent
+// Events: "sensors" (at most every STREAM_SENSORS_MS), "alerts", "relays",
+// "uptime" and "log" when they change, and "resync" when the client must
+// refetch /api/log. Every event carries the id of the newest log entry sent,
+// so a client that reconnects with Last-Event-ID gets the entries it missed.
+
+#define STREAM_EVENT_MAX 1536     // Longest event payload
+#define STREAM_SENSORS_MS 250
+#define STREAM_PASS_MS 20
+#define STREAM_REPLAY_MAX 16      // More missed log entries than this: resync
+#define STREAM_LOG_PER_PASS 8
+#define STREAM_MAX_WAITING 8      // Skip sensor updates while clients lag this far behind
+#define STREAM_RETRY_MS 3000
+
+// Runs every piece of `step` into out; 0 if the whole body does not fit
+size_t renderJson(JsonStep step, char* out, size_t cap) {
+  JsonWriter w;
+  size_t len = 0;
+  bool more = true;
+  for (size_t i = 0; more; i++) {
+    w.len = 0;
+    more = step(w, i);
+    if (w.overflow || len + w.len + 1 > cap) return 0;
+    memcpy(out + len, w.buf, w.len);
+    len += w.len;
+  }
+  out[len] = '\0';
+  return len;
+}
+
+// Newest log id, or 0 if the log is empty
+uint32_t newestLogId() {
+  return logNewestId;
+}
 
-    function updateStats(stats) {
-      // Temperature
-      document.getElementById('currentValue').textContent =
-        stats.temperature !== undefined && stats.temperature !== null ? `${stats.temperature.toFixed(1)}°C` : 'Error';
-      document.getElementById('avgValue').textContent =
-        stats.temperature_avg !== undefined && stats.temperature_avg !== null ? `${stats.temperature_avg.toFixed(1)}°C` : 'Error';
-      document.getElementById('maxValue').textContent =
-        stats.temperature_max !== undefined && stats.temperature_max !== null ? `${stats.temperature_max.toFixed(1)}°C` : 'Error';
-      document.getElementById('minValue').textContent =
-        stats.temperature_min !== undefined && stats.temperature_min !== null ? `${stats.temperature_min.toFixed(1)}°C` : 'Error';
+// Formats the first log entry after `afterId` into out; false if there is
+// none, or if the log stayed busy (the stream picks it up on its next pass)
+bool renderLogAfter(uint32_t afterId, uint32_t& id, char* out, size_t cap) {
+  bool found = false;
+  if (!lockForHttp(eventLogMutex)) return false;
+  for (auto &e : logEntries) {
+    if (e.id <= afterId) continue;
+    JsonWriter w;
+    writeLogEntry(w, e);
+    size_t n = min(w.len, cap - 1);
+    memcpy(out, w.buf, n);
+    out[n] = '\0';
+    id = e.id;
+    found = true;
+    break;
+  }
+  xSemaphoreGive(eventLogMutex);
+  return found;
+}
+
+bool writeAlerts(JsonWriter& w, const Snapshot& s) {
+  w.beginObject();
+  w.field("isOnline", s.isOnline);
+  w.beginArray("activeAlerts");
+  for (uint8_t i = 0; i < ACTIVE_ALERT_COUNT; i++) {
+    if (s.activeAlerts & (1 << i)) w.value(ACTIVE_ALERT_NAMES[i]);
+  }
+  w.endArray();
+  w.endObject();
+  return false;
+}
+
+uint8_t relayBits() {
+  return getRelayState(RELAY1) | getRelayState(RELAY2) << 1 | getRelayState(RELAY3) << 2 |
+         getRelayState(RELAY4) << 3 | autoMode << 4;
+}
+
+// async_tcp task: a (re)connecting client gets the current state, plus the
+// log entries it missed or a resync
+void replayStream(AsyncEventSourceClient* client) {
+  static char buf[STREAM_EVENT_MAX];  // Only used on the async_tcp task
+  uint32_t lastId = client->lastId();
+  uint32_t newest = newestLogId();
+  Snapshot s;
+  readSnapshot(s);
+
+  // Ids restart at a random base on every boot, so an id from before a
+  // reboot is almost never within reach of the current log
+  bool resync = lastId == 0 || lastId > newest || newest - lastId > STREAM_REPLAY_MAX;
+  client->send("{}", resync ? "resync" : "resumed", newest, STREAM_RETRY_MS);
+  if (!resync) {
+    uint32_t id = lastId;
+    while (renderLogAfter(id, id, buf, sizeof(buf))) client->send(buf, "log", id);
+  }
+  if (renderJson([&s](JsonWriter& w, size_t step) { return writeSensors(w, step, s); }, buf, sizeof(buf))) {
+    client->send(buf, "sensors", newest);
+  }
+  if (renderJson([&s](JsonWriter& w, size_t) { return writeAlerts(w, s); }, buf, sizeof(buf))) client->send(buf, "alerts", newest);
+  if (renderJson(writeRelays, buf, sizeof(buf))) client->send(buf, "relays", newest);
+  if (renderJson(writeUptime, buf, sizeof(buf))) client->send(buf, "uptime", newest);
+}
+
+// streamTask: broadcasts whatever changed since the last pass
+void serviceStream() {
+  static char buf[STREAM_EVENT_MAX];  // Only used by streamTask
+  static uint32_t sentLogId = 0, sentVersion = 0;
+  static uint8_t sentAlerts = 0xFF, sentRelays = 0xFF;
+  static bool sentOnline = false;
+  static int sentUptime = -1;
+  static unsigned long sentSensorsAt = 0;
+
+  if (!events.count()) {
+    // Nobody listening: new clients get the full state from replayStream()
+    sentLogId = newestLogId();
+    sentAlerts = sentRelays = 0xFF;
+    sentVersion = 0;
+    return;
+  }
+
+  // Log entries, oldest first; the rest go out on the next pass
+  uint32_t id;
+  for (int i = 0; i < STREAM_LOG_PER_PASS && renderLogAfter(sentLogId, id, buf, sizeof(buf)); i++) {
+    sentLogId = id;
+    events.send(buf, "log", sentLogId);
+  }
+
+  Snapshot s;
+  readSnapshot(s);
+  if (s.activeAlerts != sentAlerts || s.isOnline != sentOnline) {
+    sentAlerts = s.activeAlerts;
+    sentOnline = s.isOnline;
+    if (renderJson([&s](JsonWriter& w, size_t) { return writeAlerts(w, s); }, buf, sizeof(buf))) events.send(buf, "alerts", sentLogId);
+  }
+
+  uint8_t relays = relayBits();
+  if (relays != sentRelays) {
+    sentRelays = relays;
+    if (renderJson(writeRelays, buf, sizeof(buf))) events.send(buf, "relays", sentLogId);
+  }
+
+  if (systemUptimeMinutes != sentUptime) {
+    sentUptime = systemUptimeMinutes;
+    if (renderJson(writeUptime, buf, sizeof(buf))) events.send(buf, "uptime", sentLogId);
+  }
+
+  // Sensor readings are the bulk of the traffic: rate-limited, and held back
+  // while a slow client still has a queue (the next update supersedes them)
+  if (s.version != sentVersion && millis() - sentSensorsAt >= STREAM_SENSORS_MS &&
+      events.avgPacketsWaiting() < STREAM_MAX_WAITING) {
+    sentVersion = s.version;
+    sentSensorsAt = millis();
+    tracePublished();
+    if (renderJson([&s](JsonWriter& w, size_t step) { return writeSensors(w, step, s); }, buf, sizeof(buf))) {
+      events.send(buf, "sensors", sentLogId);
     }
+  }
+}
 
-    function updateRelayDisplay(relayNumber, state) {
-      const relayItem = document.querySelector(`#relay${relayNumber}Status`).closest('.relay-item');
-      const statusIndicator = relayItem.querySelector('.status-indicator');
-      const icon = relayItem.querySelector('.relay-info i');
-      if (state) {
-        statusIndicator.className = 'status-indicator status-on';
-        statusIndicator.innerHTML = '<span class="status-dot"></span>ON';
-        icon.style.color = 'var(--primary-color)';
+// ------------------------ Snapshot Endpoint --------------------------
+// /api/snapshot: everything the dashboard shows, in one response, for
+// clients that cannot use /api/stream. Each section remembers the state
+// version at which it last changed; the current version is the ETag, and
+// ?since=<version> (or a matching If-None-Match) returns only the sections
+// changed after it, or a 304 when there are none.
+
+#define SNAPSHOT_LOG_TAIL 10
+
+enum StateSection : uint8_t {
+  SECTION_SENSORS,   // Readings, stats and counters (Snapshot.version)
+  SECTION_RELAYS,    // Relay states and mode
+  SECTION_ALERTS,
+  SECTION_UPTIME,
+  SECTION_LOG,
+  SECTION_COUNT
+};
+const char* const SECTION_NAMES[SECTION_COUNT] = {"sensors", "relays", "alerts", "uptime", "log"};
+
+struct StateVersions {
+  uint32_t current;
+  uint32_t changedAt[SECTION_COUNT];
+  uint32_t fingerprint[SECTION_COUNT];  // What the section looked like at changedAt
+};
+StateVersions stateVersions;
+SemaphoreHandle_t stateVersionMutex = nullptr;
+
+// Bumps the version for every section that differs from its fingerprint.
+// Called by whoever needs the versions (no hooks in the code that changes state).
+// False if the versions stayed locked for HTTP_LOCK_WAIT_MS.
+bool refreshStateVersions(const Snapshot& s, StateVersions& v) {
+  uint32_t now[SECTION_COUNT] = {
+    s.version, relayBits(), (uint32_t)s.activeAlerts | (uint32_t)s.isOnline << 8,
+    (uint32_t)systemUptimeMinutes, newestLogId(),
+  };
+  if (!lockForHttp(stateVersionMutex)) return false;
+  bool bumped = false;
+  for (uint8_t i = 0; i < SECTION_COUNT; i++) {
+    if (now[i] == stateVersions.fingerprint[i]) continue;
+    if (!bumped) { stateVersions.current++; bumped = true; }
+    stateVersions.fingerprint[i] = now[i];
+    stateVersions.changedAt[i] = stateVersions.current;
+  }
+  v = stateVersions;
+  xSemaphoreGive(stateVersionMutex);
+  return true;
+}
+
+// The last SNAPSHOT_LOG_TAIL entries, one piece each; false when done
+bool writeLogTail(JsonWriter& w, uint32_t& lastId) {
+  bool found = false;
+  if (!lockForHttp(eventLogMutex)) return false;  // Busy: the tail is cut short
+  size_t first = logEntries.size() > SNAPSHOT_LOG_TAIL ? logEntries.size() - SNAPSHOT_LOG_TAIL : 0;
+  for (size_t i = first; i < logEntries.size(); i++) {
+    if (logEntries[i].id <= lastId) continue;
+    lastId = logEntries[i].id;
+    writeLogEntry(w, logEntries[i]);
+    found = true;
+    break;
+  }
+  xSemaphoreGive(eventLogMutex);
+  return found;
+}
+
+void handleApiSnapshot(AsyncWebServerRequest* request) {
+  Snapshot s;
+  readSnapshot(s);
+  StateVersions v;
+  if (!refreshStateVersions(s, v)) {
+    request->send(503, "text/plain", "Busy");
+    return;
+  }
+  char etag[16];
+  snprintf(etag, sizeof(etag), "\"%lu\"", (unsigned long)v.current);
+
+  // A version from the future (an earlier boot) gets everything
+  uint32_t since = 0;
+  if (request->hasArg("since")) since = strtoul(request->arg("since").c_str(), nullptr, 10);
+  if (since > v.current) since = 0;
+  bool notModified = since == v.current;
+  if (request->hasHeader("If-None-Match") && request->getHeader("If-None-Match")->value() == etag) notModified = true;
+  if (notModified) {
+    AsyncWebServerResponse* response = request->beginResponse(304);
+    response->addHeader("ETag", etag);
+    response->addHeader("Cache-Control", "no-cache");
+    request->send(response);
+    return;
+  }
+
+  uint8_t sections = 0;
+  for (uint8_t i = 0; i < SECTION_COUNT; i++) {
+    if (v.changedAt[i] > since) sections |= 1 << i;
+  }
+  if (sections & (1 << SECTION_SENSORS)) tracePublished();
+
+  // Sections are filled in as they are sent, so one may already be newer
+  // than `version`; the client then just gets it again next time.
+  uint32_t version = v.current;
+  uint8_t section = 0;
+  size_t sectionStep = 0;
+  uint32_t logId = 0;
+  AsyncWebServerResponse* response = beginJson(request,
+    [s, version, sections, section, sectionStep, logId](JsonWriter& w, size_t step) mutable {
+      if (step == 0) {
+        w.beginObject();
+        w.field("version", version);
+        w.beginArray("changed");
+        for (uint8_t i = 0; i < SECTION_COUNT; i++) {
+          if (sections & (1 << i)) w.value(SECTION_NAMES[i]);
+        }
+        w.endArray();
+        return true;
+      }
+      while (section < SECTION_COUNT && !(sections & (1 << section))) section++;
+      if (section == SECTION_COUNT) {
+        w.endObject();
+        return false;
+      }
+      bool more = false;
+      switch (section) {
+        case SECTION_SENSORS:
+          if (sectionStep == 0) w.key("sensors");
+          more = writeSensors(w, sectionStep, s);
+          break;
+        case SECTION_RELAYS:
+          w.key("relays");
+          writeRelays(w, 0);
+          break;
+        case SECTION_ALERTS:
+          w.key("alerts");
+          writeAlerts(w, s);
+          break;
+        case SECTION_UPTIME:
+          w.key("uptime");
+          writeUptime(w, 0);
+          break;
+        case SECTION_LOG:
+          if (sectionStep == 0) w.beginArray("log");
+          more = writeLogTail(w, logId);
+          if (!more) w.endArray();
+          break;
+      }
+      if (more) {
+        sectionStep++;
       } else {
-        statusIndicator.className = 'status-indicator status-off';
-        statusIndicator.innerHTML = '<span class="status-dot"></span>OFF';
-        icon.style.color = 'var(--text-secondary)';
+        section++;
+        sectionStep = 0;
       }
-    }
+      return true;
+    });
+  response->addHeader("ETag", etag);
+  response->addHeader("Cache-Control", "no-cache");
+  request->send(response);
+}
 
-    function updateBottomStats(data) {
-      document.getElementById('alertCount').textContent =
-        data.activeAlerts && data.activeAlerts.length !== undefined ? data.activeAlerts.length : 'Error';
-      document.getElementById('systemStatus').textContent =
-        data.systemStatus ? data.systemStatus : 'Error';
-      document.getElementById('dataPoints').textContent =
-        data.dataPoints !== undefined ? data.dataPoints : 'Error';
-      document.getElementById('uptimePercent').textContent =
-        data.uptimeStr ? data.uptimeStr : 'Error';
-    }
+// ------------------------ Modern HTML Dashboard --------------------------
+// The page lives in web/ (HTML, CSS, JS). tools/embed_web.py gzips it at
+// build time into web_assets.h, so it is sent straight from flash with no
+// heap copy, and a browser that already has it gets a 304.
+void serveAsset(AsyncWebServerRequest* request, const WebAsset& asset) {
+  const char* cacheControl = asset.immutable ? "public, max-age=31536000, immutable" : "no-cache";
+  if (request->hasHeader("If-None-Match") && request->getHeader("If-None-Match")->value() == asset.etag) {
+    AsyncWebServerResponse* response = request->beginResponse(304);
+    response->addHeader("ETag", asset.etag);
+    response->addHeader("Cache-Control", cacheControl);
+    request->send(response);
+    return;
+  }
+  AsyncWebServerResponse* response = request->beginResponse_P(200, asset.mime, asset.data, asset.len);
+  response->addHeader("Content-Encoding", "gzip");
+  response->addHeader("ETag", asset.etag);
+  response->addHeader("Cache-Control", cacheControl);
+  request->send(response);
+}
 
-    // ESP8266 Configuration Functions
-    function saveESP8266Config(event) {
-      event.preventDefault();
-      const submitBtn = event.target.querySelector('button[type="submit"]');
-      const originalText = submitBtn.innerHTML;
-      submitBtn.innerHTML = '<span class="loading"></span> Saving...';
-      submitBtn.disabled = true;
-
-      const config = {
-        ip: document.getElementById('esp8266IP').value,
-        port: document.getElementById('esp8266Port').value
-      };
-
-      fetch('/api/esp8266/config', {
-        method: 'POST',
-        headers: { 'Content-Type': 'application/json' },
-        body: JSON.stringify(config)
-      })
-      .then(response => response.json())
-      .then(data => {
-        if (data.success) {
-          submitBtn.innerHTML = '<i class="fas fa-check"></i> Saved!';
-          addLogEntry('ESP8266 configuration updated: ' + data.ip + ':' + data.port);
-          setTimeout(() => {
-            submitBtn.innerHTML = originalText;
-            submitBtn.disabled = false;
-          }, 2000);
-        } else {
-          throw new Error(data.message);
-        }
-      })
-      .catch(error => {
-        console.error('Error saving ESP8266 config:', error);
-        submitBtn.innerHTML = '<i class="fas fa-exclamation-triangle"></i> Error!';
-        addLogEntry('ESP8266 configuration failed: ' + error.message);
-        setTimeout(() => {
-          submitBtn.innerHTML = originalText;
-          submitBtn.disabled = false;
-        }, 2000);
-      });
-    }
+// ------------------------ Web Handlers --------------------------
+void handleRelay(AsyncWebServerRequest* request, int n) {
+  OutputCommand c = {};
+  c.op = OUT_TOGGLE_RELAY; c.relay = n;
+  if (!autoMode && !queueOutputs(c)) { request->send(503, "text/plain", "Busy"); return; }
+  request->send(200, "text/plain", "OK");
+}
 
-    function loadESP8266Config() {
-      fetch('/api/esp8266/config')
-        .then(response => response.json())
-        .then(data => {
-          document.getElementById('esp8266IP').value = data.ip;
-          document.getElementById('esp8266Port').value = data.port;
-          updateESP8266Status(data.connected);
-        })
-        .catch(error => {
-          console.error('Error loading ESP8266 config:', error);
-        });
+void handleToggleMode(AsyncWebServerRequest* request) {
+  OutputCommand c = {};
+  c.op = OUT_TOGGLE_MODE;
+  if (!queueOutputs(c)) { request->send(503, "text/plain", "Busy"); return; }
+  request->send(200, "text/plain", "OK");
+}
+
+void handleSetThreshold(AsyncWebServerRequest* request) {
+  OutputCommand c = currentSettings();
+  if (request->hasArg("temp")) c.temp = request->arg("temp").toInt();
+  if (request->hasArg("gas")) c.gas = request->arg("gas").toInt();
+  if (!queueOutputs(c)) { request->send(503, "text/plain", "Busy"); return; }
+  logEvent("Thresholds Updated. TEMP=" + String(c.temp) + ", GAS=" + String(c.gas));
+  request->send(200, "text/plain", "OK");
+}
+
+void handleAllOn(AsyncWebServerRequest* request) {
+  OutputCommand c = {};
+  c.op = OUT_SET_ALL; c.on = true;
+  if (!autoMode && !queueOutputs(c)) { request->send(503, "text/plain", "Busy"); return; }
+  request->send(200, "text/plain", "OK");
+}
+
+void handleAllOff(AsyncWebServerRequest* request) {
+  OutputCommand c = {};
+  c.op = OUT_SET_ALL; c.on = false;
+  if (!autoMode && !queueOutputs(c)) { request->send(503, "text/plain", "Busy"); return; }
+  request->send(200, "text/plain", "OK");
+}
+
+// ------------------------ Tasks --------------------------
+// Core 1: sockets, parsing and automation. Never sleeps longer than a tick.
+void ingestTask(void*) {
+  unsigned long lastPing = 0;
+  for (;;) {
+    acceptNodes();
+    serviceNodes();
+    processNodeCommands();
+    processOutputCommands();
+    serviceAutomation();
+
+    // Set isOnline to false if no sensor update for SENSOR_TIMEOUT (or one heartbeat)
+    if (isOnline && millis() - lastSensorUpdate > sensorTimeoutMs()) {
+      isOnline = false;
+      esp8266_connected = false;
+      snapshotDirty = true;
     }
 
-    function updateESP8266Status(connected) {
-      const statusBadge = document.getElementById('esp8266Status');
-      if (connected) {
-        statusBadge.className = 'status-badge online';
-        statusBadge.innerHTML = '<i class="fas fa-circle" style="font-size: 0.5rem;"></i>Connected';
-      } else {
-        statusBadge.className = 'status-badge offline';
-        statusBadge.innerHTML = '<i class="fas fa-circle" style="font-size: 0.5rem;"></i>Disconnected';
+    // Send periodic ping to ESP8266 every 10 seconds
+    if (millis() - lastPing > 10000) {
+      sendToNodes(("PING:ESP32,T=" + String(millis())).c_str());
+      for (auto &n : nodes) {
+        if (n.clockRttMs < ULONG_MAX) n.clockRttMs++;  // Let newer samples replace an old best as the clocks drift
       }
+      lastPing = millis();
     }
-  </script>
-</body>
-</html>
-  )rawliteral";
-  return html;
+
+    if (snapshotDirty) publishSnapshot();
+    vTaskDelay(1);
+  }
 }
 
-// ------------------------ Web Handlers --------------------------
-void handleRoot() { server.send(200, "text/html", htmlPage()); }
+// Core 0: the LCD (I2C is slow, and messages hold the screen for seconds)
+void displayTask(void*) {
+  LcdMessage m;
+  for (;;) {
+    if (xQueueReceive(lcdQueue, &m, pdMS_TO_TICKS(2000)) == pdTRUE) {
+      drawLCDMessage(m.line1, m.line2);
+      vTaskDelay(pdMS_TO_TICKS(m.durationMs));
+    }
+    updateLCD();
+  }
+}
 
-void handleRelay(int n) {
-  if (!autoMode) {
-    int pin = (n == 1) ? RELAY1 : (n == 2) ? RELAY2 : (n == 3) ? RELAY3 : RELAY4;
-    setRelay(pin, !getRelayState(pin));
-    saveRelayStates();
-    logEvent("Relay " + String(n) + " toggled manually");
+// Core 0: Telegram, one message at a time
+void notifyTask(void*) {
+  TelegramMessage m;
+  for (;;) {
+    if (xQueueReceive(notifyQueue, &m, portMAX_DELAY) == pdTRUE) sendTelegram(m.text);
   }
-  server.send(200, "text/plain", "OK");
 }
 
-void handleToggleMode() {
-  autoMode = !autoMode;
-  EEPROM.write(ADDR_MODE, autoMode);
-  EEPROM.commit();
-  logEvent("Mode changed to " + String(autoMode ? "Auto" : "Manual"));
-  server.send(200, "text/plain", "OK");
+// Core 0: /api/stream. The ESP32Async AsyncEventSource locks its client list
+// and queues, so it may be fed from a task other than async_tcp; loop() is
+// kept out of it (flash flushes there would stall the stream).
+void streamTask(void*) {
+  for (;;) {
+    serviceStream();
+    vTaskDelay(pdMS_TO_TICKS(STREAM_PASS_MS));
+  }
 }
 
-void handleSetThreshold() {
-  if (server.hasArg("temp")) TEMP_THRESHOLD = server.arg("temp").toInt();
-  if (server.hasArg("gas")) GAS_THRESHOLD = server.arg("gas").toInt();
-  EEPROM.write(ADDR_THRESH_TEMP, TEMP_THRESHOLD);
-  EEPROM.write(ADDR_THRESH_GAS, GAS_THRESHOLD);
-  EEPROM.commit();
-  logEvent("Thresholds Updated. TEMP=" + String(TEMP_THRESHOLD) + ", GAS=" + String(GAS_THRESHOLD));
-  server.send(200, "text/plain", "OK");
+void startTasks() {
+  nodeCommandQueue = xQueueCreate(NODE_COMMAND_QUEUE_LEN, sizeof(NodeCommand));
+  outputQueue = xQueueCreate(OUTPUT_QUEUE_LEN, sizeof(OutputCommand));
+  notifyQueue = xQueueCreate(NOTIFY_QUEUE_LEN, sizeof(TelegramMessage));
+  publishSnapshot();
+  xTaskCreatePinnedToCore(ingestTask, "ingest", INGEST_STACK, nullptr, 3, nullptr, APP_CPU_NUM);
+  xTaskCreatePinnedToCore(notifyTask, "notify", NOTIFY_STACK, nullptr, 1, nullptr, PRO_CPU_NUM);
+  xTaskCreatePinnedToCore(streamTask, "stream", STREAM_STACK, nullptr, 1, nullptr, PRO_CPU_NUM);
+  // Last: showLCDMessage() switches to the queue once it exists
+  QueueHandle_t q = xQueueCreate(LCD_QUEUE_LEN, sizeof(LcdMessage));
+  xTaskCreatePinnedToCore(displayTask, "display", DISPLAY_STACK, nullptr, 1, nullptr, PRO_CPU_NUM);
+  lcdQueue = q;
 }
 
-void handleAllOn() {
-  if (!autoMode) {
-    setRelay(RELAY1, true);
-    setRelay(RELAY2, true);
-    setRelay(RELAY3, true);
-    setRelay(RELAY4, true);
-    saveRelayStates();
-    logEvent("All relays turned ON");
+// ------------------------ Flash Store --------------------------
+// History, log entries and sensor stats survive a restart in a LittleFS
+// segment store (lib/LabGuardStore). Only loop() touches it: serviceStore()
+// batches finished 1 minute buckets, new log entries and the stats, and
+// writes them once every STORE_FLUSH_MS instead of once per sample. setup()
+// replays it before the tasks start.
+#define STORE_DIR "/lg"
+#define STORE_FLUSH_MS 600000UL          // 10 minutes; at most this much is lost on power loss
+#define STORE_MIN_FLUSH_MS 60000UL       // Early flushes when the batch fills, at most this often
+#define STORE_MAX_BYTES (768 * 1024UL)   // Of the 1.4 MB LittleFS partition
+#define STORE_RETENTION_SEC (7 * 24 * 3600UL)
+#define STORE_EVENT_MAX 120              // Characters of a log message kept
+#define STORE_PER_PASS 8                 // Minutes / log entries batched per loop() pass
+#define STORE_TIER 0                     // histTiers[0], the 1 minute rollup
+
+enum StoreRecordType : uint8_t { STORE_MINUTE = 1, STORE_EVENT = 2, STORE_STATS = 3 };
+
+struct StoreMinute {
+  HistBucket ch[HIST_CHANNELS];
+};
+
+struct StoreStats {
+  SensorStats temp, gas, sound, light, dist;
+};
+
+LgLittleFs storeFs;
+LgStore store;
+bool storeReady = false;
+uint32_t storedMinute = 0;         // Newest 1 minute bucket id batched
+uint32_t storedLogId = 0;          // Newest log entry id batched
+unsigned long storeFlushedAt = 0;
+bool storeErrorReported = false;
+
+struct StoreRestore {
+  std::vector<LogEntry> events;
+  uint32_t minutes = 0;
+  uint32_t statsTime = 0;
+  bool stats = false;
+};
+
+// Oldest first by time; compaction copies events forward, so they can come late
+void trimRestoredEvents(std::vector<LogEntry> &events) {
+  std::stable_sort(events.begin(), events.end(), [](const LogEntry &a, const LogEntry &b) { return a.timestamp < b.timestamp; });
+  if (events.size() > LOG_MAX_ENTRIES) events.erase(events.begin(), events.end() - LOG_MAX_ENTRIES);
+}
+
+void restoreRecord(const LgStoreRecord &rec, void* ctx) {
+  StoreRestore &r = *(StoreRestore*)ctx;
+  if (rec.type == STORE_MINUTE && rec.len == sizeof(StoreMinute)) {
+    StoreMinute m;
+    memcpy(&m, rec.payload, sizeof(m));
+    for (uint8_t c = 0; c < HIST_CHANNELS; c++) {
+      if (m.ch[c].count) historyAddBucket((HistChannel)c, rec.time, m.ch[c]);
+    }
+    uint32_t id = rec.time / histTiers[STORE_TIER].widthSec;
+    if (id > storedMinute) storedMinute = id;
+    r.minutes++;
+  } else if (rec.type == STORE_EVENT) {
+    char msg[STORE_EVENT_MAX + 1];
+    size_t n = min((size_t)rec.len, (size_t)STORE_EVENT_MAX);
+    memcpy(msg, rec.payload, n);
+    msg[n] = '\0';
+    r.events.push_back({rec.time, String(msg), 0});
+    if (r.events.size() >= 2 * LOG_MAX_ENTRIES) trimRestoredEvents(r.events);
+  } else if (rec.type == STORE_STATS && rec.len == sizeof(StoreStats) && rec.time >= r.statsTime) {
+    StoreStats st;
+    memcpy(&st, rec.payload, sizeof(st));
+    tempStats = st.temp; gasStats = st.gas; soundStats = st.sound;
+    lightStats = st.light; distStats = st.dist;
+    r.statsTime = rec.time;
+    r.stats = true;
   }
-  server.send(200, "text/plain", "OK");
 }
 
-void handleAllOff() {
-  if (!autoMode) {
-    setRelay(RELAY1, false);
-    setRelay(RELAY2, false);
-    setRelay(RELAY3, false);
-    setRelay(RELAY4, false);
-    saveRelayStates();
-    logEvent("All relays turned OFF");
+// setup(), before the tasks start and before anything is logged
+void beginStore() {
+  StoreRestore r;
+  if (!LittleFS.begin(true) || !lgStoreBegin(store, storeFs, STORE_DIR, restoreRecord, &r)) {
+    LG_ERROR("❌ LittleFS unavailable, history will not survive a restart");
+    return;
+  }
+  storeReady = true;
+  if (store.lastTime) timelineOffset = store.lastTime + 1;
+  trimRestoredEvents(r.events);
+  for (auto &e : r.events) {
+    e.id = logNextId++;
+    logEntries.push_back(e);
+  }
+  if (!logEntries.empty()) logNewestId = logEntries.back().id;
+  storedLogId = logNextId - 1;
+  LG_INFO("💾 Store: %u segments, %lu bytes; restored %lu minutes, %u log entries%s",
+          (unsigned)store.segmentCount, (unsigned long)store.totalBytes, (unsigned long)r.minutes,
+          (unsigned)r.events.size(), r.stats ? ", stats" : "");
+  if (store.tornSegments) LG_WARN("⚠️ Store: %lu segment(s) ended in a torn write", (unsigned long)store.tornSegments);
+}
+
+// setup(), once Wi-Fi is up and before the tasks start: SNTP time turns the
+// timeline into epoch seconds, so records carry wall-clock time and a restart
+// leaves its real gap. Without it (or with a clock behind the store) the
+// continued timeline from beginStore() stays for this run.
+void beginClock() {
+  configTzTime(TIME_ZONE, NTP_SERVER);
+  unsigned long start = millis();
+  time_t epoch;
+  while ((epoch = time(nullptr)) < (time_t)EPOCH_VALID && millis() - start < SNTP_WAIT_MS) delay(100);
+  if (epoch < (time_t)EPOCH_VALID || (uint32_t)epoch <= store.lastTime) {
+    LG_WARN("⚠️ No SNTP time, timeline continues from the store");
+    return;
+  }
+  uint32_t offset = (uint32_t)epoch - millis() / 1000;
+  xSemaphoreTake(eventLogMutex, portMAX_DELAY);
+  for (auto &e : logEntries) {
+    if (e.id > storedLogId) e.timestamp += offset - timelineOffset;  // Logged during this boot
+  }
+  timelineOffset = offset;
+  xSemaphoreGive(eventLogMutex);
+  LG_INFO("🕒 SNTP time: %lu", (unsigned long)epoch);
+}
+
+// Buffers one record, flushing early when the batch is full (rate-limited,
+// the caller retries on a later pass)
+bool storeAppend(uint8_t type, uint32_t time, const void* payload, size_t len) {
+  if (lgStoreAppend(store, type, time, payload, len)) return true;
+  if (millis() - storeFlushedAt < STORE_MIN_FLUSH_MS) return false;
+  storeFlushedAt = millis();
+  return lgStoreFlush(store) && lgStoreAppend(store, type, time, payload, len);
+}
+
+// Compaction keeps the log entries still on the dashboard
+bool storeKeepEvent(const LgStoreRecord &rec, void* ctx) {
+  return rec.type == STORE_EVENT && rec.time >= *(uint32_t*)ctx;
+}
+
+// loop(): batches what is new; writes it every STORE_FLUSH_MS, or now (restart)
+void serviceStore(bool flushNow = false) {
+  if (!storeReady) return;
+
+  // Finished 1 minute buckets, oldest first (the head is still filling)
+  const HistTier &tier = histTiers[STORE_TIER];
+  for (uint8_t k = 0; k < STORE_PER_PASS; k++) {
+    StoreMinute m;
+    portENTER_CRITICAL(&historyLock);
+    uint32_t head = tier.headId;
+    uint32_t id = max(storedMinute + 1, head >= tier.size ? head - tier.size + 1 : 0);
+    if (id < head) {
+      for (uint8_t c = 0; c < HIST_CHANNELS; c++) m.ch[c] = tier.buckets[c * tier.size + id % tier.size];
+    }
+    portEXIT_CRITICAL(&historyLock);
+    if (id >= head) break;
+    bool any = false;
+    for (auto &b : m.ch) any |= b.count > 0;
+    if (any && !storeAppend(STORE_MINUTE, id * tier.widthSec, &m, sizeof(m))) break;
+    storedMinute = id;
+  }
+
+  // New log entries, copied out so no flash write happens under the mutex
+  struct { uint32_t id, time; char msg[STORE_EVENT_MAX + 1]; } pending[STORE_PER_PASS];
+  uint8_t count = 0;
+  uint32_t keepFrom = 0;
+  xSemaphoreTake(eventLogMutex, portMAX_DELAY);
+  for (auto &e : logEntries) {
+    if (e.id <= storedLogId) continue;
+    if (count == STORE_PER_PASS) break;
+    pending[count].id = e.id;
+    pending[count].time = e.timestamp;
+    strlcpy(pending[count].msg, e.message.c_str(), sizeof(pending[count].msg));
+    count++;
+  }
+  if (!logEntries.empty()) keepFrom = logEntries.front().timestamp;
+  xSemaphoreGive(eventLogMutex);
+  for (uint8_t i = 0; i < count; i++) {
+    if (!storeAppend(STORE_EVENT, pending[i].time, pending[i].msg, strlen(pending[i].msg))) break;
+    storedLogId = pending[i].id;
+  }
+
+  if (!flushNow && millis() - storeFlushedAt < STORE_FLUSH_MS) return;
+  storeFlushedAt = millis();
+  static Snapshot s;                 // Only used by loop()
+  readSnapshot(s);
+  StoreStats st = {s.temp, s.gas, s.sound, s.light, s.dist};
+  uint32_t now = timelineNow();
+  bool added = lgStoreAppend(store, STORE_STATS, now, &st, sizeof(st)) ||
+               (lgStoreFlush(store) && lgStoreAppend(store, STORE_STATS, now, &st, sizeof(st)));
+  if (!added || !lgStoreFlush(store)) {
+    if (!storeErrorReported) LG_WARN("⚠️ Store: flush failed (%lu bytes waiting)", (unsigned long)store.batchLen);
+    storeErrorReported = true;
+    return;
+  }
+  storeErrorReported = false;
+  uint32_t minTime = now > STORE_RETENTION_SEC ? now - STORE_RETENTION_SEC : 0;
+  while (lgStoreCompact(store, STORE_MAX_BYTES, minTime, storeKeepEvent, &keepFrom)) {
+    LG_DEBUG("🗜️ Store: dropped oldest segment, %lu bytes left", (unsigned long)store.totalBytes);
   }
-  server.send(200, "text/plain", "OK");
 }
 
 // ------------------------ Setup & Loop --------------------------
 void setup() {
   Serial.begin(115200);
+  lgLogBegin(Serial);
+  eventLogMutex = xSemaphoreCreateMutex();
+  settingsMutex = xSemaphoreCreateMutex();
+  logNextId = 1 + (esp_random() & 0xFFFFFF);  // See replayStream()
+  stateVersionMutex = xSemaphoreCreateMutex();
+  stateVersions.current = 1 + (esp_random() & 0xFFFFFF);  // Same for ?since=
   EEPROM.begin(EEPROM_SIZE);
   pinMode(RELAY1, OUTPUT); pinMode(RELAY2, OUTPUT);
   pinMode(RELAY3, OUTPUT); pinMode(RELAY4, OUTPUT);
@@ -1799,35 +3105,44 @@ void setup() {
   
   // Load settings
   loadRelayStates();
+  loadDeadbands();
   loadESP8266Settings();
+  beginStore();
   
   setLEDs(true, false, false);
   showLCDMessage("Connecting to", "Wi-Fi...");
 
   WiFi.begin(ssid, password);
+  lgLogFlush();
   while (WiFi.status() != WL_CONNECTED) { delay(500); Serial.print("."); }
+  Serial.println();
   setLEDs(false, true, false);
-  Serial.println("Wi-Fi connected: " + WiFi.localIP().toString());
+  LG_INFO("Wi-Fi connected: %s", WiFi.localIP().toString());
   
   showLCDMessage("Wi-Fi Connected", WiFi.localIP().toString());
 
-  if (MDNS.begin("labguard")) Serial.println("mDNS ready: http://labguard.local");
+  beginClock();
+
+  if (MDNS.begin("labguard")) LG_INFO("mDNS ready: http://labguard.local");
 
   tcpServer.begin();
-  server.on("/", handleRoot);
-  server.on("/api/sensors", handleApiSensors);
-  server.on("/api/relays", handleApiRelays);
-  server.on("/api/log", handleApiLog);
-  server.on("/api/uptime", handleApiUptime);
-  server.on("/relay1", []() { handleRelay(1); });
-  server.on("/relay2", []() { handleRelay(2); });
-  server.on("/relay3", []() { handleRelay(3); });
-  server.on("/relay4", []() { handleRelay(4); });
-  server.on("/mode", handleToggleMode);
-  server.on("/set", handleSetThreshold);
-  server.on("/allon", handleAllOn);
-  server.on("/alloff", handleAllOff);
-  server.on("/api/settings", HTTP_POST, handleApiSettings);
+  for (size_t i = 0; i < WEB_ASSET_COUNT; i++) {
+    const WebAsset* asset = &WEB_ASSETS[i];
+    server.on(asset->path, HTTP_GET, [asset](AsyncWebServerRequest* r) { serveAsset(r, *asset); });
+  }
+  server.on("/api/sensors", HTTP_ANY, handleApiSensors);
+  server.on("/api/relays", HTTP_ANY, handleApiRelays);
+  server.on("/api/log", HTTP_ANY, handleApiLog);
+  server.on("/api/uptime", HTTP_ANY, handleApiUptime);
+  server.on("/relay1", HTTP_ANY, [](AsyncWebServerRequest* r) { handleRelay(r, 1); });
+  server.on("/relay2", HTTP_ANY, [](AsyncWebServerRequest* r) { handleRelay(r, 2); });
+  server.on("/relay3", HTTP_ANY, [](AsyncWebServerRequest* r) { handleRelay(r, 3); });
+  server.on("/relay4", HTTP_ANY, [](AsyncWebServerRequest* r) { handleRelay(r, 4); });
+  server.on("/mode", HTTP_ANY, handleToggleMode);
+  server.on("/set", HTTP_ANY, handleSetThreshold);
+  server.on("/allon", HTTP_ANY, handleAllOn);
+  server.on("/alloff", HTTP_ANY, handleAllOff);
+  server.on("/api/settings", HTTP_POST, handleApiSettings, nullptr, collectBody);
   server.on("/api/mode/toggle", HTTP_POST, handleApiModeToggle);
   server.on("/api/relay/all/on", HTTP_POST, handleApiAllOn);
   server.on("/api/relay/all/off", HTTP_POST, handleApiAllOff);
@@ -1835,97 +3150,63 @@ void setup() {
   server.on("/api/relay/2/toggle", HTTP_POST, handleApiRelayToggle);
   server.on("/api/relay/3/toggle", HTTP_POST, handleApiRelayToggle);
   server.on("/api/relay/4/toggle", HTTP_POST, handleApiRelayToggle);
-  server.on("/api/chart/temperature", handleApiChart);
-  server.on("/api/chart/gas", handleApiChart);
-  server.on("/api/chart/light", handleApiChart);
-  server.on("/api/chart/sound", handleApiChart);
-  server.on("/api/trend/all", handleApiTrend);
-  server.on("/api/trend/environmental", handleApiTrend);
-  server.on("/api/trend/safety", handleApiTrend);
-  server.on("/api/esp8266/config", handleApiESP8266Config);
+  server.on("/api/chart/temperature", HTTP_ANY, handleApiChart);
+  server.on("/api/chart/gas", HTTP_ANY, handleApiChart);
+  server.on("/api/chart/light", HTTP_ANY, handleApiChart);
+  server.on("/api/chart/sound", HTTP_ANY, handleApiChart);
+  server.on("/api/trend/all", HTTP_ANY, handleApiTrend);
+  server.on("/api/trend/environmental", HTTP_ANY, handleApiTrend);
+  server.on("/api/trend/safety", HTTP_ANY, handleApiTrend);
+  server.on("/api/esp8266/config", HTTP_ANY, handleApiESP8266Config);
+  server.on("/api/gasfilter", HTTP_ANY, handleApiGasFilter, nullptr, collectBody);
+  server.on("/api/latency", HTTP_ANY, handleApiLatency);
+  server.on("/api/snapshot", HTTP_GET, handleApiSnapshot);
+  events.onConnect(replayStream);
+  server.addHandler(&events);
   server.begin();
+  startTasks();
+  LG_INFO("🧠 Free heap %lu bytes, history uses %u bytes static",
+          (unsigned long)ESP.getFreeHeap(), (unsigned)(sizeof(histRaw) + sizeof(hist1m) + sizeof(hist30m)));
   logEvent("System Boot Complete.");
 }
 
+// EEPROM writes requested by automation and the HTTP handlers
+void servicePersistence() {
+  if (relaySavePending) {
+    relaySavePending = false;
+    saveRelayStates();
+  }
+  if (deadbandSavePending) {
+    deadbandSavePending = false;
+    saveDeadbands();
+  }
+  if (esp8266SavePending) {
+    esp8266SavePending = false;
+    saveESP8266Settings();
+  }
+}
+
+// Core 1, below ingestTask: housekeeping only
 void loop() {
   if (digitalRead(RESET_BUTTON) == LOW) {
     logEvent("Manual Reset Triggered");
+    serviceStore(true);
+    lgLogFlush();
     delay(500);
     ESP.restart();
   }
+  lgLogDrain();
+  servicePersistence();
+  serviceStore();
 
   if (millis() - lastUptimeLog > 60000) {
     systemUptimeMinutes++;
     lastUptimeLog = millis();
   }
 
-  // Set isOnline to false if no sensor update for SENSOR_TIMEOUT
-  if (millis() - lastSensorUpdate > SENSOR_TIMEOUT) {
-    isOnline = false;
-    esp8266_connected = false;
-  }
-
-  server.handleClient();
-  client = tcpServer.available();
-  if (client) {
-    String msg = client.readStringUntil('\n');
-    msg.trim();
-    if (msg.startsWith("DATA:")) {
-      parseSensorData(msg);
-      esp8266_connected = true;
-      isOnline = true;
-      lastSensorUpdate = millis();
-      setLEDs(false, true, true); // Green LED on when ESP8266 connected
-    } else if (msg.startsWith("INFO:ESP8266_IP=")) {
-      esp8266_actual_ip = msg.substring(15); // Remove "INFO:ESP8266_IP=" prefix
-      logEvent("ESP8266 IP: " + esp8266_actual_ip);
-    } else if (msg.startsWith("PONG:")) {
-      // Keep-alive response from ESP8266
-      esp8266_connected = true;
-      lastSensorUpdate = millis();
-    }
-    logEvent("From ESP8266: " + msg);
-    // Automation logic (as before)
-    if (autoMode && msg.startsWith("ALERT:")) {
-      if (msg == "ALERT:GAS_LEAK") {
-        setRelay(RELAY1, true);
-        notifyTelegram("⚠️ GAS Leak detected! Exhaust Fan ON");
-      } else if (msg == "ALERT:TEMP_HIGH") {
-        setRelay(RELAY3, true);
-        notifyTelegram("🔥 High Temperature detected! Cooling Fan ON");
-      } else if (msg == "ALERT:MOTION_PIR" || msg == "ALERT:PRESENCE_DETECTED") {
-        setRelay(RELAY2, true);
-        notifyTelegram("👁️ Motion Detected! Lights ON");
-      } else if (msg == "ALERT:SOUND_EVENT" || msg == "ALERT:IR_TRIGGERED") {
-        blinkBuzzer(3, 200);
-        notifyTelegram("🔊 Sound/IR Triggered! Alarm Blinking");
-      }
-      saveRelayStates();
-      delay(2000);
-      setRelay(RELAY1, false); setRelay(RELAY2, false);
-      setRelay(RELAY3, false); setRelay(RELAY4, false);
-      saveRelayStates();
-    }
-  }
-
-  // Update LCD display every 2 seconds
-  static unsigned long lastLCDUpdate = 0;
-  if (millis() - lastLCDUpdate > 2000) {
-    updateLCD();
-    lastLCDUpdate = millis();
-  }
-
-  // Send periodic ping to ESP8266 every 10 seconds
-  static unsigned long lastPing = 0;
-  if (millis() - lastPing > 10000) {
-    if (client.connected()) {
-      client.println("PING:ESP32");
-    }
-    lastPing = millis();
-  }
-
   if (WiFi.status() != WL_CONNECTED) {
     setLEDs(true, false, false);
     WiFi.begin(ssid, password);
   }
-} 
\ No newline at end of file
+  delay(1);
+}
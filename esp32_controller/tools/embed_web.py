@@ -0,0 +1,114 @@
+# LabGuard+ dashboard asset embedder
+# --------------------------------------------------
+# Gzips everything in web/ and writes src/web_assets.h: one PROGMEM byte
+# array per file plus a table with its URL, MIME type and ETag. Runs as a
+# PlatformIO pre-build script (extra_scripts) and can also be run by hand:
+#
+#   python tools/embed_web.py
+#
+# References from index.html to the other assets ("/style.css") get a
+# ?v=<etag> suffix, so those can be cached for good and index.html itself
+# only needs a cheap If-None-Match revalidation.
+
+import gzip
+import hashlib
+import os
+
+MIME_TYPES = {
+    ".html": "text/html",
+    ".css": "text/css",
+    ".js": "application/javascript",
+    ".svg": "image/svg+xml",
+    ".ico": "image/x-icon",
+    ".json": "application/json",
+}
+
+try:
+    Import("env")  # noqa: F821 - provided by PlatformIO/SCons
+    ROOT = env["PROJECT_DIR"]  # noqa: F821
+except NameError:
+    ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+WEB_DIR = os.path.join(ROOT, "web")
+OUT_FILE = os.path.join(ROOT, "src", "web_assets.h")
+
+
+def symbol(name):
+    return "WEB_" + "".join(c.upper() if c.isalnum() else "_" for c in name) + "_GZ"
+
+
+def compress(data):
+    # mtime=0 keeps the output (and so the ETag) identical across builds
+    return gzip.compress(data, compresslevel=9, mtime=0)
+
+
+def etag(gz):
+    return '"' + hashlib.sha1(gz).hexdigest()[:16] + '"'
+
+
+def build():
+    names = sorted(n for n in os.listdir(WEB_DIR) if os.path.splitext(n)[1] in MIME_TYPES)
+    assets = {}
+    for name in names:
+        if name.endswith(".html"):
+            continue
+        with open(os.path.join(WEB_DIR, name), "rb") as f:
+            gz = compress(f.read())
+        assets[name] = (gz, etag(gz))
+
+    for name in names:
+        if not name.endswith(".html"):
+            continue
+        with open(os.path.join(WEB_DIR, name), "rb") as f:
+            page = f.read()
+        for ref, (_, tag) in assets.items():
+            page = page.replace(('"/%s"' % ref).encode(), ('"/%s?v=%s"' % (ref, tag.strip('"'))).encode())
+        gz = compress(page)
+        assets[name] = (gz, etag(gz))
+
+    out = [
+        "// Generated by tools/embed_web.py from web/ - do not edit",
+        "#pragma once",
+        "",
+        "#include <Arduino.h>",
+        "",
+        "struct WebAsset {",
+        "  const char* path;",
+        "  const char* mime;",
+        "  const uint8_t* data;  // gzip, in flash",
+        "  size_t len;",
+        "  const char* etag;",
+        "  bool immutable;       // Referenced with ?v=<etag>, safe to cache forever",
+        "};",
+        "",
+    ]
+    for name in names:
+        gz = assets[name][0]
+        out.append("static const uint8_t %s[] PROGMEM = {" % symbol(name))
+        for i in range(0, len(gz), 16):
+            out.append("  " + ", ".join("0x%02x" % b for b in gz[i:i + 16]) + ",")
+        out.append("};")
+        out.append("")
+    out.append("static const WebAsset WEB_ASSETS[] = {")
+    for name in names:
+        gz, tag = assets[name]
+        path = "/" if name == "index.html" else "/" + name
+        out.append('  {"%s", "%s", %s, %d, "%s", %s},' % (
+            path, MIME_TYPES[os.path.splitext(name)[1]], symbol(name), len(gz),
+            tag.replace('"', '\\"'), "false" if name.endswith(".html") else "true"))
+    out.append("};")
+    out.append("#define WEB_ASSET_COUNT (sizeof(WEB_ASSETS) / sizeof(WEB_ASSETS[0]))")
+    out.append("")
+    text = "\n".join(out)
+
+    # Only touch the header when something changed, so main.cpp is not rebuilt
+    if os.path.exists(OUT_FILE):
+        with open(OUT_FILE) as f:
+            if f.read() == text:
+                return
+    with open(OUT_FILE, "w") as f:
+        f.write(text)
+    for name in names:
+        print("embed_web: %-12s %6d bytes gzipped" % (name, len(assets[name][0])))
+
+
+build()
@@ -0,0 +1,664 @@
+// Global variables for charts
+let sensorChart, trendChart;
+let currentSensorType = 'temperature';
+let currentTimeRange = '1h';
+
+// Theme toggle functionality
+function toggleTheme() {
+  const body = document.body;
+  const themeToggle = document.querySelector('.theme-toggle .btn i');
+  
+  if (body.classList.contains('dark-theme')) {
+    body.classList.remove('dark-theme');
+    themeToggle.className = 'fas fa-moon';
+    localStorage.setItem('theme', 'light');
+  } else {
+    body.classList.add('dark-theme');
+    themeToggle.className = 'fas fa-sun';
+    localStorage.setItem('theme', 'dark');
+  }
+}
+
+// Load saved theme
+const savedTheme = localStorage.getItem('theme');
+if (savedTheme === 'dark') {
+  document.body.classList.add('dark-theme');
+  document.querySelector('.theme-toggle .btn i').className = 'fas fa-sun';
+}
+
+// Relay control functions
+function toggleRelay(relayNumber) {
+  const button = event.target.closest('.btn');
+  const originalText = button.innerHTML;
+  button.innerHTML = '<span class="loading"></span>';
+  button.disabled = true;
+
+  fetch(`/api/relay/${relayNumber}/toggle`, {
+    method: 'POST',
+    headers: { 'Content-Type': 'application/json' }
+  })
+  .then(response => response.json())
+  .then(data => {
+    updateRelayDisplay(relayNumber, data.state);
+    addLogEntry(`Relay ${relayNumber} toggled ${data.state ? 'ON' : 'OFF'}`);
+    button.innerHTML = originalText;
+    button.disabled = false;
+  })
+  .catch(error => {
+    console.error('Error toggling relay:', error);
+    button.innerHTML = originalText;
+    button.disabled = false;
+  });
+}
+
+function updateRelayDisplay(relayNumber, state) {
+  const relayItem = document.querySelector(`#relay${relayNumber}Status`).closest('.relay-item');
+  const statusIndicator = relayItem.querySelector('.status-indicator');
+  const icon = relayItem.querySelector('.relay-info i');
+  
+  if (state) {
+    statusIndicator.className = 'status-indicator status-on';
+    statusIndicator.innerHTML = '<span class="status-dot"></span>ON';
+    icon.style.color = 'var(--primary-color)';
+  } else {
+    statusIndicator.className = 'status-indicator status-off';
+    statusIndicator.innerHTML = '<span class="status-dot"></span>OFF';
+    icon.style.color = 'var(--text-secondary)';
+  }
+}
+
+function toggleMode() {
+  fetch('/api/mode/toggle', { method: 'POST' })
+    .then(response => response.json())
+    .then(data => {
+      document.getElementById('modeDisplay').textContent = data.mode;
+      addLogEntry(`System mode changed to ${data.mode}`);
+    });
+}
+
+function allOn() {
+  fetch('/api/relay/all/on', { method: 'POST' })
+    .then(response => response.json())
+    .then(data => {
+      for (let i = 1; i <= 4; i++) {
+        updateRelayDisplay(i, true);
+      }
+      addLogEntry('All relays turned ON');
+    });
+}
+
+function allOff() {
+  fetch('/api/relay/all/off', { method: 'POST' })
+    .then(response => response.json())
+    .then(data => {
+      for (let i = 1; i <= 4; i++) {
+        updateRelayDisplay(i, false);
+      }
+      addLogEntry('All relays turned OFF');
+    });
+}
+
+// Settings functions
+function saveSettings(event) {
+  event.preventDefault();
+  const submitBtn = event.target.querySelector('button[type="submit"]');
+  const originalText = submitBtn.innerHTML;
+  submitBtn.innerHTML = '<span class="loading"></span> Saving...';
+  submitBtn.disabled = true;
+
+  const settings = {
+    tempThreshold: document.getElementById('tempThreshold').value,
+    gasThreshold: document.getElementById('gasThreshold').value,
+    soundThreshold: document.getElementById('soundThreshold').value
+  };
+
+  fetch('/api/settings', {
+    method: 'POST',
+    headers: { 'Content-Type': 'application/json' },
+    body: JSON.stringify(settings)
+  })
+  .then(response => response.json())
+  .then(data => {
+    submitBtn.innerHTML = '<i class="fas fa-check"></i> Saved!';
+    addLogEntry('Settings updated successfully');
+    setTimeout(() => {
+      submitBtn.innerHTML = originalText;
+      submitBtn.disabled = false;
+    }, 2000);
+  })
+  .catch(error => {
+    console.error('Error saving settings:', error);
+    submitBtn.innerHTML = originalText;
+    submitBtn.disabled = false;
+  });
+}
+
+// Log functions
+function addLogEntry(message) {
+  const logContainer = document.querySelector('.log-container');
+  const time = new Date().toLocaleTimeString('en-US', {
+    hour12: false,
+    hour: '2-digit',
+    minute: '2-digit'
+  });
+  
+  const logEntry = document.createElement('div');
+  logEntry.className = 'log-entry';
+  logEntry.innerHTML = `
+    <span class="log-time">${time}</span>
+    <span class="log-message">${message}</span>
+  `;
+  
+  logContainer.insertBefore(logEntry, logContainer.firstChild);
+  
+  // Keep only last 10 entries
+  const entries = logContainer.querySelectorAll('.log-entry');
+  if (entries.length > 10) {
+    entries[entries.length - 1].remove();
+  }
+}
+
+// Data fetching functions
+function showSensorData(data) {
+  updateSystemStatus(data);
+  updateSensorDisplay(data);
+  updateStats(data.stats || {});
+  updateBottomStats(data);
+}
+
+function showRelayData(data) {
+  for (let i = 1; i <= 4; i++) {
+    updateRelayDisplay(i, data[`relay${i}`]);
+  }
+}
+
+function showUptime(data) {
+  document.getElementById('uptimeDisplay').textContent = `System Uptime: ${data.uptime}`;
+}
+
+function fetchLogData() {
+  fetch('/api/log')
+    .then(response => response.json())
+    .then(data => {
+      updateLogDisplay(data.logs);
+    })
+    .catch(error => console.error('Error fetching log data:', error));
+}
+
+// Update display functions
+function updateSensorDisplay(data) {
+  // Update temperature
+  if (data.temperature !== undefined && !isNaN(data.temperature)) {
+    document.getElementById('tempValue').textContent = `${data.temperature.toFixed(1)}°C`;
+    const tempPercent = Math.min((data.temperature / 50) * 100, 100);
+    document.getElementById('tempProgress').style.width = `${tempPercent}%`;
+  } else {
+    document.getElementById('tempValue').textContent = 'Error';
+    document.getElementById('tempProgress').style.width = '0%';
+  }
+
+  // Update gas level
+  if (data.gasLevel !== undefined && !isNaN(data.gasLevel)) {
+    document.getElementById('gasValue').textContent = `${data.gasLevel} ppm`;
+    const gasPercent = Math.min((data.gasLevel / 1000) * 100, 100);
+    document.getElementById('gasProgress').style.width = `${gasPercent}%`;
+  } else {
+    document.getElementById('gasValue').textContent = 'Error';
+    document.getElementById('gasProgress').style.width = '0%';
+  }
+
+  // Update sound level
+  if (data.soundLevel !== undefined && !isNaN(data.soundLevel)) {
+    document.getElementById('soundValue').textContent = `${data.soundLevel} dB`;
+    const soundPercent = Math.min((data.soundLevel / 120) * 100, 100);
+    document.getElementById('soundProgress').style.width = `${soundPercent}%`;
+  } else {
+    document.getElementById('soundValue').textContent = 'Error';
+    document.getElementById('soundProgress').style.width = '0%';
+  }
+
+  // Update PIR motion
+  if (data.motionDetected !== undefined) {
+    const pirElement = document.getElementById('pirValue');
+    if (data.motionDetected) {
+      pirElement.innerHTML = '<span class="status-badge online">Detected</span>';
+    } else {
+      pirElement.innerHTML = '<span class="status-badge offline">Clear</span>';
+    }
+  } else {
+    document.getElementById('pirValue').textContent = 'Error';
+  }
+
+  // Update IR sensor
+  if (data.irTriggered !== undefined) {
+    const irElement = document.getElementById('irValue');
+    if (data.irTriggered) {
+      irElement.innerHTML = '<span class="status-badge warning">Triggered</span>';
+    } else {
+      irElement.innerHTML = '<span class="status-badge offline">Clear</span>';
+    }
+  } else {
+    document.getElementById('irValue').textContent = 'Error';
+  }
+
+  // Update light level
+  if (data.lightLevel !== undefined && !isNaN(data.lightLevel)) {
+    document.getElementById('lightValue').textContent = `${data.lightLevel} lux`;
+    const lightPercent = Math.min((data.lightLevel / 1000) * 100, 100);
+    document.getElementById('lightProgress').style.width = `${lightPercent}%`;
+  } else {
+    document.getElementById('lightValue').textContent = 'Error';
+    document.getElementById('lightProgress').style.width = '0%';
+  }
+
+  // Update distance
+  if (data.distance !== undefined && !isNaN(data.distance)) {
+    document.getElementById('distanceValue').textContent = `${data.distance} cm`;
+    const distancePercent = Math.min((data.distance / 200) * 100, 100);
+    document.getElementById('distanceProgress').style.width = `${distancePercent}%`;
+  } else {
+    document.getElementById('distanceValue').textContent = 'Error';
+    document.getElementById('distanceProgress').style.width = '0%';
+  }
+}
+
+// Id of the newest entry shown, so streamed entries are not shown twice
+let lastLogId = 0;
+const MAX_LOG_ENTRIES = 100;
+
+function updateLogDisplay(logs) {
+  const logContainer = document.querySelector('.log-container');
+  logContainer.innerHTML = '';
+  lastLogId = 0;
+  logs.forEach(appendLogEntry);
+}
+
+function appendLogEntry(log) {
+  if (log.id !== undefined) {
+    if (log.id <= lastLogId) return;
+    lastLogId = log.id;
+  }
+  const logContainer = document.querySelector('.log-container');
+  const logEntry = document.createElement('div');
+  logEntry.className = 'log-entry';
+  if (log.type === 'alert') {
+    logEntry.innerHTML = `
+      <span class="log-time">${log.time}</span>
+      <span class="log-message log-alert">${log.message}</span>
+    `;
+  } else {
+    logEntry.innerHTML = `
+      <span class="log-time">${log.time}</span>
+      <span class="log-message">${log.message}</span>
+    `;
+  }
+  logContainer.appendChild(logEntry);
+
+  const entries = logContainer.querySelectorAll('.log-entry');
+  if (entries.length > MAX_LOG_ENTRIES) entries[0].remove();
+}
+
+// Chart functions
+function initCharts() {
+  const sensorCtx = document.getElementById('sensorChart').getContext('2d');
+  const trendCtx = document.getElementById('trendChart').getContext('2d');
+
+  sensorChart = new Chart(sensorCtx, {
+    type: 'line',
+    data: {
+      labels: [],
+      datasets: [{
+        label: 'Temperature',
+        data: [],
+        borderColor: '#ef4444',
+        backgroundColor: '#ef444420',
+        borderWidth: 3,
+        fill: true,
+        tension: 0.4,
+        pointBackgroundColor: '#ef4444',
+        pointBorderColor: '#ffffff',
+        pointBorderWidth: 2,
+        pointRadius: 4,
+        pointHoverRadius: 6
+      }]
+    },
+    options: {
+      responsive: true,
+      maintainAspectRatio: false,
+      plugins: {
+        legend: { display: false },
+        tooltip: {
+          backgroundColor: 'rgba(0, 0, 0, 0.8)',
+          titleColor: '#ffffff',
+          bodyColor: '#ffffff',
+          borderColor: '#ef4444',
+          borderWidth: 1,
+          cornerRadius: 8,
+          displayColors: false
+        }
+      },
+      scales: {
+        x: {
+          grid: { color: 'rgba(0, 0, 0, 0.1)' },
+          ticks: { color: 'var(--text-secondary)' }
+        },
+        y: {
+          grid: { color: 'rgba(0, 0, 0, 0.1)' },
+          ticks: { color: 'var(--text-secondary)' }
+        }
+      }
+    }
+  });
+
+  trendChart = new Chart(trendCtx, {
+    type: 'bar',
+    data: {
+      labels: ['Temperature', 'Gas Level', 'Light Level', 'Sound Level'],
+      datasets: [{
+        label: 'Current Values',
+        data: [0, 0, 0, 0],
+        backgroundColor: ['#ef4444', '#f59e0b', '#f97316', '#8b5cf6'],
+        borderColor: ['#ef4444', '#f59e0b', '#f97316', '#8b5cf6'],
+        borderWidth: 2
+      }]
+    },
+    options: {
+      responsive: true,
+      maintainAspectRatio: false,
+      plugins: {
+        legend: {
+          display: true,
+          position: 'top',
+          labels: {
+            color: 'var(--text-primary)',
+            usePointStyle: true,
+            padding: 20
+          }
+        },
+        tooltip: {
+          backgroundColor: 'rgba(0, 0, 0, 0.8)',
+          titleColor: '#ffffff',
+          bodyColor: '#ffffff',
+          cornerRadius: 8
+        }
+      },
+      scales: {
+        x: {
+          grid: { color: 'rgba(0, 0, 0, 0.1)' },
+          ticks: { color: 'var(--text-secondary)' }
+        },
+        y: {
+          grid: { color: 'rgba(0, 0, 0, 0.1)' },
+          ticks: { color: 'var(--text-secondary)' }
+        }
+      }
+    }
+  });
+}
+
+// Points are [t, avg, min, max]; t and data.now are seconds on the
+// controller's timeline: epoch seconds when it has SNTP time, else a count
+// that carries on across its restarts. Either way now - t is the age.
+function loadChart() {
+  fetch(`/api/chart/${currentSensorType}/${currentTimeRange}`)
+    .then(response => response.json())
+    .then(data => {
+      const origin = Date.now() - data.now * 1000;
+      const format = data.range > 86400
+        ? { weekday: 'short', hour: '2-digit', minute: '2-digit' }
+        : { hour: '2-digit', minute: '2-digit' };
+      sensorChart.data.labels = data.points.map(p => new Date(origin + p[0] * 1000).toLocaleTimeString([], format));
+      sensorChart.data.datasets[0].data = data.points.map(p => p[1]);
+      sensorChart.data.datasets[0].label = data.label;
+      sensorChart.data.datasets[0].borderColor = data.color;
+      sensorChart.data.datasets[0].backgroundColor = data.color + '20';
+      sensorChart.data.datasets[0].pointBackgroundColor = data.color;
+      sensorChart.options.plugins.tooltip.borderColor = data.color;
+      sensorChart.update();
+      
+      // Update stats
+      updateStats(data);
+    });
+}
+
+function switchChart(sensorType) {
+  currentSensorType = sensorType;
+  loadChart();
+
+  // Update active tab
+  document.querySelectorAll('.chart-tab').forEach(tab => tab.classList.remove('active'));
+  event.target.classList.add('active');
+}
+
+function switchTrendChart(trendType) {
+  fetch(`/api/trend/${trendType}`)
+    .then(response => response.json())
+    .then(data => {
+      trendChart.data.labels = data.labels;
+      trendChart.data.datasets = data.datasets;
+      trendChart.update();
+    });
+
+  document.querySelectorAll('.chart-card:nth-child(2) .chart-tab').forEach(tab => tab.classList.remove('active'));
+  event.target.classList.add('active');
+}
+
+function setTimeRange(range) {
+  currentTimeRange = range;
+  document.querySelectorAll('.chart-btn').forEach(btn => btn.classList.remove('active'));
+  event.target.classList.add('active');
+  loadChart();
+}
+
+function updateStats(data) {
+  const show = v => (v === null ? '--' : +v.toFixed(1)) + data.unit;
+  document.getElementById('currentValue').textContent = show(data.current);
+  document.getElementById('avgValue').textContent = show(data.average);
+  document.getElementById('maxValue').textContent = show(data.maximum);
+  document.getElementById('minValue').textContent = show(data.minimum);
+}
+
+// Initialize dashboard
+document.addEventListener('DOMContentLoaded', function() {
+  // Animate progress bars
+  const progressBars = document.querySelectorAll('.progress-fill');
+  progressBars.forEach(bar => {
+    const width = bar.style.width;
+    bar.style.width = '0%';
+    setTimeout(() => {
+      bar.style.width = width;
+    }, 500);
+  });
+
+  // Initialize charts
+  initCharts();
+  loadChart();
+
+  // Load ESP8266 configuration
+  loadESP8266Config();
+
+  // Live data: pushed over /api/stream, polling only without EventSource
+  if (window.EventSource) {
+    connectStream();
+  } else {
+    startPolling();
+  }
+  setInterval(loadESP8266Config, 30000); // Node list changes rarely
+});
+
+// One conditional request per poll: only the sections changed since the
+// version we have, or a bodiless 304
+let snapshotVersion = 0;
+
+function fetchSnapshot() {
+  fetch(`/api/snapshot?since=${snapshotVersion}`)
+    .then(response => response.status === 304 ? null : response.json())
+    .then(data => {
+      if (!data) return;
+      snapshotVersion = data.version;
+      if (data.sensors) showSensorData(data.sensors);
+      if (data.alerts) updateSystemStatus(data.alerts);
+      if (data.relays) showRelayData(data.relays);
+      if (data.uptime) showUptime(data.uptime);
+      if (data.log) data.log.forEach(appendLogEntry);
+    })
+    .catch(error => {
+      updateSystemStatus({isOnline: false, activeAlerts: []});
+      updateSensorDisplay({});
+      updateStats({});
+    });
+}
+
+function startPolling() {
+  fetchLogData();
+  fetchSnapshot();
+  setInterval(fetchSnapshot, 5000); // Update every 5 seconds
+}
+
+// The browser reconnects on its own and sends Last-Event-ID; the controller
+// answers with the state and the log entries missed, or "resync"
+function connectStream() {
+  const stream = new EventSource('/api/stream');
+  const on = (type, handler) => stream.addEventListener(type, e => handler(JSON.parse(e.data)));
+  on('sensors', showSensorData);
+  on('alerts', updateSystemStatus);
+  on('relays', showRelayData);
+  on('uptime', showUptime);
+  on('log', appendLogEntry);
+  on('resync', fetchLogData);
+  stream.onerror = () => {
+    if (stream.readyState === EventSource.CLOSED) {
+      updateSystemStatus({isOnline: false, activeAlerts: []});
+      setTimeout(connectStream, 5000);
+    }
+  };
+}
+
+function updateSystemStatus(data) {
+  // System Online/Offline
+  const statusBadge = document.querySelector('.status-badge.online');
+  if (data.isOnline) {
+    statusBadge.textContent = 'SYSTEM ONLINE';
+    statusBadge.classList.remove('offline');
+    statusBadge.classList.add('online');
+  } else {
+    statusBadge.textContent = 'SYSTEM OFFLINE';
+    statusBadge.classList.remove('online');
+    statusBadge.classList.add('offline');
+  }
+  // Alerts
+  const alertBadge = document.querySelector('.status-badge.warning');
+  if (data.activeAlerts && data.activeAlerts.length > 0) {
+    alertBadge.textContent = `${data.activeAlerts.length} ALERT${data.activeAlerts.length > 1 ? 'S' : ''} ACTIVE`;
+    alertBadge.classList.remove('no-alert');
+    alertBadge.classList.add('warning');
+  } else {
+    alertBadge.textContent = 'NO ALERTS';
+    alertBadge.classList.remove('warning');
+    alertBadge.classList.add('no-alert');
+  }
+}
+
+function updateStats(stats) {
+  // Temperature
+  document.getElementById('currentValue').textContent =
+    stats.temperature !== undefined && stats.temperature !== null ? `${stats.temperature.toFixed(1)}°C` : 'Error';
+  document.getElementById('avgValue').textContent =
+    stats.temperature_avg !== undefined && stats.temperature_avg !== null ? `${stats.temperature_avg.toFixed(1)}°C` : 'Error';
+  document.getElementById('maxValue').textContent =
+    stats.temperature_max !== undefined && stats.temperature_max !== null ? `${stats.temperature_max.toFixed(1)}°C` : 'Error';
+  document.getElementById('minValue').textContent =
+    stats.temperature_min !== undefined && stats.temperature_min !== null ? `${stats.temperature_min.toFixed(1)}°C` : 'Error';
+}
+
+function updateRelayDisplay(relayNumber, state) {
+  const relayItem = document.querySelector(`#relay${relayNumber}Status`).closest('.relay-item');
+  const statusIndicator = relayItem.querySelector('.status-indicator');
+  const icon = relayItem.querySelector('.relay-info i');
+  if (state) {
+    statusIndicator.className = 'status-indicator status-on';
+    statusIndicator.innerHTML = '<span class="status-dot"></span>ON';
+    icon.style.color = 'var(--primary-color)';
+  } else {
+    statusIndicator.className = 'status-indicator status-off';
+    statusIndicator.innerHTML = '<span class="status-dot"></span>OFF';
+    icon.style.color = 'var(--text-secondary)';
+  }
+}
+
+function updateBottomStats(data) {
+  document.getElementById('alertCount').textContent =
+    data.activeAlerts && data.activeAlerts.length !== undefined ? data.activeAlerts.length : 'Error';
+  document.getElementById('systemStatus').textContent =
+    data.systemStatus ? data.systemStatus : 'Error';
+  document.getElementById('dataPoints').textContent =
+    data.dataPoints !== undefined ? data.dataPoints : 'Error';
+  document.getElementById('uptimePercent').textContent =
+    data.uptimeStr ? data.uptimeStr : 'Error';
+}
+
+// ESP8266 Configuration Functions
+function saveESP8266Config(event) {
+  event.preventDefault();
+  const submitBtn = event.target.querySelector('button[type="submit"]');
+  const originalText = submitBtn.innerHTML;
+  submitBtn.innerHTML = '<span class="loading"></span> Saving...';
+  submitBtn.disabled = true;
+
+  const config = {
+    ip: document.getElementById('esp8266IP').value,
+    port: document.getElementById('esp8266Port').value
+  };
+
+  fetch('/api/esp8266/config', {
+    method: 'POST',
+    headers: { 'Content-Type': 'application/json' },
+    body: JSON.stringify(config)
+  })
+  .then(response => response.json())
+  .then(data => {
+    if (data.success) {
+      submitBtn.innerHTML = '<i class="fas fa-check"></i> Saved!';
+      addLogEntry('ESP8266 configuration updated: ' + data.ip + ':' + data.port);
+      setTimeout(() => {
+        submitBtn.innerHTML = originalText;
+        submitBtn.disabled = false;
+      }, 2000);
+    } else {
+      throw new Error(data.message);
+    }
+  })
+  .catch(error => {
+    console.error('Error saving ESP8266 config:', error);
+    submitBtn.innerHTML = '<i class="fas fa-exclamation-triangle"></i> Error!';
+    addLogEntry('ESP8266 configuration failed: ' + error.message);
+    setTimeout(() => {
+      submitBtn.innerHTML = originalText;
+      submitBtn.disabled = false;
+    }, 2000);
+  });
+}
+
+function loadESP8266Config() {
+  fetch('/api/esp8266/config')
+    .then(response => response.json())
+    .then(data => {
+      document.getElementById('esp8266IP').value = data.ip;
+      document.getElementById('esp8266Port').value = data.port;
+      updateESP8266Status(data.connected);
+    })
+    .catch(error => {
+      console.error('Error loading ESP8266 config:', error);
+    });
+}
+
+function updateESP8266Status(connected) {
+  const statusBadge = document.getElementById('esp8266Status');
+  if (connected) {
+    statusBadge.className = 'status-badge online';
+    statusBadge.innerHTML = '<i class="fas fa-circle" style="font-size: 0.5rem;"></i>Connected';
+  } else {
+    statusBadge.className = 'status-badge offline';
+    statusBadge.innerHTML = '<i class="fas fa-circle" style="font-size: 0.5rem;"></i>Disconnected';
+  }
+}
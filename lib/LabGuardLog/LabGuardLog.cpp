@@ -0,0 +1,242 @@
+// LabGuard+ Logger
+// See LabGuardLog.h for usage.
+//
+// Ring layout: [len][fmt pointer][arg]..., each arg a type byte followed by
+// 4 value bytes (8 for 64-bit integers), or by a length byte and the
+// characters for strings. Arguments after one that did not fit are dropped,
+// so the drain never shifts a later argument into an earlier specifier. head is
+// only written by producers (serialised by ringLock on the ESP32, where tasks
+// on both cores log), tail only by lgLogDrain().
+
+#include "LabGuardLog.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static uint8_t ring[LG_LOG_RING_SIZE];
+static volatile uint32_t ringHead = 0;
+static volatile uint32_t ringTail = 0;
+static volatile uint32_t dropped = 0;
+static uint32_t droppedReported = 0;
+
+#if defined(ESP32)
+static portMUX_TYPE ringLock = portMUX_INITIALIZER_UNLOCKED;
+#define RING_LOCK() portENTER_CRITICAL(&ringLock)
+#define RING_UNLOCK() portEXIT_CRITICAL(&ringLock)
+#else
+#define RING_LOCK() do {} while (0)
+#define RING_UNLOCK() do {} while (0)
+#endif
+
+static HardwareSerial* port = nullptr;
+static char pending[LG_LOG_LINE_MAX];  // Formatted line being written out
+static size_t pendingLen = 0;
+static size_t pendingOff = 0;
+
+// ---------------------- Producer --------------------------------
+namespace lglog {
+
+// False (and the record closed to further arguments) if n bytes do not fit
+static bool reserve(Record& r, size_t n) {
+  if (r.overflow || r.len + n > sizeof(r.buf)) {
+    r.overflow = true;  // Missing args print as "?"
+    return false;
+  }
+  return true;
+}
+
+static void put(Record& r, const void* data, size_t n) {
+  memcpy(r.buf + r.len, data, n);
+  r.len += n;
+}
+
+static void putValue(Record& r, uint8_t type, const void* v, size_t n) {
+  if (!reserve(r, 1 + n)) return;
+  put(r, &type, 1);
+  put(r, v, n);
+}
+
+void begin(Record& r, const char* fmt) {
+  r.len = 0;
+  r.overflow = false;
+  put(r, &fmt, sizeof(fmt));
+}
+
+void add(Record& r, int v) { int32_t x = v; putValue(r, ARG_INT, &x, 4); }
+void add(Record& r, unsigned int v) { uint32_t x = v; putValue(r, ARG_UINT, &x, 4); }
+void add(Record& r, long long v) { int64_t x = v; putValue(r, ARG_INT64, &x, 8); }
+void add(Record& r, unsigned long long v) { uint64_t x = v; putValue(r, ARG_UINT64, &x, 8); }
+void add(Record& r, double v) { float x = v; putValue(r, ARG_FLOAT, &x, 4); }
+
+// long is 32 bits on both targets; wider on a host
+void add(Record& r, long v) {
+  if (sizeof(v) > 4) add(r, (long long)v);
+  else { int32_t x = v; putValue(r, ARG_INT, &x, 4); }
+}
+
+void add(Record& r, unsigned long v) {
+  if (sizeof(v) > 4) add(r, (unsigned long long)v);
+  else { uint32_t x = v; putValue(r, ARG_UINT, &x, 4); }
+}
+
+void add(Record& r, const char* v) {
+  if (!v) v = "(null)";
+  size_t n = strlen(v);
+  if (n > LG_LOG_STR_MAX) n = LG_LOG_STR_MAX;
+  if (!reserve(r, 2 + n)) return;
+  uint8_t hdr[2] = {ARG_STR, (uint8_t)n};
+  put(r, hdr, 2);
+  put(r, v, n);
+}
+
+void add(Record& r, const String& v) { add(r, v.c_str()); }
+
+void commit(Record& r) {
+  RING_LOCK();
+  uint32_t head = ringHead;
+  uint32_t need = r.len + 1;
+  if (need > LG_LOG_RING_SIZE - (head - ringTail)) {
+    dropped++;
+    RING_UNLOCK();
+    return;
+  }
+  ring[head & (LG_LOG_RING_SIZE - 1)] = r.len;
+  for (uint8_t i = 0; i < r.len; i++) ring[(head + 1 + i) & (LG_LOG_RING_SIZE - 1)] = r.buf[i];
+  ringHead = head + need;  // Publish only after the bytes are in place
+  RING_UNLOCK();
+}
+
+}  // namespace lglog
+
+// ---------------------- Formatting ------------------------------
+// printf subset: flags/width/precision are kept, length modifiers are dropped
+// because every argument carries its own width (32 or 64 bits).
+static size_t formatRecord(const uint8_t* rec, size_t len, char* out, size_t outLen) {
+  const char* fmt;
+  memcpy(&fmt, rec, sizeof(fmt));
+  const uint8_t* arg = rec + sizeof(fmt);
+  const uint8_t* end = rec + len;
+  size_t n = 0;
+
+  while (*fmt && n + 1 < outLen) {
+    if (*fmt != '%') { out[n++] = *fmt++; continue; }
+    if (fmt[1] == '%') { out[n++] = '%'; fmt += 2; continue; }
+
+    char spec[16];
+    size_t sl = 0;
+    spec[sl++] = *fmt++;
+    while (*fmt && strchr("-+ #0123456789.", *fmt) && sl < sizeof(spec) - 4) spec[sl++] = *fmt++;
+    while (*fmt && strchr("hlLzjt", *fmt)) fmt++;
+    char conv = *fmt ? *fmt++ : 's';
+
+    if (arg >= end) { out[n++] = '?'; continue; }
+    uint8_t type = *arg++;
+    bool isUnsigned = type == lglog::ARG_UINT || type == lglog::ARG_UINT64;
+    long long i = 0;
+    unsigned long long u = 0;
+    float f = 0;
+    char str[LG_LOG_STR_MAX + 1] = "";
+    if (type == lglog::ARG_STR) {
+      uint8_t sn = *arg++;
+      memcpy(str, arg, sn);
+      str[sn] = '\0';
+      arg += sn;
+    } else if (type == lglog::ARG_INT64 || type == lglog::ARG_UINT64) {
+      int64_t i64;
+      memcpy(&i64, arg, 8);
+      i = i64;
+      u = (uint64_t)i64;
+      arg += 8;
+    } else {
+      int32_t i32;
+      memcpy(&i32, arg, 4);
+      memcpy(&f, arg, 4);
+      i = i32;
+      u = (uint32_t)i32;
+      arg += 4;
+    }
+    double asDouble = type == lglog::ARG_FLOAT ? f : isUnsigned ? (double)u : (double)i;
+    long long asLong = type == lglog::ARG_FLOAT ? (long long)f : isUnsigned ? (long long)u : i;
+
+    size_t room = outLen - n;
+    int w;
+    if (strchr("di", conv)) {
+      spec[sl++] = 'l'; spec[sl++] = 'l'; spec[sl++] = 'd'; spec[sl] = '\0';
+      w = snprintf(out + n, room, spec, asLong);
+    } else if (strchr("uxXo", conv)) {
+      spec[sl++] = 'l'; spec[sl++] = 'l'; spec[sl++] = conv; spec[sl] = '\0';
+      unsigned long long v = isUnsigned ? u : (unsigned long long)asLong;
+      w = snprintf(out + n, room, spec, v);
+    } else if (conv == 'c') {
+      spec[sl++] = 'c'; spec[sl] = '\0';
+      w = snprintf(out + n, room, spec, (int)asLong);
+    } else if (strchr("feEgG", conv)) {
+      spec[sl++] = conv; spec[sl] = '\0';
+      w = snprintf(out + n, room, spec, asDouble);
+    } else {
+      // %s (or anything unknown): numbers print in their natural form
+      if (type == lglog::ARG_FLOAT) snprintf(str, sizeof(str), "%g", asDouble);
+      else if (isUnsigned) snprintf(str, sizeof(str), "%llu", u);
+      else if (type != lglog::ARG_STR) snprintf(str, sizeof(str), "%lld", i);
+      spec[sl++] = 's'; spec[sl] = '\0';
+      w = snprintf(out + n, room, spec, str);
+    }
+    if (w > 0) n += (size_t)w < room ? (size_t)w : room - 1;
+  }
+  out[n] = '\0';
+  return n;
+}
+
+// ---------------------- Drain -----------------------------------
+void lgLogBegin(HardwareSerial& p) {
+  port = &p;
+}
+
+// Formats the next queued record into `pending`; false if the ring is empty
+static bool nextLine() {
+  if (dropped != droppedReported) {
+    droppedReported = dropped;
+    pendingLen = snprintf(pending, sizeof(pending), "⚠️ Log ring full, %lu lines dropped so far\r\n", (unsigned long)droppedReported);
+    pendingOff = 0;
+    return true;
+  }
+  uint32_t tail = ringTail;
+  if (tail == ringHead) return false;
+
+  uint8_t rec[LG_LOG_RECORD_MAX];
+  uint8_t len = ring[tail & (LG_LOG_RING_SIZE - 1)];
+  for (uint8_t i = 0; i < len; i++) rec[i] = ring[(tail + 1 + i) & (LG_LOG_RING_SIZE - 1)];
+  ringTail = tail + 1 + len;
+
+  pendingLen = formatRecord(rec, len, pending, sizeof(pending) - 2);
+  pending[pendingLen++] = '\r';
+  pending[pendingLen++] = '\n';
+  pendingOff = 0;
+  return true;
+}
+
+void lgLogDrain() {
+  if (!port) return;
+  while (true) {
+    if (pendingOff == pendingLen && !nextLine()) return;
+    int room = port->availableForWrite();
+    if (room <= 0) return;
+    size_t n = pendingLen - pendingOff;
+    if (n > (size_t)room) n = room;
+    port->write((const uint8_t*)pending + pendingOff, n);
+    pendingOff += n;
+  }
+}
+
+void lgLogFlush() {
+  if (!port) return;
+  while (ringTail != ringHead || pendingOff != pendingLen || dropped != droppedReported) {
+    lgLogDrain();
+    yield();
+  }
+  port->flush();
+}
+
+uint32_t lgLogDropped() {
+  return dropped;
+}
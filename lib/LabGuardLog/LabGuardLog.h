@@ -0,0 +1,113 @@
+// LabGuard+ Logger
+// --------------------------------------------------
+// Shared by the ESP8266 sensor node and the ESP32 controller.
+// ➤ Compile-time levels: calls below LG_LOG_LEVEL compile to nothing
+//   (their arguments are not even evaluated)
+// ➤ printf-style format, but formatting happens on drain: the caller only
+//   copies the format pointer and raw arguments into a lock-free byte ring
+// ➤ lgLogDrain() in loop() writes only what the UART can take without blocking
+//
+// The format string must be a literal (only its pointer is stored). String
+// arguments are copied, truncated to LG_LOG_STR_MAX; an argument that no
+// longer fits the record prints as "?", and so does every one after it. 64-bit
+// integers keep all 64 bits. Any task may log (on the
+// ESP32 a record is committed under a spinlock), but never from an ISR, and
+// only one task may call lgLogDrain()/lgLogFlush().
+//
+//   LG_INFO("✅ Connected to %s:%d", host, port);
+
+#pragma once
+
+#include <Arduino.h>
+
+#define LG_LEVEL_NONE 0
+#define LG_LEVEL_ERROR 1
+#define LG_LEVEL_WARN 2
+#define LG_LEVEL_INFO 3
+#define LG_LEVEL_DEBUG 4
+
+#ifndef LG_LOG_LEVEL
+#define LG_LOG_LEVEL LG_LEVEL_INFO
+#endif
+
+#ifndef LG_LOG_RING_SIZE
+#define LG_LOG_RING_SIZE 2048    // Bytes, power of two
+#endif
+
+#define LG_LOG_RECORD_MAX 160    // Format pointer + encoded arguments
+#define LG_LOG_STR_MAX 120
+#define LG_LOG_LINE_MAX 256      // Longest formatted line
+
+namespace lglog {
+
+enum ArgType : uint8_t { ARG_INT, ARG_UINT, ARG_FLOAT, ARG_STR, ARG_INT64, ARG_UINT64 };
+
+struct Record {
+  uint8_t buf[LG_LOG_RECORD_MAX];
+  uint8_t len;
+  bool overflow;  // An argument did not fit: the rest are left out too
+};
+
+void begin(Record& r, const char* fmt);
+void add(Record& r, int v);
+void add(Record& r, long v);
+void add(Record& r, unsigned int v);
+void add(Record& r, unsigned long v);
+void add(Record& r, long long v);
+void add(Record& r, unsigned long long v);
+void add(Record& r, double v);
+void add(Record& r, const char* v);
+void add(Record& r, const String& v);
+void commit(Record& r);
+
+inline void addAll(Record&) {}
+
+template <typename T, typename... Rest>
+inline void addAll(Record& r, const T& v, const Rest&... rest) {
+  add(r, v);
+  addAll(r, rest...);
+}
+
+template <typename... Args>
+void log(const char* fmt, const Args&... args) {
+  Record r;
+  begin(r, fmt);
+  addAll(r, args...);
+  commit(r);
+}
+
+}  // namespace lglog
+
+#if LG_LOG_LEVEL >= LG_LEVEL_ERROR
+#define LG_ERROR(...) lglog::log(__VA_ARGS__)
+#else
+#define LG_ERROR(...) do {} while (0)
+#endif
+
+#if LG_LOG_LEVEL >= LG_LEVEL_WARN
+#define LG_WARN(...) lglog::log(__VA_ARGS__)
+#else
+#define LG_WARN(...) do {} while (0)
+#endif
+
+#if LG_LOG_LEVEL >= LG_LEVEL_INFO
+#define LG_INFO(...) lglog::log(__VA_ARGS__)
+#else
+#define LG_INFO(...) do {} while (0)
+#endif
+
+#if LG_LOG_LEVEL >= LG_LEVEL_DEBUG
+#define LG_DEBUG(...) lglog::log(__VA_ARGS__)
+#else
+#define LG_DEBUG(...) do {} while (0)
+#endif
+
+// Output port; call after Serial.begin()
+void lgLogBegin(HardwareSerial& port);
+// Call every loop(): formats queued records and writes what fits in the UART
+// buffer right now. Never blocks.
+void lgLogDrain();
+// Blocking drain, for setup() and right before a restart
+void lgLogFlush();
+// Records lost because the ring was full
+uint32_t lgLogDropped();
@@ -0,0 +1,222 @@
+// LabGuard+ Wire Protocol - frame encoding/decoding
+// See LabGuardProtocol.h for the frame layout.
+
+#include "LabGuardProtocol.h"
+
+#include <math.h>
+#include <string.h>
+
+// ---------------------- Byte Helpers ----------------------------
+static inline void putU16(uint8_t* p, uint16_t v) {
+  p[0] = v & 0xFF;
+  p[1] = (v >> 8) & 0xFF;
+}
+
+static inline uint16_t getU16(const uint8_t* p) {
+  return (uint16_t)p[0] | ((uint16_t)p[1] << 8);
+}
+
+// ---------------------- CRC -------------------------------------
+// CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF), bitwise to stay out of RAM.
+uint16_t lgCrc16(const uint8_t* data, size_t len) {
+  uint16_t crc = 0xFFFF;
+  while (len--) {
+    crc ^= (uint16_t)(*data++) << 8;
+    for (int i = 0; i < 8; i++) {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+    }
+  }
+  return crc;
+}
+
+// ---------------------- Framing ---------------------------------
+size_t lgEncodeFrame(uint8_t* out, size_t outLen, uint8_t type, uint16_t seq,
+                     const uint8_t* payload, uint8_t payloadLen) {
+  size_t total = LG_FRAME_HEADER_LEN + payloadLen + LG_FRAME_CRC_LEN;
+  if (payloadLen > LG_FRAME_MAX_PAYLOAD || total > outLen) return 0;
+
+  out[0] = LG_FRAME_SYNC;
+  out[1] = LG_PROTO_VERSION;
+  out[2] = type;
+  out[3] = payloadLen;
+  putU16(out + 4, seq);
+  if (payloadLen > 0) memcpy(out + LG_FRAME_HEADER_LEN, payload, payloadLen);
+
+  uint16_t crc = lgCrc16(out + 1, LG_FRAME_HEADER_LEN - 1 + payloadLen);
+  putU16(out + LG_FRAME_HEADER_LEN + payloadLen, crc);
+  return total;
+}
+
+LgFrameStatus lgParseFrame(const uint8_t* buf, size_t len, LgFrame& frame, size_t* consumed) {
+  *consumed = 0;
+  if (len < 1) return LG_FRAME_INCOMPLETE;
+  if (buf[0] != LG_FRAME_SYNC) return LG_FRAME_BAD_SYNC;
+  if (len < LG_FRAME_HEADER_LEN) return LG_FRAME_INCOMPLETE;
+  if (buf[1] != LG_PROTO_VERSION) return LG_FRAME_BAD_VERSION;
+
+  uint8_t payloadLen = buf[3];
+  if (payloadLen > LG_FRAME_MAX_PAYLOAD) return LG_FRAME_BAD_LENGTH;
+
+  size_t total = LG_FRAME_HEADER_LEN + payloadLen + LG_FRAME_CRC_LEN;
+  if (len < total) return LG_FRAME_INCOMPLETE;
+
+  uint16_t crc = lgCrc16(buf + 1, LG_FRAME_HEADER_LEN - 1 + payloadLen);
+  if (crc != getU16(buf + LG_FRAME_HEADER_LEN + payloadLen)) return LG_FRAME_BAD_CRC;
+
+  frame.version = buf[1];
+  frame.type = buf[2];
+  frame.length = payloadLen;
+  frame.seq = getU16(buf + 4);
+  frame.payload = buf + LG_FRAME_HEADER_LEN;
+  *consumed = total;
+  return LG_FRAME_OK;
+}
+
+// ---------------------- Sensor Data -----------------------------
+size_t lgEncodeSensorData(uint8_t* out, size_t outLen, uint16_t seq, const LgSensorData& data) {
+  uint8_t payload[LG_SENSOR_DATA_LEN];
+  putU16(payload + 0, (uint16_t)data.tempCenti);
+  putU16(payload + 2, data.gas);
+  putU16(payload + 4, data.light);
+  putU16(payload + 6, (uint16_t)data.distCm);
+  payload[8] = data.sound;
+  payload[9] = data.pir;
+  payload[10] = data.ir;
+  payload[11] = data.tempAge;
+  return lgEncodeFrame(out, outLen, LG_MSG_DATA, seq, payload, LG_SENSOR_DATA_LEN);
+}
+
+bool lgDecodeSensorData(const LgFrame& frame, LgSensorData& data) {
+  if (frame.type != LG_MSG_DATA || frame.length < LG_SENSOR_DATA_MIN_LEN) return false;
+  const uint8_t* p = frame.payload;
+  data.tempCenti = (int16_t)getU16(p + 0);
+  data.gas = getU16(p + 2);
+  data.light = getU16(p + 4);
+  data.distCm = (int16_t)getU16(p + 6);
+  data.sound = p[8];
+  data.pir = p[9];
+  data.ir = p[10];
+  data.tempAge = frame.length > LG_SENSOR_DATA_MIN_LEN ? p[11] : 0;
+  return true;
+}
+
+// ---------------------- Aggregate -------------------------------
+static uint8_t* putWindow(uint8_t* p, const LgAnalogWindow& w) {
+  putU16(p + 0, (uint16_t)w.min);
+  putU16(p + 2, (uint16_t)w.max);
+  putU16(p + 4, (uint16_t)w.mean);
+  return p + 6;
+}
+
+static const uint8_t* getWindow(const uint8_t* p, LgAnalogWindow& w) {
+  w.min = (int16_t)getU16(p + 0);
+  w.max = (int16_t)getU16(p + 2);
+  w.mean = (int16_t)getU16(p + 4);
+  return p + 6;
+}
+
+static uint8_t* putTiming(uint8_t* p, const LgEventTiming& t) {
+  putU16(p + 0, t.firstMs);
+  putU16(p + 2, t.lastMs);
+  return p + 4;
+}
+
+static const uint8_t* getTiming(const uint8_t* p, LgEventTiming& t) {
+  t.firstMs = getU16(p + 0);
+  t.lastMs = getU16(p + 2);
+  return p + 4;
+}
+
+static size_t packAggregate(uint8_t* payload, const LgAggregate& agg) {
+  uint8_t* p = payload;
+  putU16(p, agg.windowMs); p += 2;
+  putU16(p, agg.samples); p += 2;
+  p = putWindow(p, agg.temp);
+  p = putWindow(p, agg.gas);
+  p = putWindow(p, agg.light);
+  p = putWindow(p, agg.dist);
+  putU16(p, agg.soundEvents); p += 2;
+  putU16(p, agg.pirEvents); p += 2;
+  putU16(p, agg.irEvents); p += 2;
+  *p++ = agg.sound;
+  *p++ = agg.pir;
+  *p++ = agg.ir;
+  *p++ = agg.tempAge;
+  *p++ = agg.channels;
+  p = putTiming(p, agg.soundAt);
+  p = putTiming(p, agg.pirAt);
+  p = putTiming(p, agg.irAt);
+  putU16(p, agg.nodeMs & 0xFFFF); p += 2;
+  putU16(p, agg.nodeMs >> 16); p += 2;
+  putU16(p, agg.acquireAgeMs); p += 2;
+  return p - payload;
+}
+
+static bool unpackAggregate(const uint8_t* p, uint8_t len, LgAggregate& agg) {
+  if (len < LG_AGGREGATE_MIN_LEN) return false;
+  agg.windowMs = getU16(p); p += 2;
+  agg.samples = getU16(p); p += 2;
+  p = getWindow(p, agg.temp);
+  p = getWindow(p, agg.gas);
+  p = getWindow(p, agg.light);
+  p = getWindow(p, agg.dist);
+  agg.soundEvents = getU16(p); p += 2;
+  agg.pirEvents = getU16(p); p += 2;
+  agg.irEvents = getU16(p); p += 2;
+  agg.sound = *p++;
+  agg.pir = *p++;
+  agg.ir = *p++;
+  agg.tempAge = *p++;
+  agg.channels = len >= LG_AGGREGATE_MASK_LEN ? *p++ : LG_CH_ALL;
+  if (len >= LG_AGGREGATE_EVENTS_LEN) {
+    p = getTiming(p, agg.soundAt);
+    p = getTiming(p, agg.pirAt);
+    p = getTiming(p, agg.irAt);
+  } else {
+    agg.soundAt.firstMs = agg.soundAt.lastMs = LG_EVENT_NONE;
+    agg.pirAt = agg.irAt = agg.soundAt;
+  }
+  if (len >= LG_AGGREGATE_LEN) {
+    agg.nodeMs = (uint32_t)getU16(p) | ((uint32_t)getU16(p + 2) << 16);
+    agg.acquireAgeMs = getU16(p + 4);
+  } else {
+    agg.nodeMs = 0;
+    agg.acquireAgeMs = LG_AGE_UNKNOWN;
+  }
+  return true;
+}
+
+size_t lgEncodeAggregate(uint8_t* out, size_t outLen, uint16_t seq, const LgAggregate& agg) {
+  uint8_t payload[LG_AGGREGATE_LEN];
+  size_t len = packAggregate(payload, agg);
+  return lgEncodeFrame(out, outLen, LG_MSG_AGGREGATE, seq, payload, len);
+}
+
+bool lgDecodeAggregate(const LgFrame& frame, LgAggregate& agg) {
+  if (frame.type != LG_MSG_AGGREGATE) return false;
+  return unpackAggregate(frame.payload, frame.length, agg);
+}
+
+size_t lgEncodeBacklog(uint8_t* out, size_t outLen, uint16_t seq, uint32_t ageMs, const LgAggregate& agg) {
+  uint8_t payload[4 + LG_AGGREGATE_LEN];
+  putU16(payload + 0, ageMs & 0xFFFF);
+  putU16(payload + 2, ageMs >> 16);
+  size_t len = 4 + packAggregate(payload + 4, agg);
+  return lgEncodeFrame(out, outLen, LG_MSG_BACKLOG, seq, payload, len);
+}
+
+bool lgDecodeBacklog(const LgFrame& frame, uint32_t& ageMs, LgAggregate& agg) {
+  if (frame.type != LG_MSG_BACKLOG || frame.length < 4) return false;
+  ageMs = (uint32_t)getU16(frame.payload) | ((uint32_t)getU16(frame.payload + 2) << 16);
+  return unpackAggregate(frame.payload + 4, frame.length - 4, agg);
+}
+
+// ---------------------- Temperature -----------------------------
+int16_t lgTempToCenti(float temp) {
+  if (isnan(temp) || temp < -300.0f || temp > 300.0f) return LG_TEMP_INVALID;
+  return (int16_t)lroundf(temp * 100.0f);
+}
+
+float lgCentiToTemp(int16_t centi) {
+  return centi == LG_TEMP_INVALID ? NAN : centi / 100.0f;
+}
@@ -0,0 +1,153 @@
+// LabGuard+ Wire Protocol
+// --------------------------------------------------
+// Shared by the ESP8266 sensor node and the ESP32 controller.
+// ➤ Versioned binary frames for the hot-path sensor messages
+// ➤ Negotiated during the HELLO:ESP8266 handshake
+// ➤ Text lines ("DATA:TEMP=...") stay available as a fallback
+//
+// Frame layout (little-endian):
+//   [0]    SYNC     0xA5 (never a valid first byte of a text line)
+//   [1]    VERSION  LG_PROTO_VERSION
+//   [2]    TYPE     LgMsgType
+//   [3]    LEN      payload length in bytes
+//   [4..5] SEQ      per-connection sequence number
+//   [6..]  PAYLOAD  LEN bytes, fixed-width fields per message type
+//   [..]   CRC16    CRC-16/CCITT-FALSE over VERSION..PAYLOAD
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// ---------------------- Framing ---------------------------------
+#define LG_PROTO_VERSION 1
+#define LG_FRAME_SYNC 0xA5
+#define LG_FRAME_HEADER_LEN 6
+#define LG_FRAME_CRC_LEN 2
+#define LG_FRAME_MAX_PAYLOAD 64
+#define LG_FRAME_MAX_LEN (LG_FRAME_HEADER_LEN + LG_FRAME_MAX_PAYLOAD + LG_FRAME_CRC_LEN)
+
+// Handshake tokens (text lines)
+#define LG_HELLO_BIN_KEY "PROTO="     // node → controller: HELLO:ESP8266,PROTO=1
+#define LG_PROTO_ACK "PROTO:BIN="     // controller → node: PROTO:BIN=1
+#define LG_HELLO_EDGE_KEY "EDGE=1"    // node sends one ALERT:/CLEAR: pair per incident
+
+enum LgMsgType : uint8_t {
+  LG_MSG_DATA = 0x01,       // One full sensor reading (LgSensorData)
+  LG_MSG_AGGREGATE = 0x02,  // Per-window min/max/mean + event counts (LgAggregate)
+  LG_MSG_BACKLOG = 0x03,    // A window buffered during a link outage: u32 age (ms) + LgAggregate
+};
+
+enum LgFrameStatus : uint8_t {
+  LG_FRAME_OK = 0,
+  LG_FRAME_INCOMPLETE,  // Need more bytes
+  LG_FRAME_BAD_SYNC,    // First byte is not LG_FRAME_SYNC
+  LG_FRAME_BAD_VERSION,
+  LG_FRAME_BAD_LENGTH,
+  LG_FRAME_BAD_CRC,
+};
+
+struct LgFrame {
+  uint8_t version;
+  uint8_t type;
+  uint8_t length;
+  uint16_t seq;
+  const uint8_t* payload;  // Points into the caller's buffer
+};
+
+// ---------------------- Sensor Data -----------------------------
+// Temperature travels as centi-degrees; LG_TEMP_INVALID marks a failed read.
+#define LG_TEMP_INVALID INT16_MIN
+#define LG_SENSOR_DATA_MIN_LEN 11   // Version 1 payload without tempAge
+#define LG_SENSOR_DATA_LEN 12
+
+struct LgSensorData {
+  int16_t tempCenti;
+  uint16_t gas;
+  uint16_t light;
+  int16_t distCm;   // -1 when the ultrasonic sensor saw no echo
+  uint8_t sound;
+  uint8_t pir;
+  uint8_t ir;
+  uint8_t tempAge;  // Seconds since the DHT reading was taken (saturates at 255)
+};
+
+// ---------------------- Aggregate -------------------------------
+// One record per reporting window. Analog channels carry min/max/mean;
+// digital channels carry the number of activations plus the last level.
+// In report-by-exception mode only the channels set in `channels` are current;
+// the other fields are still present (fixed width) but must be ignored.
+#define LG_AGGREGATE_MIN_LEN 38   // Without the channel mask (all channels current)
+#define LG_AGGREGATE_MASK_LEN 39  // With the mask, without event timing
+#define LG_AGGREGATE_EVENTS_LEN 51  // With event timing, without node timestamps
+#define LG_AGGREGATE_LEN 57
+
+#define LG_CH_TEMP 0x01
+#define LG_CH_GAS 0x02
+#define LG_CH_LIGHT 0x04
+#define LG_CH_DIST 0x08
+#define LG_CH_SOUND 0x10
+#define LG_CH_PIR 0x20
+#define LG_CH_IR 0x40
+#define LG_CH_ALL 0x7F
+
+// Digital event timing: ms from the window start, LG_EVENT_NONE if no event
+#define LG_EVENT_NONE 0xFFFF
+#define LG_AGE_UNKNOWN 0xFFFF     // acquireAgeMs from a node that does not send it
+
+struct LgEventTiming {
+  uint16_t firstMs;
+  uint16_t lastMs;
+};
+
+struct LgAnalogWindow {
+  int16_t min;
+  int16_t max;
+  int16_t mean;
+};
+
+struct LgAggregate {
+  uint16_t windowMs;
+  uint16_t samples;        // Gas samples taken (the fastest analog channel)
+  LgAnalogWindow temp;     // Centi-degrees, LG_TEMP_INVALID if no reading
+  LgAnalogWindow gas;
+  LgAnalogWindow light;
+  LgAnalogWindow dist;     // cm, -1 if no echo during the window
+  uint16_t soundEvents;
+  uint16_t pirEvents;
+  uint16_t irEvents;
+  uint8_t sound;           // Last sampled levels
+  uint8_t pir;
+  uint8_t ir;
+  uint8_t tempAge;
+  uint8_t channels;        // LG_CH_* bits of the channels carried by this record
+  LgEventTiming soundAt;   // First/last activation in the window
+  LgEventTiming pirAt;
+  LgEventTiming irAt;
+  uint32_t nodeMs;         // Node millis() when the record was built (0 = not sent)
+  uint16_t acquireAgeMs;   // ms from the window's oldest sample to nodeMs
+};
+
+// ---------------------- API -------------------------------------
+uint16_t lgCrc16(const uint8_t* data, size_t len);
+
+// Writes a complete frame into out. Returns bytes written, or 0 if it does not fit.
+size_t lgEncodeFrame(uint8_t* out, size_t outLen, uint8_t type, uint16_t seq,
+                     const uint8_t* payload, uint8_t payloadLen);
+
+// Parses one frame from the start of buf. On LG_FRAME_OK, *consumed is the frame
+// length; on any error other than LG_FRAME_INCOMPLETE the caller should drop one
+// byte and resynchronise.
+LgFrameStatus lgParseFrame(const uint8_t* buf, size_t len, LgFrame& frame, size_t* consumed);
+
+size_t lgEncodeSensorData(uint8_t* out, size_t outLen, uint16_t seq, const LgSensorData& data);
+bool lgDecodeSensorData(const LgFrame& frame, LgSensorData& data);
+size_t lgEncodeAggregate(uint8_t* out, size_t outLen, uint16_t seq, const LgAggregate& agg);
+bool lgDecodeAggregate(const LgFrame& frame, LgAggregate& agg);
+// ageMs = how long before sending the window was closed
+size_t lgEncodeBacklog(uint8_t* out, size_t outLen, uint16_t seq, uint32_t ageMs, const LgAggregate& agg);
+bool lgDecodeBacklog(const LgFrame& frame, uint32_t& ageMs, LgAggregate& agg);
+
+// Temperature helpers (NaN <-> LG_TEMP_INVALID)
+int16_t lgTempToCenti(float temp);
+float lgCentiToTemp(int16_t centi);
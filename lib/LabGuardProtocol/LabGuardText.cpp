@@ -0,0 +1,88 @@
+// LabGuard+ Text Protocol Tokenizer
+// See LabGuardText.h for the line format.
+
+#include "LabGuardText.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ---------------------- Values ----------------------------------
+// A value ends at ',' or the end of the line; strtol/strtof stop there too,
+// so the only extra check is that they consumed the whole value.
+static bool parseValue(const char* start, const char* end, const LgKvField& field) {
+  if (start == end) return false;
+  char* stop = nullptr;
+  errno = 0;
+  if (field.type == LG_KV_INT) {
+    long v = strtol(start, &stop, 10);
+    if (stop != end || errno == ERANGE) return false;
+    *(long*)field.value = v;
+  } else if (field.type == LG_KV_U32) {
+    if (*start == '-') return false;  // strtoul would negate it
+    unsigned long v = strtoul(start, &stop, 10);
+    if (stop != end || errno == ERANGE || v > UINT32_MAX) return false;
+    *(uint32_t*)field.value = v;
+  } else {
+    float v = strtof(start, &stop);
+    if (stop != end || errno == ERANGE) return false;
+    *(float*)field.value = v;
+  }
+  return true;
+}
+
+// ---------------------- Pairs -----------------------------------
+LgKvStatus lgParseKv(const char* body, const LgKvField* fields, uint8_t count,
+                     uint32_t* seen, const char** errorAt) {
+  *seen = 0;
+  const char* p = body;
+  while (*p) {
+    const char* token = p;
+    const char* eq = nullptr;
+    while (*p && *p != ',') {
+      if (*p == '=' && !eq) eq = p;
+      p++;
+    }
+    const char* end = p;
+    if (*p == ',') p++;
+    if (token == end) continue;  // Empty token (",," or trailing comma)
+
+    if (!eq || eq == token) {
+      if (errorAt) *errorAt = token;
+      return LG_KV_BAD_PAIR;
+    }
+
+    size_t keyLen = eq - token;
+    for (uint8_t i = 0; i < count; i++) {
+      if (strncmp(fields[i].key, token, keyLen) != 0 || fields[i].key[keyLen] != '\0') continue;
+      if (!parseValue(eq + 1, end, fields[i])) {
+        if (errorAt) *errorAt = token;
+        return LG_KV_BAD_NUMBER;
+      }
+      *seen |= 1UL << i;
+      break;
+    }
+  }
+  return LG_KV_OK;
+}
+
+// ---------------------- Lines -----------------------------------
+const char* lgKvBody(const char* line, const char* prefix) {
+  size_t n = strlen(prefix);
+  return strncmp(line, prefix, n) == 0 ? line + n : nullptr;
+}
+
+size_t lgTerminateLine(char* buf, size_t len) {
+  while (len > 0 && (buf[len - 1] == '\r' || buf[len - 1] == ' ' || buf[len - 1] == '\t')) len--;
+  buf[len] = '\0';
+  return len;
+}
+
+const char* lgKvStatusName(LgKvStatus status) {
+  switch (status) {
+    case LG_KV_OK: return "ok";
+    case LG_KV_BAD_PAIR: return "bad pair";
+    case LG_KV_BAD_NUMBER: return "bad number";
+  }
+  return "unknown";
+}
@@ -0,0 +1,53 @@
+// LabGuard+ Text Protocol Tokenizer
+// --------------------------------------------------
+// Shared by the ESP8266 sensor node and the ESP32 controller.
+// ➤ Parses "PREFIX:KEY=VALUE,KEY=VALUE,..." lines in place, in one pass
+// ➤ No heap: keys are matched against a caller-supplied table
+// ➤ Keys match whole tokens only (IR= never matches inside PIR=)
+// ➤ Malformed pairs and numbers are reported instead of reading as 0
+//
+// Unknown keys are skipped so older firmware keeps working with newer peers;
+// a repeated key overwrites the earlier value.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define LG_LINE_MAX 192   // Longest text line either side sends, including the NUL
+
+enum LgKvType : uint8_t {
+  LG_KV_INT,    // long*
+  LG_KV_U32,    // uint32_t* (millis() stamps, sequence numbers: they pass 2^31)
+  LG_KV_FLOAT,  // float* ("nan" is accepted and stored as NaN)
+};
+
+struct LgKvField {
+  const char* key;  // Without the '='
+  LgKvType type;
+  void* value;      // Written only when the key is present and well formed
+};
+
+enum LgKvStatus : uint8_t {
+  LG_KV_OK = 0,
+  LG_KV_BAD_PAIR,    // Token without '=' or with an empty key
+  LG_KV_BAD_NUMBER,  // Empty, non-numeric or out-of-range value
+};
+
+// Parses comma-separated KEY=VALUE pairs from body (NUL-terminated, an empty
+// body and a trailing comma are fine). Bit i of *seen is set for each field i
+// that was found. Parsing stops at the first error; *errorAt (if given) then
+// points at the offending token. Fields parsed before the error have already
+// been written, so callers that must not apply half a message should point
+// the table at locals and copy them out on LG_KV_OK.
+LgKvStatus lgParseKv(const char* body, const LgKvField* fields, uint8_t count,
+                     uint32_t* seen, const char** errorAt = nullptr);
+
+// Returns the text after prefix if line starts with it, nullptr otherwise.
+const char* lgKvBody(const char* line, const char* prefix);
+
+// Strips trailing whitespace/CR from the first len bytes of buf and
+// NUL-terminates it (buf must hold len + 1 bytes). Returns the new length.
+size_t lgTerminateLine(char* buf, size_t len);
+
+const char* lgKvStatusName(LgKvStatus status);
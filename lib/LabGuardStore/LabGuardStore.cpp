@@ -0,0 +1,326 @@
+// LabGuard+ Segment Store
+// See LabGuardStore.h for the record layout.
+//
+// Segment files are <dir>/<seq as 8 hex digits>.seg. The index holds one
+// LgSegmentInfo per file, oldest first; only the newest one is appended to.
+
+#include "LabGuardStore.h"
+
+#include <LabGuardProtocol.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint8_t scanBuf[1024];  // Holds at least one whole record
+
+// ---------------------- Byte Helpers ----------------------------
+static inline void putU32(uint8_t* p, uint32_t v) {
+  for (int i = 0; i < 4; i++) p[i] = (v >> (8 * i)) & 0xFF;
+}
+
+static inline uint32_t getU32(const uint8_t* p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void segmentPath(const LgStore& s, uint32_t seq, char* out) {
+  snprintf(out, LG_STORE_PATH_MAX, "%s/%08lx.seg", s.dir, (unsigned long)seq);
+}
+
+// ---------------------- Index -----------------------------------
+static void noteTime(LgSegmentInfo& seg, bool empty, uint32_t minTime, uint32_t maxTime) {
+  if (empty || minTime < seg.minTime) seg.minTime = minTime;
+  if (empty || maxTime > seg.maxTime) seg.maxTime = maxTime;
+}
+
+static void foundFile(const char* name, void* ctx) {
+  LgStore& s = *(LgStore*)ctx;
+  char* end;
+  unsigned long seq = strtoul(name, &end, 16);
+  if (end != name + 8 || strcmp(end, ".seg") != 0 || seq == 0) return;
+
+  // With a full index the oldest segment goes: left out of the index, its
+  // file would never be compacted or retired
+  if (s.segmentCount == LG_STORE_MAX_SEGMENTS) {
+    uint32_t oldest = seq < s.segments[0].seq ? seq : s.segments[0].seq;
+    char path[LG_STORE_PATH_MAX];
+    segmentPath(s, oldest, path);
+    s.fs->remove(path);
+    s.segmentsDropped++;
+    if (oldest == seq) return;
+    memmove(s.segments, s.segments + 1, sizeof(s.segments[0]) * --s.segmentCount);
+  }
+  // Insert sorted
+  uint8_t i = s.segmentCount;
+  while (i > 0 && s.segments[i - 1].seq > seq) {
+    s.segments[i] = s.segments[i - 1];
+    i--;
+  }
+  s.segments[i] = {(uint32_t)seq, 0, 0, 0};
+  s.segmentCount++;
+}
+
+// Reads one segment front to back, handing each valid record to visit.
+// Returns the bytes up to the first bad record; *torn if there was one.
+static uint32_t scanSegment(LgStore& s, uint32_t seq, LgStoreVisitor visit, void* ctx, bool* torn) {
+  char path[LG_STORE_PATH_MAX];
+  segmentPath(s, seq, path);
+  uint32_t base = 0;  // File offset of scanBuf[0]
+  size_t have = 0, pos = 0;
+  bool eof = false;
+  *torn = false;
+
+  while (true) {
+    if (!eof && have - pos < LG_STORE_RECORD_MAX) {
+      memmove(scanBuf, scanBuf + pos, have - pos);
+      base += pos;
+      have -= pos;
+      pos = 0;
+      size_t want = sizeof(scanBuf) - have;
+      size_t n = s.fs->read(path, base + have, scanBuf + have, want);
+      eof = n < want;
+      have += n;
+    }
+    size_t avail = have - pos;
+    if (avail == 0) break;
+
+    const uint8_t* p = scanBuf + pos;
+    size_t total = avail >= 2 ? LG_STORE_HEADER_LEN + p[1] + LG_STORE_CRC_LEN : LG_STORE_RECORD_MAX;
+    if (avail < total || p[0] == 0x00 || p[0] == 0xFF) {
+      *torn = true;
+      break;
+    }
+    uint16_t crc = (uint16_t)p[total - 2] | ((uint16_t)p[total - 1] << 8);
+    if (crc != lgCrc16(p, total - LG_STORE_CRC_LEN)) {
+      *torn = true;
+      break;
+    }
+    LgStoreRecord rec = {p[0], p[1], getU32(p + 2), p + LG_STORE_HEADER_LEN};
+    if (visit) visit(rec, ctx);
+    pos += total;
+  }
+  return base + pos;
+}
+
+struct BeginScan {
+  LgStore* store;
+  LgSegmentInfo* seg;
+  bool empty;
+  LgStoreVisitor visit;
+  void* ctx;
+};
+
+static void indexRecord(const LgStoreRecord& rec, void* ctx) {
+  BeginScan& b = *(BeginScan*)ctx;
+  noteTime(*b.seg, b.empty, rec.time, rec.time);
+  b.empty = false;
+  if (rec.time > b.store->lastTime) b.store->lastTime = rec.time;
+  if (b.visit) b.visit(rec, b.ctx);
+}
+
+bool lgStoreBegin(LgStore& s, LgStoreFs& fs, const char* dir, LgStoreVisitor visit, void* ctx) {
+  s.fs = &fs;
+  snprintf(s.dir, sizeof(s.dir), "%s", dir);
+  s.segmentCount = 0;
+  s.sealed = false;
+  s.batchLen = 0;
+  s.lastTime = 0;
+  s.carrySeq = s.carryDone = 0;
+  s.totalBytes = 0;
+  s.flushes = s.bytesWritten = s.writeErrors = s.segmentsDropped = s.tornSegments = 0;
+  if (!fs.mkdir(dir)) return false;
+
+  fs.list(dir, foundFile, &s);
+  for (uint8_t i = 0; i < s.segmentCount; i++) {
+    LgSegmentInfo& seg = s.segments[i];
+    BeginScan b = {&s, &seg, true, visit, ctx};
+    bool torn;
+    seg.bytes = scanSegment(s, seg.seq, indexRecord, &b, &torn);
+    s.totalBytes += seg.bytes;
+    if (torn) {
+      s.tornSegments++;
+      if (i == s.segmentCount - 1) s.sealed = true;
+    }
+  }
+  return true;
+}
+
+// ---------------------- Writing ---------------------------------
+bool lgStoreAppend(LgStore& s, uint8_t type, uint32_t time, const void* payload, size_t len) {
+  size_t total = LG_STORE_HEADER_LEN + len + LG_STORE_CRC_LEN;
+  if (type == 0x00 || type == 0xFF || len > 255 || s.batchLen + total > sizeof(s.batch)) return false;
+  uint8_t* p = s.batch + s.batchLen;
+  p[0] = type;
+  p[1] = (uint8_t)len;
+  putU32(p + 2, time);
+  memcpy(p + LG_STORE_HEADER_LEN, payload, len);
+  uint16_t crc = lgCrc16(p, LG_STORE_HEADER_LEN + len);
+  p[total - 2] = crc & 0xFF;
+  p[total - 1] = crc >> 8;
+  if (!s.batchLen || time < s.batchMinTime) s.batchMinTime = time;
+  if (!s.batchLen || time > s.batchMaxTime) s.batchMaxTime = time;
+  s.batchLen += total;
+  return true;
+}
+
+bool lgStoreFlush(LgStore& s) {
+  if (!s.batchLen) return true;
+  LgSegmentInfo* seg = s.segmentCount ? &s.segments[s.segmentCount - 1] : nullptr;
+  bool full = seg && seg->bytes + s.batchLen > LG_STORE_SEGMENT_MAX && s.segmentCount < LG_STORE_MAX_SEGMENTS;
+  if (!seg || s.sealed || full) {
+    if (s.segmentCount == LG_STORE_MAX_SEGMENTS) {
+      // Sealed with a full index: make room rather than stop writing
+      char old[LG_STORE_PATH_MAX];
+      segmentPath(s, s.segments[0].seq, old);
+      s.fs->remove(old);
+      s.totalBytes -= s.segments[0].bytes;
+      memmove(s.segments, s.segments + 1, sizeof(s.segments[0]) * --s.segmentCount);
+      s.segmentsDropped++;
+    }
+    uint32_t seq = seg ? seg->seq + 1 : 1;
+    seg = &s.segments[s.segmentCount++];
+    *seg = {seq, 0, 0, 0};
+    s.sealed = false;
+  }
+
+  char path[LG_STORE_PATH_MAX];
+  segmentPath(s, seg->seq, path);
+  if (!s.fs->append(path, s.batch, s.batchLen)) {
+    // Part of it may have landed: never append behind it
+    s.writeErrors++;
+    s.sealed = true;
+    return false;
+  }
+  noteTime(*seg, seg->bytes == 0, s.batchMinTime, s.batchMaxTime);
+  seg->bytes += s.batchLen;
+  s.totalBytes += s.batchLen;
+  s.bytesWritten += s.batchLen;
+  s.flushes++;
+  if (s.batchMaxTime > s.lastTime) s.lastTime = s.batchMaxTime;
+  s.batchLen = 0;
+  return true;
+}
+
+// ---------------------- Compaction ------------------------------
+struct CarryScan {
+  LgStore* store;
+  LgStoreKeep keep;
+  void* ctx;
+  uint32_t index;  // Records of the segment visited so far
+  bool ok;
+};
+
+// A record already in the batch stays there when a flush fails, so it is
+// counted in carryDone and skipped when the copy is retried
+static void carryRecord(const LgStoreRecord& rec, void* ctx) {
+  CarryScan& c = *(CarryScan*)ctx;
+  LgStore& s = *c.store;
+  if (!c.ok || c.index++ < s.carryDone) return;
+  if (c.keep(rec, c.ctx) && !lgStoreAppend(s, rec.type, rec.time, rec.payload, rec.len)) {
+    c.ok = lgStoreFlush(s) && lgStoreAppend(s, rec.type, rec.time, rec.payload, rec.len);
+    if (!c.ok) return;
+  }
+  s.carryDone = c.index;
+}
+
+bool lgStoreCompact(LgStore& s, uint32_t maxBytes, uint32_t minTime, LgStoreKeep keep, void* ctx) {
+  if (s.segmentCount < 2) return false;
+  LgSegmentInfo oldest = s.segments[0];
+  if (s.totalBytes <= maxBytes && oldest.maxTime >= minTime) return false;
+
+  if (keep) {
+    // Copy first, delete after: a reset in between only duplicates records
+    if (s.carrySeq != oldest.seq) {
+      s.carrySeq = oldest.seq;
+      s.carryDone = 0;
+    }
+    CarryScan c = {&s, keep, ctx, 0, true};
+    bool torn;
+    scanSegment(s, oldest.seq, carryRecord, &c, &torn);
+    if (!c.ok || !lgStoreFlush(s)) return false;
+    if (s.segments[0].seq != oldest.seq) return true;  // A flush already made room
+  }
+  char path[LG_STORE_PATH_MAX];
+  segmentPath(s, oldest.seq, path);
+  s.fs->remove(path);
+  s.totalBytes -= oldest.bytes;
+  memmove(s.segments, s.segments + 1, sizeof(s.segments[0]) * --s.segmentCount);
+  s.segmentsDropped++;
+  return true;
+}
+
+// ---------------------- Backends --------------------------------
+#if defined(ESP32)
+#include <LittleFS.h>
+
+bool LgLittleFs::mkdir(const char* dir) {
+  return LittleFS.exists(dir) || LittleFS.mkdir(dir);
+}
+
+bool LgLittleFs::append(const char* path, const uint8_t* data, size_t len) {
+  File f = LittleFS.open(path, "a");
+  if (!f) return false;
+  size_t n = f.write(data, len);
+  f.close();
+  return n == len;
+}
+
+size_t LgLittleFs::read(const char* path, uint32_t offset, uint8_t* buf, size_t len) {
+  File f = LittleFS.open(path, "r");
+  if (!f) return 0;
+  size_t n = f.seek(offset) ? f.read(buf, len) : 0;
+  f.close();
+  return n;
+}
+
+bool LgLittleFs::remove(const char* path) {
+  return LittleFS.remove(path);
+}
+
+void LgLittleFs::list(const char* dir, void (*found)(const char* name, void* ctx), void* ctx) {
+  File d = LittleFS.open(dir, "r");
+  if (!d || !d.isDirectory()) return;
+  for (File f = d.openNextFile(); f; f = d.openNextFile()) {
+    String name = f.name();  // Base name on current cores, full path on old ones
+    int slash = name.lastIndexOf('/');
+    found(name.c_str() + slash + 1, ctx);
+    f.close();
+  }
+}
+
+#elif !defined(ARDUINO)
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+bool LgPosixFs::mkdir(const char* dir) {
+  return ::mkdir(dir, 0755) == 0 || errno == EEXIST;
+}
+
+bool LgPosixFs::append(const char* path, const uint8_t* data, size_t len) {
+  FILE* f = fopen(path, "ab");
+  if (!f) return false;
+  size_t n = fwrite(data, 1, len, f);
+  return fclose(f) == 0 && n == len;
+}
+
+size_t LgPosixFs::read(const char* path, uint32_t offset, uint8_t* buf, size_t len) {
+  FILE* f = fopen(path, "rb");
+  if (!f) return 0;
+  size_t n = fseek(f, offset, SEEK_SET) == 0 ? fread(buf, 1, len, f) : 0;
+  fclose(f);
+  return n;
+}
+
+bool LgPosixFs::remove(const char* path) {
+  return ::remove(path) == 0;
+}
+
+void LgPosixFs::list(const char* dir, void (*found)(const char* name, void* ctx), void* ctx) {
+  DIR* d = opendir(dir);
+  if (!d) return;
+  while (struct dirent* e = readdir(d)) {
+    if (e->d_name[0] != '.') found(e->d_name, ctx);
+  }
+  closedir(d);
+}
+#endif
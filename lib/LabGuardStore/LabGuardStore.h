@@ -0,0 +1,135 @@
+// LabGuard+ Segment Store
+// --------------------------------------------------
+// Append-only, log-structured record store for the ESP32 controller.
+// ➤ Records are batched in RAM; one flush is one append to the newest segment
+// ➤ Segments are files named by sequence number, rotated at
+//   LG_STORE_SEGMENT_MAX bytes
+// ➤ Compaction drops the oldest segment once the store is over its byte
+//   budget or the segment is past retention, copying forward the records the
+//   owner still wants
+// ➤ lgStoreBegin() rebuilds the segment index from the files and replays
+//   every record, oldest segment first
+// ➤ The filesystem sits behind LgStoreFs: LittleFS on the ESP32, plain files
+//   (LgPosixFs) on a PC, so the store can be exercised on the host
+//
+// Record layout (little-endian):
+//   [0]    TYPE     owner-defined, 0x00 and 0xFF are reserved (erased flash)
+//   [1]    LEN      payload length in bytes
+//   [2..5] TIME     seconds on the owner's timeline
+//   [6..]  PAYLOAD  LEN bytes
+//   [..]   CRC16    lgCrc16 over TYPE..PAYLOAD
+//
+// A record that fails its CRC (a write torn by a reset or power loss) ends
+// its segment: the records before it are kept, and appends go to a new
+// segment. Not thread-safe; the controller only touches it from loop().
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef LG_STORE_SEGMENT_MAX
+#define LG_STORE_SEGMENT_MAX 32768   // Bytes before rotating to a new segment
+#endif
+
+#ifndef LG_STORE_BATCH_MAX
+#define LG_STORE_BATCH_MAX 1024      // Bytes buffered between flushes
+#endif
+
+#define LG_STORE_MAX_SEGMENTS 40
+#define LG_STORE_HEADER_LEN 6
+#define LG_STORE_CRC_LEN 2
+#define LG_STORE_RECORD_MAX (LG_STORE_HEADER_LEN + 255 + LG_STORE_CRC_LEN)
+#define LG_STORE_PATH_MAX 40
+
+// ---------------------- Filesystem ------------------------------
+class LgStoreFs {
+ public:
+  virtual ~LgStoreFs() {}
+  virtual bool mkdir(const char* dir) = 0;                    // true if it exists afterwards
+  virtual bool append(const char* path, const uint8_t* data, size_t len) = 0;
+  virtual size_t read(const char* path, uint32_t offset, uint8_t* buf, size_t len) = 0;
+  virtual bool remove(const char* path) = 0;
+  // Calls back with the base name of every file in dir
+  virtual void list(const char* dir, void (*found)(const char* name, void* ctx), void* ctx) = 0;
+};
+
+#if defined(ESP32)
+class LgLittleFs : public LgStoreFs {
+ public:
+  bool mkdir(const char* dir) override;
+  bool append(const char* path, const uint8_t* data, size_t len) override;
+  size_t read(const char* path, uint32_t offset, uint8_t* buf, size_t len) override;
+  bool remove(const char* path) override;
+  void list(const char* dir, void (*found)(const char* name, void* ctx), void* ctx) override;
+};
+#elif !defined(ARDUINO)
+class LgPosixFs : public LgStoreFs {
+ public:
+  bool mkdir(const char* dir) override;
+  bool append(const char* path, const uint8_t* data, size_t len) override;
+  size_t read(const char* path, uint32_t offset, uint8_t* buf, size_t len) override;
+  bool remove(const char* path) override;
+  void list(const char* dir, void (*found)(const char* name, void* ctx), void* ctx) override;
+};
+#endif
+
+// ---------------------- Store -----------------------------------
+struct LgStoreRecord {
+  uint8_t type;
+  uint8_t len;
+  uint32_t time;
+  const uint8_t* payload;  // Only valid during the callback
+};
+
+typedef void (*LgStoreVisitor)(const LgStoreRecord& rec, void* ctx);
+typedef bool (*LgStoreKeep)(const LgStoreRecord& rec, void* ctx);  // true = copy forward
+
+struct LgSegmentInfo {
+  uint32_t seq;
+  uint32_t bytes;          // Valid bytes; a torn tail is not counted
+  uint32_t minTime;        // Compaction copies older records forward, so
+  uint32_t maxTime;        // times are not in order within a segment
+};
+
+struct LgStore {
+  LgStoreFs* fs;
+  char dir[LG_STORE_PATH_MAX - 16];
+  LgSegmentInfo segments[LG_STORE_MAX_SEGMENTS];  // Oldest first
+  uint8_t segmentCount;
+  bool sealed;             // Newest segment has a torn tail, do not append to it
+  uint8_t batch[LG_STORE_BATCH_MAX];
+  size_t batchLen;
+  uint32_t batchMinTime, batchMaxTime;
+
+  uint32_t lastTime;       // Newest record time seen or written, 0 = none
+  uint32_t carrySeq;       // Segment an unfinished compaction was copying forward
+  uint32_t carryDone;      // Its records (kept or not) already handed to the batch
+  uint32_t totalBytes;
+  // Counters
+  uint32_t flushes;
+  uint32_t bytesWritten;
+  uint32_t writeErrors;
+  uint32_t segmentsDropped;
+  uint32_t tornSegments;   // Found at boot
+};
+
+// Indexes dir (created if missing) and replays every valid record to visit
+// (may be null). Segment files beyond the newest LG_STORE_MAX_SEGMENTS are
+// deleted. False if the directory cannot be used.
+bool lgStoreBegin(LgStore& s, LgStoreFs& fs, const char* dir, LgStoreVisitor visit, void* ctx);
+
+// Buffers one record; false if the batch is full (flush first) or len > 255
+bool lgStoreAppend(LgStore& s, uint8_t type, uint32_t time, const void* payload, size_t len);
+
+// Writes the batch to the newest segment, starting a new one when it is full
+// or sealed (or growing it past LG_STORE_SEGMENT_MAX while the index is
+// full). The batch is kept if the write fails.
+bool lgStoreFlush(LgStore& s);
+
+// Drops the oldest segment if the store is over maxBytes or all of its
+// records are older than minTime; records keep() accepts (keep may be null)
+// are appended and flushed first. A copy that fails partway resumes after
+// the records it already copied on the next call.
+// Never drops the newest segment. One segment per call; true if one went.
+bool lgStoreCompact(LgStore& s, uint32_t maxBytes, uint32_t minTime, LgStoreKeep keep, void* ctx);
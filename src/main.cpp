@@ -5,21 +5,72 @@
 // ➤ Communicates with ESP32 via TCP
 // ➤ Reads data from sensors
 // ➤ Sends alerts and full sensor data
+// ➤ Binary framed DATA messages (text fallback)
+// ➤ Interrupt-driven, non-blocking ultrasonic ranging
+// ➤ Scheduled DHT11 reads with a cached last-good temperature
+// ➤ Fast per-channel sampling, min/max/mean per reporting window
+// ➤ Timer-ticked per-sensor scheduler with a per-loop() latency budget
+// ➤ Interrupt-counted sound / PIR / IR events with first/last timestamps
+// ➤ Optional report-by-exception with per-channel deadbands
+// ➤ Store-and-forward backlog for link outages (RAM ring, optional flash spill)
+// ➤ Non-blocking Wi-Fi / TCP connection manager with jittered backoff
+// ➤ Oversampled, filtered MQ-2 gas channel
+// ➤ Edge-triggered alerts (ALERT:/CLEAR:) with hysteresis and re-arm time
+// ➤ Leveled, non-blocking Serial logging (LG_LOG_LEVEL)
+// ➤ Sequence number + node timestamp on every message (latency tracing)
 // ➤ LED status indicators
 // ➤ Manual reset push button
 
 #include <ESP8266WiFi.h>
 #include <DHT.h>
+#include <LabGuardProtocol.h>
+#include <LabGuardText.h>
+#include <LabGuardLog.h>
+
+// RAM overflow of the outage backlog can spill to LittleFS (-DBACKLOG_FLASH_SPILL=1)
+#ifndef BACKLOG_FLASH_SPILL
+#define BACKLOG_FLASH_SPILL 0
+#endif
+#if BACKLOG_FLASH_SPILL
+#include <LittleFS.h>
+#endif
 
 // --- Function Prototypes ---
 void setLEDs(bool red, bool white, bool green, bool blue);
-void connectToWiFi();
+void startWiFi();
 void connectToESP32();
+void serviceConnection();
+void updateStatusLEDs();
 void sendTestMessages();
 bool testSensorHealth();
-void blinkLED(int pin, int times, int delayTime);
 void readAndSendSensorData();
 long getUltrasonicDistance();
+void IRAM_ATTR onEchoEdge();
+void startUltrasonicPing();
+void serviceUltrasonic();
+bool waitForUltrasonic(unsigned long timeoutMs);
+bool acquireDHT();
+bool serviceDHT();
+unsigned long dhtAgeMs();
+void IRAM_ATTR onSchedulerTick();
+void IRAM_ATTR onSoundEdge();
+void IRAM_ATTR onPirEdge();
+void IRAM_ATTR onIrEdge();
+void serviceEdgeQueue();
+void serviceScheduler();
+void resetWindows();
+uint8_t changedChannels();
+void handleControllerLine(const char* line);
+void readControllerLines();
+void storeWindow();
+void backlogBegin();
+void drainBacklog();
+int sampleGas();
+void resetGasFilter();
+String gasFilterState();
+void evaluateAlerts(bool windowClosed);
+void resetAlerts();
+void sendLine(const char* msg, long ageMs = -1);
 
 // ---------------------- Wi-Fi Credentials ----------------------
 const char* ssid = "apple";
@@ -30,6 +81,27 @@ const char* esp32_ip = "192.168.4.1";
 const uint16_t esp32_port = 8080;
 WiFiClient client;
 
+// ---------------------- Connection Manager ----------------------
+// serviceConnection() drives Wi-Fi and the ESP32 link from loop(). Nothing
+// waits longer than one bounded connect() attempt, and failures back off
+// (exponential, jittered) instead of rebooting the node.
+#define WIFI_CONNECT_TIMEOUT_MS 15000
+#define WIFI_BACKOFF_MIN_MS 2000
+#define WIFI_BACKOFF_MAX_MS 60000
+#define TCP_CONNECT_TIMEOUT_MS 1000
+#define TCP_BACKOFF_MIN_MS 500
+#define TCP_BACKOFF_MAX_MS 30000
+#define RSSI_WEAK_DBM -80
+
+enum WifiState { WIFI_CONNECTING, WIFI_UP, WIFI_BACKOFF };
+WifiState wifiState = WIFI_CONNECTING;
+unsigned long wifiStateSince = 0;
+unsigned long wifiRetryDelay = 0;
+unsigned long wifiBackoffMs = WIFI_BACKOFF_MIN_MS;
+unsigned long tcpLastAttempt = 0;
+unsigned long tcpRetryDelay = 0;
+unsigned long tcpBackoffMs = TCP_BACKOFF_MIN_MS;
+
 // ---------------------- Sensor Pins ----------------------------
 #define DHTPIN D1       // DHT11 Temp Sensor (D1 / GPIO5)
 #define PIR_PIN D2      // PIR Motion Sensor (D2 / GPIO4)
@@ -58,15 +130,259 @@ int SOUND_TRIGGER = HIGH;
 int PRESENCE_DISTANCE_CM = 100;
 int LIGHT_THRESHOLD = 500;
 
+// ---------------------- Alert Engine ----------------------------
+// Each alert fires once (ALERT:X) when its condition appears and clears
+// (CLEAR:X) only once the value is back past its hysteresis band for a whole
+// window. A cleared alert can fire again ALERT_REARM_MS after it last fired.
+// A CLEAR: sent while the link is down is lost, so every alert announced on
+// the previous connection is cleared again on reconnect.
+#define TEMP_HYSTERESIS 1.0         // °C below TEMP_THRESHOLD
+#define GAS_HYSTERESIS 30           // Below GAS_THRESHOLD
+#define PRESENCE_HYSTERESIS_CM 20   // Beyond PRESENCE_DISTANCE_CM
+#define LIGHT_HYSTERESIS 50         // Above LIGHT_THRESHOLD
+unsigned long ALERT_REARM_MS = 30000;
+
+enum AlertId {
+  ALERT_TEMP_HIGH,
+  ALERT_GAS_LEAK,
+  ALERT_SOUND_EVENT,
+  ALERT_MOTION_PIR,
+  ALERT_IR_TRIGGERED,
+  ALERT_PRESENCE_DETECTED,
+  ALERT_ROOM_DARK,
+  ALERT_COUNT
+};
+const char* const ALERT_NAMES[ALERT_COUNT] = {
+  "TEMP_HIGH", "GAS_LEAK", "SOUND_EVENT", "MOTION_PIR", "IR_TRIGGERED", "PRESENCE_DETECTED", "ROOM_DARK"
+};
+
+struct AlertState {
+  bool active;
+  bool fired;               // Has fired at least once (re-arm timer valid)
+  unsigned long firedAt;
+  bool announced;           // ALERT: sent since the last (re)connect
+};
+AlertState alertStates[ALERT_COUNT];
+
+// ---------------------- Report by Exception ---------------------
+// When enabled, a window only reports the channels that left their deadband
+// (or fired, for digital channels); everything is re-sent at least every
+// HEARTBEAT_MS. Pushed by the ESP32 as DEADBANDS:RBE=1,TEMP=..,GAS=..,...
+#define RBE_MIN_INTERVAL_MS 1000   // Earliest a change may close a window
+bool RBE_ENABLED = false;
+float TEMP_DEADBAND = 0.5;         // °C
+int GAS_DEADBAND = 15;
+int LIGHT_DEADBAND = 50;
+int DIST_DEADBAND_CM = 10;
+unsigned long HEARTBEAT_MS = 60000;
+long lastReportedTemp = 0;         // Centi-degrees
+long lastReportedGas = 0;
+long lastReportedLight = 0;
+long lastReportedDist = 0;
+bool lastReportedSound = false;
+bool lastReportedPir = false;
+bool lastReportedIr = false;
+unsigned long lastHeartbeat = 0;
+bool heartbeatDue = true;          // First report after (re)connect is always full
+
+// ---------------------- Ultrasonic Ranging ----------------------
+// The echo pin is timed by a CHANGE interrupt; loop() only starts pings and
+// collects finished ones, so a missing echo never stalls the node.
+#define ULTRASONIC_MAX_ECHO_US 20000      // Same range limit as the old pulseIn timeout (~340 cm)
+#define ULTRASONIC_CYCLE_US 40000         // Give up on a ping after this (HC-SR04 idles ~38 ms with no echo)
+#define ULTRASONIC_PING_INTERVAL_MS 50    // 20 Hz raw ping rate
+#define ULTRASONIC_MAX_BURST 9
+
+enum UltrasonicState { US_IDLE, US_WAIT_ECHO };
+UltrasonicState ultrasonicState = US_IDLE;
+uint8_t ultrasonicBurstSize = 5;          // Median-of-N (1 = publish every ping)
+long ultrasonicBurst[ULTRASONIC_MAX_BURST];
+uint8_t ultrasonicBurstCount = 0;
+unsigned long ultrasonicPingUs = 0;
+unsigned long lastUltrasonicPing = 0;
+long ultrasonicDistanceCm = -1;           // Last published median, -1 = no echo
+unsigned long ultrasonicUpdatedAt = 0;    // millis() of the last published result
+unsigned long ultrasonicResults = 0;      // Published results since boot
+volatile unsigned long echoRiseUs = 0;
+volatile unsigned long echoFallUs = 0;
+volatile bool echoStarted = false;
+volatile bool echoDone = false;
+
 // ---------------------- Timing ------------------------------
 unsigned long lastSendTime = 0;
 const unsigned long sendInterval = 5000;
 bool esp32Ready = false;
 bool sensorReady = false;
 
+// ---------------------- DHT Acquisition -------------------------
+// A DHT11 read bit-bangs for ~25 ms (partly with interrupts off), so it runs on
+// its own cadence outside the send path; everyone else reads the cache.
+#define DHT_READ_INTERVAL_MS 2000   // DHT11 cannot be polled faster than this
+#define DHT_STALE_MS 10000          // Older cached readings are reported as NaN
+float dhtTemperature = NAN;         // Last good reading
+unsigned long dhtReadAt = 0;        // millis() of the last good reading
+unsigned long lastDhtAttempt = 0;
+bool dhtHasReading = false;
+uint16_t dhtFailures = 0;           // Consecutive failed reads
+
+// ---------------------- Gas ADC Pipeline ------------------------
+// Each gas sample is a burst of GAS_OVERSAMPLE A0 reads averaged into one
+// (decimation), then a fixed-order integer filter chain:
+// median (spike rejection) -> moving average -> EWMA. 0 disables a stage.
+// Tunable from the ESP32 with GASFILTER:OS=4,MEDIAN=3,AVG=0,EWMA=2.
+#define GAS_MAX_OVERSAMPLE 16   // Keep bursts short: back-to-back A0 reads upset Wi-Fi
+#define GAS_MAX_TAPS 9
+uint8_t GAS_OVERSAMPLE = 4;
+uint8_t GAS_MEDIAN_TAPS = 3;
+uint8_t GAS_AVERAGE_TAPS = 0;
+uint8_t GAS_EWMA_SHIFT = 2;     // alpha = 1 / 2^shift
+
+int gasRaw = 0;                 // Last decimated burst
+int gasFiltered = 0;            // Pipeline output
+int gasMedianBuf[GAS_MAX_TAPS];
+uint8_t gasMedianIdx = 0;
+uint8_t gasMedianCount = 0;
+int gasAverageBuf[GAS_MAX_TAPS];
+uint8_t gasAverageIdx = 0;
+uint8_t gasAverageCount = 0;
+long gasAverageSum = 0;
+long gasEwmaState = 0;          // 8 fractional bits
+bool gasEwmaPrimed = false;
+
+// ---------------------- Sampling Windows ------------------------
+// Channels are sampled far faster than they are reported. Each report carries
+// min/max/mean (analog) or activation counts (digital) for its window, so a
+// spike between reports is no longer invisible.
+// Sample rates are set per channel in the scheduler's task table.
+
+struct AnalogWindow {
+  long minV;
+  long maxV;
+  long sum;
+  uint16_t count;
+  unsigned long firstAt;        // millis() the oldest sample was taken
+  unsigned long minAt, maxAt;   // millis() the samples behind minV/maxV were taken
+};
+
+struct EventWindow {
+  uint16_t events;              // Inactive -> active transitions during the window
+  bool active;                  // Current state (carried across windows)
+  int level;                    // Last raw pin level
+  unsigned long firstAt;        // millis() of the first activation in the window
+  unsigned long lastAt;         // millis() of the latest activation in the window
+  unsigned long lastActivation; // Across windows, for the hold-off
+  unsigned long changedAt;      // millis() of the last active/inactive change
+};
+
+AnalogWindow tempWindow, gasWindow, lightWindow, distWindow;  // temp in centi-degrees
+EventWindow soundWindow, pirWindow, irWindow;
+unsigned long windowStart = 0;
+
+// ---------------------- Digital Event Interrupts ----------------
+// Sound, PIR and IR are timed by CHANGE interrupts. The ISRs only push
+// {micros, channel, level} into a single-producer/single-consumer ring; loop()
+// drains it every pass, so the first edge of an incident reaches the alert
+// engine within one pass and nothing between polls is missed. (GPIO ISRs do not
+// nest on the ESP8266, so the three handlers together are one producer.)
+// Re-activations closer than EVENT_HOLDOFF_MS count once (KY-037 chatter).
+#define EDGE_QUEUE_SIZE 32            // Power of two
+#define EVENT_HOLDOFF_MS 50
+
+enum EdgeChannel : uint8_t { EDGE_SOUND, EDGE_PIR, EDGE_IR };
+
+struct EdgeEvent {
+  uint32_t us;
+  uint8_t channel;
+  uint8_t level;
+};
+
+volatile EdgeEvent edgeQueue[EDGE_QUEUE_SIZE];
+volatile uint8_t edgeHead = 0;        // Written by the ISRs only
+volatile uint8_t edgeTail = 0;        // Written by loop() only
+volatile uint16_t edgeDropped = 0;    // Ring was full
+uint16_t edgeDroppedReported = 0;
+
+// ---------------------- Sensor Scheduler ------------------------
+// timer1 ticks every SCHED_TICK_MS. Each channel task declares a period and an
+// acquisition cost; loop() runs the due tasks, most overdue first, until the
+// pass would exceed SCHED_BUDGET_US. A task that does not fit waits for a later
+// pass, so a slow DHT read gets a pass to itself instead of stalling the fast
+// channels behind it. Phases are staggered so periods that divide each other
+// do not all land on the same tick. (timer1 is free: nothing here uses
+// analogWrite/tone.)
+#define SCHED_TICK_MS 5
+#define SCHED_BUDGET_US 2000        // Acquisition time allowed per loop() pass
+#define SCHED_REPORT_MS 60000       // Stats interval (LG_LEVEL_DEBUG builds)
+
+struct SensorTask {
+  const char* name;
+  uint16_t periodMs;
+  uint16_t costUs;                  // Declared cost; the measured average takes over if higher
+  bool (*acquire)();                // false = not now (e.g. echo in flight), retry next tick
+  uint32_t nextTick;
+  uint32_t runs;
+  uint32_t deferred;                // Due but pushed to a later pass by the budget
+  uint16_t avgUs;
+  uint16_t maxUs;
+};
+
+bool taskLevels();
+bool taskGas();
+bool taskLight();
+bool taskUltrasonic();
+
+SensorTask sensorTasks[] = {
+  // name, period ms, cost us, acquire
+  {"LEVELS", 500, 30, taskLevels},         // Sound/PIR/IR are interrupt-driven; this only resyncs
+  {"ULTRASONIC", 10, 30, taskUltrasonic},  // Polls the echo state machine (pings every 50 ms)
+  {"GAS", 50, 450, taskGas},               // 20 Hz, cost scales with GAS_OVERSAMPLE
+  {"LIGHT", 250, 120, taskLight},          // 4 Hz
+  {"DHT", DHT_READ_INTERVAL_MS, 25000, serviceDHT},  // 0.5 Hz, bit-banged
+};
+#define SENSOR_TASK_COUNT (sizeof(sensorTasks) / sizeof(sensorTasks[0]))
+
+volatile uint32_t schedTicks = 0;
+uint32_t schedOverruns = 0;         // Passes that ran past the budget anyway
+unsigned long lastSchedReport = 0;
+
+// ---------------------- Store and Forward -----------------------
+// Windows that close while the link is down are kept (with their close time)
+// and replayed as BACKLOG frames after reconnect, a few per pass.
+#define BACKLOG_SIZE 120                // RAM ring: 10 min of 5 s windows
+#define BACKLOG_BATCH 4                 // Records per drain pass
+#define BACKLOG_DRAIN_INTERVAL_MS 250   // => at most 16 replayed records/s
+#define BACKLOG_FILE "/backlog.bin"
+#define BACKLOG_FLASH_MAX 1440          // Spill file cap: 2 h of 5 s windows
+
+struct BacklogRecord {
+  unsigned long closedAt;  // millis() when the window closed
+  LgAggregate agg;
+};
+BacklogRecord backlog[BACKLOG_SIZE];
+uint16_t backlogHead = 0;               // Oldest record in RAM
+uint16_t backlogCount = 0;
+uint16_t flashBacklogWritten = 0;       // Records appended to BACKLOG_FILE
+uint16_t flashBacklogRead = 0;          // Records already replayed from it
+unsigned long backlogDropped = 0;
+unsigned long lastBacklogDrain = 0;
+
+// ---------------------- Wire Protocol ------------------------------
+// Every message carries the per-connection sequence number and the node's
+// millis() at send (frame header / payload, or a ",SEQ=..,T=.." trailer on text
+// lines). Readings and alerts also carry AGE: ms since the data they report
+// was acquired (the window's oldest sample, or the sample behind an alert).
+bool binaryProtocol = false;  // Set once the ESP32 acknowledges PROTO:BIN
+uint16_t txSeq = 0;
+uint8_t txFrame[LG_FRAME_MAX_LEN];
+// Lines from the ESP32 build up here across loop() passes
+char rxLine[LG_LINE_MAX];
+size_t rxLen = 0;
+bool rxOverlong = false;      // Discarding the rest of a line that did not fit
+
 // ---------------------- Setup ------------------------------
 void setup() {
   Serial.begin(115200);
+  lgLogBegin(Serial);
   delay(1000);
 
   pinMode(LED_RED, OUTPUT);
@@ -78,187 +394,977 @@ void setup() {
   pinMode(SOUND_PIN, INPUT);
   pinMode(TRIG_PIN, OUTPUT);
   pinMode(ECHO_PIN, INPUT);
+  attachInterrupt(digitalPinToInterrupt(ECHO_PIN), onEchoEdge, CHANGE);
+  attachInterrupt(digitalPinToInterrupt(SOUND_PIN), onSoundEdge, CHANGE);
+  attachInterrupt(digitalPinToInterrupt(PIR_PIN), onPirEdge, CHANGE);
+  attachInterrupt(digitalPinToInterrupt(IR_PIN), onIrEdge, CHANGE);
+  for (unsigned int i = 0; i < SENSOR_TASK_COUNT; i++) sensorTasks[i].nextTick = i;  // Staggered phases
+  timer1_attachInterrupt(onSchedulerTick);
+  timer1_enable(TIM_DIV16, TIM_EDGE, TIM_LOOP);
+  timer1_write(SCHED_TICK_MS * 5000);  // 80 MHz / 16 = 5 counts per µs
   pinMode(RESET_BUTTON, INPUT_PULLUP);
   dht.begin();
+  resetWindows();
+  backlogBegin();
 
   setLEDs(true, false, false, false);
-  connectToWiFi();
-  connectToESP32();
-
-  if (esp32Ready) {
-    sendTestMessages();
-    sensorReady = testSensorHealth();
-  }
-
-  if (esp32Ready && sensorReady) {
-    setLEDs(false, true, true, true); // All good - blue LED on for ESP32 connection
-  } else {
-    setLEDs(true, false, false, false);
-  }
+  randomSeed(ESP.getChipId() ^ micros());
+  client.setTimeout(TCP_CONNECT_TIMEOUT_MS);
+  sensorReady = testSensorHealth();
+  startWiFi();  // loop() finishes the connection; sampling starts right away
 }
 
 // ---------------------- Loop ------------------------------
 void loop() {
-  // Wi-Fi auto-reconnect logic
-  if (WiFi.status() != WL_CONNECTED) {
-    Serial.println("📡 Wi-Fi dropped! Reconnecting...");
-    connectToWiFi();
-  }
+  // Wi-Fi and ESP32 link state machines (never block for long, never reboot)
+  serviceConnection();
+  lgLogDrain();
 
   // Debounced reset button
   static unsigned long lastResetPress = 0;
   if (digitalRead(RESET_BUTTON) == LOW && millis() - lastResetPress > 300) {
     lastResetPress = millis();
-    Serial.println("🔁 Manual Reset Pressed!");
+    LG_WARN("🔁 Manual Reset Pressed!");
+    lgLogFlush();
     ESP.restart();
   }
 
-  if (!client.connected()) {
-    setLEDs(true, false, false, false);
-    connectToESP32();
-    return;
-  }
+  // Sensor acquisition keeps running even while the ESP32 link is down
+  serviceEdgeQueue();
+  serviceScheduler();
 
-  if (WiFi.RSSI() < -80) {
-    blinkLED(LED_RED, 3, 200);
-    setLEDs(true, false, false, false);
-    return;
+  // Windows close on schedule whether or not the link is up
+  bool linkUp = esp32Ready && WiFi.RSSI() >= RSSI_WEAK_DBM;
+  bool sendDue = millis() - lastSendTime > sendInterval;
+  // Report-by-exception: a change closes the window early instead of waiting
+  if (linkUp && RBE_ENABLED && !sendDue && millis() - lastSendTime > RBE_MIN_INTERVAL_MS && changedChannels() != 0) {
+    sendDue = true;
   }
-
-  if (millis() - lastSendTime > sendInterval) {
-    readAndSendSensorData();
+  if (sendDue) {
+    if (linkUp) readAndSendSensorData();
+    else storeWindow();
     lastSendTime = millis();
   }
 
-  if (client.available()) {
-    String reply = client.readStringUntil('\n');
-    reply.trim();
-    Serial.println("📥 ESP32 says: " + reply);
-    
-    // Handle different message types from ESP32
-    if (reply.startsWith("THRESHOLDS:")) {
-      Serial.println("🔄 New thresholds received from ESP32:");
-      Serial.println(reply);
-      
-      // Parse threshold updates (format: THRESHOLDS:TEMP=40,GAS=350,SOUND=80)
-      if (reply.indexOf("TEMP=") != -1) {
-        int tempStart = reply.indexOf("TEMP=") + 5;
-        int tempEnd = reply.indexOf(",", tempStart);
-        if (tempEnd == -1) tempEnd = reply.length();
-        TEMP_THRESHOLD = reply.substring(tempStart, tempEnd).toFloat();
-        Serial.println("🌡️ New Temperature Threshold: " + String(TEMP_THRESHOLD) + "°C");
-      }
-      
-      if (reply.indexOf("GAS=") != -1) {
-        int gasStart = reply.indexOf("GAS=") + 4;
-        int gasEnd = reply.indexOf(",", gasStart);
-        if (gasEnd == -1) gasEnd = reply.length();
-        GAS_THRESHOLD = reply.substring(gasStart, gasEnd).toInt();
-        Serial.println("💨 New Gas Threshold: " + String(GAS_THRESHOLD) + " ppm");
-      }
-      
-      if (reply.indexOf("SOUND=") != -1) {
-        int soundStart = reply.indexOf("SOUND=") + 6;
-        int soundEnd = reply.indexOf(",", soundStart);
-        if (soundEnd == -1) soundEnd = reply.length();
-        SOUND_TRIGGER = reply.substring(soundStart, soundEnd).toInt();
-        Serial.println("🔊 New Sound Threshold: " + String(SOUND_TRIGGER));
+  if (!esp32Ready) return;
+  if (linkUp) {
+    evaluateAlerts(false);  // Enter conditions are checked on every pass
+    drainBacklog();
+  }
+
+  readControllerLines();
+}
+
+// ---------------------- Controller Messages ---------------------
+// Every handler parses into locals and applies them only if the whole line is
+// well formed, so a corrupted line never leaves a setting half updated.
+bool parseLine(const char* body, const LgKvField* fields, uint8_t count, uint32_t* seen) {
+  const char* errorAt = nullptr;
+  LgKvStatus status = lgParseKv(body, fields, count, seen, &errorAt);
+  if (status == LG_KV_OK) return true;
+  LG_WARN("⚠️ Ignoring malformed message (%s at \"%s\")", lgKvStatusName(status), errorAt);
+  return false;
+}
+
+// Takes whatever bytes have arrived without waiting for the rest of a line.
+// A line longer than LG_LINE_MAX - 1 is dropped whole, never handled in pieces.
+void readControllerLines() {
+  int avail = client.available();
+  while (avail-- > 0) {
+    int c = client.read();
+    if (c < 0) break;
+    if (c != '\n') {
+      if (rxLen < sizeof(rxLine) - 1) {
+        rxLine[rxLen++] = c;
+      } else if (!rxOverlong) {
+        rxOverlong = true;
+        LG_WARN("⚠️ Dropping a line from the ESP32 longer than %d bytes", LG_LINE_MAX - 1);
       }
-    } else if (reply.startsWith("CONFIG:")) {
-      Serial.println("⚙️ Configuration update from ESP32:");
-      Serial.println(reply);
-    } else if (reply.startsWith("PING")) {
-      Serial.println("🏓 PING received from ESP32 - connection alive");
-      client.println("PONG:ESP8266");
+      continue;
     }
+    bool complete = !rxOverlong;
+    size_t len = rxLen;
+    rxLen = 0;
+    rxOverlong = false;
+    if (!complete) continue;
+    lgTerminateLine(rxLine, len);
+    LG_DEBUG("📥 ESP32 says: %s", rxLine);
+    handleControllerLine(rxLine);
+  }
+}
+
+void handleControllerLine(const char* line) {
+  const char* body;
+  uint32_t seen;
+
+  if ((body = lgKvBody(line, "THRESHOLDS:"))) {
+    // Format: THRESHOLDS:TEMP=40,GAS=350,SOUND=80,REARM=30
+    float temp = TEMP_THRESHOLD;
+    long gas = GAS_THRESHOLD, sound = SOUND_TRIGGER, rearm = ALERT_REARM_MS / 1000;
+    const LgKvField fields[] = {
+      {"TEMP", LG_KV_FLOAT, &temp}, {"GAS", LG_KV_INT, &gas}, {"SOUND", LG_KV_INT, &sound}, {"REARM", LG_KV_INT, &rearm},
+    };
+    if (!parseLine(body, fields, 4, &seen)) return;
+    TEMP_THRESHOLD = temp;
+    GAS_THRESHOLD = gas;
+    SOUND_TRIGGER = sound;
+    ALERT_REARM_MS = rearm * 1000UL;
+    LG_INFO("🔄 New thresholds from ESP32: 🌡️ %.2f°C, 💨 %d ppm, 🔊 %d, ⏱️ re-arm %lus",
+            TEMP_THRESHOLD, GAS_THRESHOLD, SOUND_TRIGGER, ALERT_REARM_MS / 1000);
+  } else if ((body = lgKvBody(line, "GASFILTER:"))) {
+    // Format: GASFILTER:OS=4,MEDIAN=3,AVG=0,EWMA=2 (no keys = just report)
+    long os = GAS_OVERSAMPLE, median = GAS_MEDIAN_TAPS, avg = GAS_AVERAGE_TAPS, ewma = GAS_EWMA_SHIFT;
+    const LgKvField fields[] = {
+      {"OS", LG_KV_INT, &os}, {"MEDIAN", LG_KV_INT, &median}, {"AVG", LG_KV_INT, &avg}, {"EWMA", LG_KV_INT, &ewma},
+    };
+    if (!parseLine(body, fields, 4, &seen)) return;
+    GAS_OVERSAMPLE = constrain(os, 1, GAS_MAX_OVERSAMPLE);
+    GAS_MEDIAN_TAPS = constrain(median, 0, GAS_MAX_TAPS);
+    GAS_AVERAGE_TAPS = constrain(avg, 0, GAS_MAX_TAPS);
+    GAS_EWMA_SHIFT = constrain(ewma, 0, 8);
+    resetGasFilter();
+    sendLine(("GASFILTER_STATE:" + gasFilterState()).c_str());
+  } else if ((body = lgKvBody(line, "DEADBANDS:"))) {
+    // Format: DEADBANDS:RBE=1,TEMP=0.5,GAS=15,LIGHT=50,DIST=10,HEARTBEAT=60
+    long rbe = RBE_ENABLED, gas = GAS_DEADBAND, light = LIGHT_DEADBAND, dist = DIST_DEADBAND_CM;
+    long heartbeat = HEARTBEAT_MS / 1000;
+    float temp = TEMP_DEADBAND;
+    const LgKvField fields[] = {
+      {"RBE", LG_KV_INT, &rbe}, {"TEMP", LG_KV_FLOAT, &temp}, {"GAS", LG_KV_INT, &gas},
+      {"LIGHT", LG_KV_INT, &light}, {"DIST", LG_KV_INT, &dist}, {"HEARTBEAT", LG_KV_INT, &heartbeat},
+    };
+    if (!parseLine(body, fields, 6, &seen)) return;
+    RBE_ENABLED = rbe == 1;
+    TEMP_DEADBAND = temp;
+    GAS_DEADBAND = gas;
+    LIGHT_DEADBAND = light;
+    DIST_DEADBAND_CM = dist;
+    HEARTBEAT_MS = heartbeat * 1000UL;
+    heartbeatDue = true;
+    LG_INFO("📉 Report-by-exception %s, heartbeat %lus", RBE_ENABLED ? "ON" : "OFF", HEARTBEAT_MS / 1000);
+  } else if ((body = lgKvBody(line, "PROTO:"))) {
+    // Format: PROTO:BIN=1
+    long bin = 0;
+    const LgKvField fields[] = {{"BIN", LG_KV_INT, &bin}};
+    if (!parseLine(body, fields, 1, &seen)) return;
+    binaryProtocol = bin == LG_PROTO_VERSION;
+    LG_INFO("%s", binaryProtocol ? "📦 Binary protocol enabled" : "📝 Staying on text protocol");
+  } else if (lgKvBody(line, "CONFIG:")) {
+    LG_INFO("⚙️ Configuration update from ESP32: %s", line);
+  } else if ((body = lgKvBody(line, "PING:"))) {
+    // Format: PING:ESP32,T=<ESP32 millis> - echoed back for the clock offset estimate
+    uint32_t t = 0;
+    const LgKvField fields[] = {{"T", LG_KV_U32, &t}};
+    const char* caps = strchr(body, ',');
+    seen = 0;
+    if (caps && !parseLine(caps + 1, fields, 1, &seen)) return;
+    LG_DEBUG("🏓 PING received from ESP32 - connection alive");
+    char pong[40];
+    if (seen & 1) snprintf(pong, sizeof(pong), "PONG:ESP8266,ECHO=%lu", (unsigned long)t);
+    else strcpy(pong, "PONG:ESP8266");
+    sendLine(pong);
   }
 }
 
 // ---------------------- Wi-Fi Connection -----------------------
-void connectToWiFi() {
+void startWiFi() {
+  WiFi.mode(WIFI_STA);
   WiFi.begin(ssid, password);
-  int attempts = 0;
-  while (WiFi.status() != WL_CONNECTED && attempts < 30) {
-    delay(500); Serial.print(".");
-    attempts++;
-  }
-  if (WiFi.status() == WL_CONNECTED) {
-    Serial.println("\n✅ Wi-Fi connected!");
-    Serial.println("📶 IP: " + WiFi.localIP().toString());
-    setLEDs(false, true, false, false);
-  } else {
-    Serial.println("\n❌ Wi-Fi failed. Restarting...");
-    setLEDs(true, false, false, false);
-    ESP.restart();
+  wifiState = WIFI_CONNECTING;
+  wifiStateSince = millis();
+}
+
+// "Equal jitter": wait between half and all of the current backoff, then double it
+unsigned long nextBackoff(unsigned long &backoffMs, unsigned long maxMs) {
+  unsigned long wait = backoffMs / 2 + random(backoffMs / 2 + 1);
+  backoffMs = min(backoffMs * 2, maxMs);
+  return wait;
+}
+
+void serviceWiFi() {
+  bool connected = WiFi.status() == WL_CONNECTED;
+  switch (wifiState) {
+    case WIFI_CONNECTING:
+      if (connected) {
+        LG_INFO("✅ Wi-Fi connected! 📶 IP: %s", WiFi.localIP().toString());
+        wifiState = WIFI_UP;
+        wifiBackoffMs = WIFI_BACKOFF_MIN_MS;
+        updateStatusLEDs();
+      } else if (millis() - wifiStateSince > WIFI_CONNECT_TIMEOUT_MS) {
+        wifiRetryDelay = nextBackoff(wifiBackoffMs, WIFI_BACKOFF_MAX_MS);
+        LG_WARN("❌ Wi-Fi failed. Retrying in %lus", wifiRetryDelay / 1000);
+        WiFi.disconnect();
+        wifiState = WIFI_BACKOFF;
+        wifiStateSince = millis();
+      }
+      break;
+    case WIFI_BACKOFF:
+      if (millis() - wifiStateSince >= wifiRetryDelay) startWiFi();
+      break;
+    case WIFI_UP:
+      if (!connected) {
+        // The SDK reconnects on its own; give it the normal connect window
+        LG_WARN("📡 Wi-Fi dropped! Reconnecting...");
+        client.stop();
+        wifiState = WIFI_CONNECTING;
+        wifiStateSince = millis();
+        updateStatusLEDs();
+      }
+      break;
   }
 }
 
 // ---------------------- ESP32 Connection -----------------------
+void serviceESP32Link() {
+  if (esp32Ready && !client.connected()) {
+    LG_WARN("🔌 ESP32 connection lost.");
+    esp32Ready = false;
+    binaryProtocol = false;
+    tcpLastAttempt = millis();
+    tcpRetryDelay = nextBackoff(tcpBackoffMs, TCP_BACKOFF_MAX_MS);
+    updateStatusLEDs();
+  }
+  if (!esp32Ready && wifiState == WIFI_UP && millis() - tcpLastAttempt >= tcpRetryDelay) {
+    connectToESP32();
+  }
+}
+
+void serviceConnection() {
+  serviceWiFi();
+  serviceESP32Link();
+}
+
+// Single attempt, bounded by TCP_CONNECT_TIMEOUT_MS; the caller schedules retries
 void connectToESP32() {
+  tcpLastAttempt = millis();
   if (client.connect(esp32_ip, esp32_port)) {
-    Serial.println("✅ Connected to ESP32.");
-    Serial.println("🔗 ESP32 IP: " + String(esp32_ip) + ":" + String(esp32_port));
-    client.println("HELLO:ESP8266");
+    LG_INFO("✅ Connected to ESP32. 🔗 %s:%d", esp32_ip, esp32_port);
+    // Offer the binary protocol; stay on text until the ESP32 acknowledges
+    binaryProtocol = false;
+    txSeq = 0;
+    rxLen = 0;
+    rxOverlong = false;
+    heartbeatDue = true;
+    sendLine(("HELLO:ESP8266," LG_HELLO_BIN_KEY + String(LG_PROTO_VERSION) + "," LG_HELLO_EDGE_KEY).c_str());
+    resetAlerts();  // Clear what an outage may have left set, re-announce what is still active
+    sendTestMessages();
     esp32Ready = true;
-    setLEDs(false, true, true, true); // Blue LED on when connected to ESP32
+    tcpBackoffMs = TCP_BACKOFF_MIN_MS;
   } else {
-    Serial.println("❌ ESP32 connection failed.");
-    Serial.println("🔗 Trying to connect to: " + String(esp32_ip) + ":" + String(esp32_port));
+    tcpRetryDelay = nextBackoff(tcpBackoffMs, TCP_BACKOFF_MAX_MS);
+    LG_WARN("❌ ESP32 connection failed. Retrying in %lums", tcpRetryDelay);
     esp32Ready = false;
-    setLEDs(false, true, true, false); // Blue LED off when not connected
   }
+  updateStatusLEDs();
 }
 
 // ---------------------- Test Functions --------------------------
 bool testSensorHealth() {
-  float temp = dht.readTemperature();
+  float temp = acquireDHT() ? dhtTemperature : NAN;
   int gas = analogRead(MQ2_PIN);
   int sound = digitalRead(SOUND_PIN);
-  long dist = getUltrasonicDistance();
+  long dist = waitForUltrasonic(500) ? getUltrasonicDistance() : -1;
   return !isnan(temp) && gas > 0 && sound >= 0 && dist >= 0;
 }
 
 void sendTestMessages() {
-  client.println("TEST:SENSOR_CHECK");
-  delay(500);
+  sendLine("TEST:SENSOR_CHECK");
   // Send ESP8266 IP address to ESP32
-  client.println("INFO:ESP8266_IP=" + WiFi.localIP().toString());
-  delay(500);
+  sendLine(("INFO:ESP8266_IP=" + WiFi.localIP().toString()).c_str());
+}
+
+// ---------------------- Sampling Windows ------------------------
+void resetWindow(AnalogWindow &w) {
+  w.minV = LONG_MAX;
+  w.maxV = LONG_MIN;
+  w.sum = 0;
+  w.count = 0;
+}
+
+void addSample(AnalogWindow &w, long value, unsigned long at = millis()) {
+  if (w.count == 0) w.firstAt = at;
+  if (value < w.minV) { w.minV = value; w.minAt = at; }
+  if (value > w.maxV) { w.maxV = value; w.maxAt = at; }
+  w.sum += value;
+  w.count++;
+}
+
+long windowMean(const AnalogWindow &w) {
+  return w.sum / w.count;
+}
+
+// Also the 500 ms level resync: only an actual change moves changedAt
+void addLevel(EventWindow &w, int level, bool active, unsigned long at) {
+  if (active != w.active) w.changedAt = at;
+  if (active && !w.active && at - w.lastActivation >= EVENT_HOLDOFF_MS) {
+    if (w.events == 0) w.firstAt = at;
+    w.lastAt = at;
+    w.lastActivation = at;
+    w.events++;
+  }
+  w.active = active;
+  w.level = level;
+}
+
+// When the current state began: the window's first activation, else the
+// last change (for an alert, the sample that crossed into it)
+unsigned long eventStateAt(const EventWindow &w) {
+  return w.events ? w.firstAt : w.changedAt;
+}
+
+// First/last activation as ms from the window start
+LgEventTiming eventTiming(const EventWindow &w) {
+  LgEventTiming t;
+  if (w.events == 0) {
+    t.firstMs = t.lastMs = LG_EVENT_NONE;
+    return t;
+  }
+  // An edge drained just after the window opened may predate it slightly
+  long first = (long)(w.firstAt - windowStart);
+  long last = (long)(w.lastAt - windowStart);
+  t.firstMs = constrain(first, 0L, (long)LG_EVENT_NONE - 1);
+  t.lastMs = constrain(last, 0L, (long)LG_EVENT_NONE - 1);
+  return t;
+}
+
+void resetWindows() {
+  resetWindow(tempWindow);
+  resetWindow(gasWindow);
+  resetWindow(lightWindow);
+  resetWindow(distWindow);
+  soundWindow.events = 0;
+  pirWindow.events = 0;
+  irWindow.events = 0;
+  windowStart = millis();
+}
+
+LgAnalogWindow packWindow(const AnalogWindow &w, int16_t empty) {
+  LgAnalogWindow out;
+  if (w.count == 0) {
+    out.min = out.max = out.mean = empty;
+  } else {
+    out.min = w.minV;
+    out.max = w.maxV;
+    out.mean = windowMean(w);
+  }
+  return out;
+}
+
+// Analog channel left its deadband if any sample in the window did
+bool outsideDeadband(const AnalogWindow &w, long last, long band) {
+  return w.count > 0 && (w.maxV - last > band || last - w.minV > band);
+}
+
+// LG_CH_* bits of the channels that changed since they were last reported
+uint8_t changedChannels() {
+  uint8_t channels = 0;
+  if (outsideDeadband(tempWindow, lastReportedTemp, lroundf(TEMP_DEADBAND * 100))) channels |= LG_CH_TEMP;
+  if (outsideDeadband(gasWindow, lastReportedGas, GAS_DEADBAND)) channels |= LG_CH_GAS;
+  if (outsideDeadband(lightWindow, lastReportedLight, LIGHT_DEADBAND)) channels |= LG_CH_LIGHT;
+  if (outsideDeadband(distWindow, lastReportedDist, DIST_DEADBAND_CM)) channels |= LG_CH_DIST;
+  if (soundWindow.events > 0 || soundWindow.active != lastReportedSound) channels |= LG_CH_SOUND;
+  if (pirWindow.events > 0 || pirWindow.active != lastReportedPir) channels |= LG_CH_PIR;
+  if (irWindow.events > 0 || irWindow.active != lastReportedIr) channels |= LG_CH_IR;
+  return channels;
+}
+
+// Remember what the ESP32 now knows, for the next deadband comparison
+void markReported(uint8_t channels) {
+  if ((channels & LG_CH_TEMP) && tempWindow.count) lastReportedTemp = windowMean(tempWindow);
+  if ((channels & LG_CH_GAS) && gasWindow.count) lastReportedGas = windowMean(gasWindow);
+  if ((channels & LG_CH_LIGHT) && lightWindow.count) lastReportedLight = windowMean(lightWindow);
+  if ((channels & LG_CH_DIST) && distWindow.count) lastReportedDist = windowMean(distWindow);
+  if (channels & LG_CH_SOUND) lastReportedSound = soundWindow.active;
+  if (channels & LG_CH_PIR) lastReportedPir = pirWindow.active;
+  if (channels & LG_CH_IR) lastReportedIr = irWindow.active;
+}
+
+// A window without a DHT read still reports the cached value if it is fresh,
+// and slow channels get at least one sample
+void fillEmptyWindows() {
+  if (tempWindow.count == 0 && dhtAgeMs() < DHT_STALE_MS) addSample(tempWindow, lroundf(dhtTemperature * 100), dhtReadAt);
+  if (gasWindow.count == 0) addSample(gasWindow, sampleGas());
+  if (lightWindow.count == 0) addSample(lightWindow, analogRead(LDR_PIN));
+}
+
+// millis() of the oldest sample in the window: what an aggregate's AGE is about
+unsigned long windowAcquiredAt() {
+  unsigned long at = millis();
+  for (const AnalogWindow* w : {&tempWindow, &gasWindow, &lightWindow, &distWindow}) {
+    if (w->count && (long)(w->firstAt - at) < 0) at = w->firstAt;
+  }
+  for (const EventWindow* w : {&soundWindow, &pirWindow, &irWindow}) {
+    if (w->events && (long)(w->firstAt - at) < 0) at = w->firstAt;
+  }
+  return at;
+}
+
+// AGE for data acquired at `at`, below LG_AGE_UNKNOWN
+long acquireAge(unsigned long at) {
+  return min(millis() - at, (unsigned long)LG_AGE_UNKNOWN - 1);
+}
+
+void buildAggregate(LgAggregate &agg, uint8_t channels) {
+  agg.windowMs = min(millis() - windowStart, 65535UL);
+  agg.samples = gasWindow.count;
+  agg.temp = packWindow(tempWindow, LG_TEMP_INVALID);
+  agg.gas = packWindow(gasWindow, 0);
+  agg.light = packWindow(lightWindow, 0);
+  agg.dist = packWindow(distWindow, -1);
+  agg.soundEvents = soundWindow.events;
+  agg.pirEvents = pirWindow.events;
+  agg.irEvents = irWindow.events;
+  agg.sound = soundWindow.level;
+  agg.pir = pirWindow.level;
+  agg.ir = irWindow.level;
+  agg.tempAge = min(dhtAgeMs() / 1000, 255UL);
+  agg.channels = channels;
+  agg.soundAt = eventTiming(soundWindow);
+  agg.pirAt = eventTiming(pirWindow);
+  agg.irAt = eventTiming(irWindow);
+  agg.nodeMs = millis();
+  agg.acquireAgeMs = acquireAge(windowAcquiredAt());
+}
+
+// ---------------------- Alert Engine ----------------------------
+// On (re)connect: clear whatever the ESP32 may still hold, then let anything
+// still active be announced again right away, without waiting to re-arm
+void resetAlerts() {
+  for (int i = 0; i < ALERT_COUNT; i++) {
+    AlertState &a = alertStates[i];
+    if (a.announced) {
+      char msg[32];
+      snprintf(msg, sizeof(msg), "CLEAR:%s", ALERT_NAMES[i]);
+      sendLine(msg);
+    }
+    a = {false, false, 0, false};
+  }
+}
+
+// `at`: millis() of the sample the enter/clear comparison was decided on
+void updateAlert(AlertId id, bool enter, bool clear, unsigned long at) {
+  AlertState &a = alertStates[id];
+  if (!a.active) {
+    if (!enter) return;
+    if (a.fired && millis() - a.firedAt < ALERT_REARM_MS) return;  // Not re-armed yet
+    a.active = true;
+    a.fired = true;
+    a.firedAt = millis();
+    a.announced = true;
+    char msg[32];
+    snprintf(msg, sizeof(msg), "ALERT:%s", ALERT_NAMES[id]);
+    sendLine(msg, acquireAge(at));
+  } else if (clear) {
+    a.active = false;
+    if (client.connected()) a.announced = false;  // Else resetAlerts() repeats it
+    char msg[32];
+    snprintf(msg, sizeof(msg), "CLEAR:%s", ALERT_NAMES[id]);
+    sendLine(msg, acquireAge(at));
+  }
+}
+
+// Enter conditions look at the window so far, so an alert fires within one
+// loop() pass; clear conditions need a whole closed window as evidence.
+void evaluateAlerts(bool windowClosed) {
+  bool tempSeen = tempWindow.count > 0;
+  updateAlert(ALERT_TEMP_HIGH, tempSeen && tempWindow.maxV > lroundf(TEMP_THRESHOLD * 100),
+              windowClosed && tempSeen && tempWindow.maxV < lroundf((TEMP_THRESHOLD - TEMP_HYSTERESIS) * 100),
+              tempWindow.maxAt);
+  updateAlert(ALERT_GAS_LEAK, gasWindow.count > 0 && gasWindow.maxV > GAS_THRESHOLD,
+              windowClosed && gasWindow.count > 0 && gasWindow.maxV < GAS_THRESHOLD - GAS_HYSTERESIS,
+              gasWindow.maxAt);
+  updateAlert(ALERT_SOUND_EVENT, soundWindow.events > 0 || soundWindow.active,
+              windowClosed && soundWindow.events == 0 && !soundWindow.active, eventStateAt(soundWindow));
+  updateAlert(ALERT_MOTION_PIR, pirWindow.events > 0 || pirWindow.active,
+              windowClosed && pirWindow.events == 0 && !pirWindow.active, eventStateAt(pirWindow));
+  updateAlert(ALERT_IR_TRIGGERED, irWindow.events > 0 || irWindow.active,
+              windowClosed && irWindow.events == 0 && !irWindow.active, eventStateAt(irWindow));
+  updateAlert(ALERT_PRESENCE_DETECTED, distWindow.count > 0 && distWindow.minV > 0 && distWindow.minV < PRESENCE_DISTANCE_CM,
+              windowClosed && (distWindow.count == 0 || distWindow.minV > PRESENCE_DISTANCE_CM + PRESENCE_HYSTERESIS_CM),
+              distWindow.count ? distWindow.minAt : ultrasonicUpdatedAt);  // No echo: the last burst
+  if (windowClosed && lightWindow.count > 0) {
+    long light = windowMean(lightWindow);
+    updateAlert(ALERT_ROOM_DARK, light < LIGHT_THRESHOLD, light > LIGHT_THRESHOLD + LIGHT_HYSTERESIS, lightWindow.firstAt);
+  }
 }
 
 // ---------------------- Sensor Read + Send ----------------------
+// Closes the current window: settles alerts on the whole window, then sends
+// one aggregate record and starts the next window.
 void readAndSendSensorData() {
-  float temp = dht.readTemperature();
-  int gas = analogRead(MQ2_PIN);
+  fillEmptyWindows();
+  evaluateAlerts(true);
+
+  float tempMean = tempWindow.count ? windowMean(tempWindow) / 100.0 : NAN;
+  long distMean = distWindow.count ? windowMean(distWindow) : -1;
+  bool soundSeen = soundWindow.events > 0 || soundWindow.active;
+  bool pirSeen = pirWindow.events > 0 || pirWindow.active;
+  bool irSeen = irWindow.events > 0 || irWindow.active;
+
+  if (distWindow.count == 0) {
+    LG_DEBUG("No object detected by ultrasonic sensor.");
+  }
+
+  uint8_t channels = LG_CH_ALL;
+  if (RBE_ENABLED) {
+    if (heartbeatDue || millis() - lastHeartbeat >= HEARTBEAT_MS) {
+      heartbeatDue = false;
+      lastHeartbeat = millis();
+    } else {
+      channels = changedChannels();
+    }
+  }
+  markReported(channels);
+  if (channels == 0) {
+    resetWindows();
+    return;
+  }
+
+  if (binaryProtocol) {
+    LgAggregate agg;
+    buildAggregate(agg, channels);
+    size_t len = lgEncodeAggregate(txFrame, sizeof(txFrame), txSeq++, agg);
+    client.write(txFrame, len);
+    resetWindows();
+    return;
+  }
+
+  // Text fallback: window means, digital channels reported as "seen this window"
+  int sound = soundSeen ? SOUND_TRIGGER : soundWindow.level;
+  int pir = pirSeen ? HIGH : LOW;
+  int ir = irSeen ? LOW : HIGH;
+  String data = "DATA:";
+  if (channels & LG_CH_TEMP) data += "TEMP=" + String(tempMean) + ",";
+  if (channels & LG_CH_GAS) data += "GAS=" + String(windowMean(gasWindow)) + ",";
+  if (channels & LG_CH_SOUND) data += "SOUND=" + String(sound) + ",";
+  if (channels & LG_CH_PIR) data += "PIR=" + String(pir) + ",";
+  if (channels & LG_CH_IR) data += "IR=" + String(ir) + ",";
+  if (channels & LG_CH_LIGHT) data += "LIGHT=" + String(windowMean(lightWindow)) + ",";
+  if (channels & LG_CH_DIST) data += "DIST=" + String(distMean) + ",";
+  data.remove(data.length() - 1);  // Trailing comma
+  sendLine(data.c_str(), acquireAge(windowAcquiredAt()));
+  resetWindows();
+}
+
+// ---------------------- Digital Event Interrupts ----------------
+void IRAM_ATTR pushEdge(uint8_t channel, uint8_t pin) {
+  uint8_t head = edgeHead;
+  uint8_t next = (head + 1) & (EDGE_QUEUE_SIZE - 1);
+  if (next == edgeTail) {
+    edgeDropped++;
+    return;
+  }
+  edgeQueue[head].us = micros();
+  edgeQueue[head].channel = channel;
+  edgeQueue[head].level = digitalRead(pin);
+  edgeHead = next;  // Publish only after the slot is filled
+}
+
+void IRAM_ATTR onSoundEdge() { pushEdge(EDGE_SOUND, SOUND_PIN); }
+void IRAM_ATTR onPirEdge() { pushEdge(EDGE_PIR, PIR_PIN); }
+void IRAM_ATTR onIrEdge() { pushEdge(EDGE_IR, IR_PIN); }
+
+// Call every loop(): moves queued edges into the current window
+void serviceEdgeQueue() {
+  unsigned long nowUs = micros();
+  unsigned long nowMs = millis();
+  while (edgeTail != edgeHead) {
+    uint8_t tail = edgeTail;
+    uint32_t us = edgeQueue[tail].us;
+    uint8_t channel = edgeQueue[tail].channel;
+    int level = edgeQueue[tail].level;
+    edgeTail = (tail + 1) & (EDGE_QUEUE_SIZE - 1);
+
+    unsigned long at = nowMs - (nowUs - us) / 1000;
+    EventWindow &w = channel == EDGE_SOUND ? soundWindow : channel == EDGE_PIR ? pirWindow : irWindow;
+    bool active = channel == EDGE_SOUND ? level == SOUND_TRIGGER : channel == EDGE_PIR ? level == HIGH : level == LOW;
+    // An edge that already reads back idle while the channel is idle was a
+    // pulse shorter than the ISR latency: count it, then settle on idle
+    if (!active && !w.active) addLevel(w, level, true, at);
+    addLevel(w, level, active, at);
+  }
+  if (edgeDropped != edgeDroppedReported) {
+    edgeDroppedReported = edgeDropped;
+    LG_WARN("⚠️ Edge queue overflow, %u edges dropped so far", edgeDroppedReported);
+  }
+}
+
+// ---------------------- Sensor Scheduler ------------------------
+void IRAM_ATTR onSchedulerTick() {
+  schedTicks++;
+}
+
+// Safety net for an edge lost to a full queue: a level that differs from the
+// tracked state is applied (and counted) as if its edge had arrived
+bool taskLevels() {
+  unsigned long now = millis();
   int sound = digitalRead(SOUND_PIN);
   int pir = digitalRead(PIR_PIN);
   int ir = digitalRead(IR_PIN);
-  int light = analogRead(LDR_PIN);
-  long dist = getUltrasonicDistance();
+  addLevel(soundWindow, sound, sound == SOUND_TRIGGER, now);
+  addLevel(pirWindow, pir, pir == HIGH, now);
+  addLevel(irWindow, ir, ir == LOW, now);
+  return true;
+}
+
+bool taskGas() {
+  addSample(gasWindow, sampleGas());
+  return true;
+}
+
+bool taskLight() {
+  addSample(lightWindow, analogRead(LDR_PIN));
+  return true;
+}
+
+bool taskUltrasonic() {
+  serviceUltrasonic();
+  return true;
+}
+
+// Call every loop(): runs the due tasks, most overdue first, within the budget
+void serviceScheduler() {
+  uint32_t now = schedTicks;
+  unsigned long spent = 0;
+  bool ranAny = false;
+
+  while (true) {
+    SensorTask *next = nullptr;
+    for (unsigned int i = 0; i < SENSOR_TASK_COUNT; i++) {
+      SensorTask &t = sensorTasks[i];
+      if ((int32_t)(now - t.nextTick) < 0) continue;
+      if (!next || (int32_t)(t.nextTick - next->nextTick) < 0) next = &t;
+    }
+    if (!next) break;
+
+    unsigned long cost = max((unsigned long)next->costUs, (unsigned long)next->avgUs);
+    if (ranAny && spent + cost > SCHED_BUDGET_US) {
+      next->deferred++;
+      break;
+    }
+
+    unsigned long start = micros();
+    bool done = next->acquire();
+    unsigned long took = micros() - start;
+    spent += took;
+    ranAny = true;
+
+    if (!done) {
+      next->nextTick = now + 1;
+      continue;
+    }
+    uint32_t period = max(1, next->periodMs / SCHED_TICK_MS);
+    next->nextTick += period;
+    if ((int32_t)(now - next->nextTick) >= 0) next->nextTick = now + period;  // Fell a whole period behind
+    next->runs++;
+    next->avgUs = next->avgUs ? (next->avgUs * 7 + took) / 8 : took;
+    if (took > next->maxUs) next->maxUs = min(took, 65535UL);
+  }
+  if (spent > SCHED_BUDGET_US) schedOverruns++;
+
+#if LG_LOG_LEVEL >= LG_LEVEL_DEBUG
+  if (millis() - lastSchedReport >= SCHED_REPORT_MS) {
+    lastSchedReport = millis();
+    for (unsigned int i = 0; i < SENSOR_TASK_COUNT; i++) {
+      const SensorTask &t = sensorTasks[i];
+      LG_DEBUG("⏱️ %s runs %lu deferred %lu avg %uus max %uus", t.name, t.runs, t.deferred, t.avgUs, t.maxUs);
+    }
+    LG_DEBUG("⏱️ Scheduler overruns %lu", schedOverruns);
+  }
+#endif
+}
+
+// ---------------------- Gas Sensor ------------------------------
+int readGasBurst() {
+  long sum = 0;
+  for (int i = 0; i < GAS_OVERSAMPLE; i++) sum += analogRead(MQ2_PIN);
+  return sum / GAS_OVERSAMPLE;
+}
+
+int gasMedianStage(int x) {
+  gasMedianBuf[gasMedianIdx] = x;
+  gasMedianIdx = (gasMedianIdx + 1) % GAS_MEDIAN_TAPS;
+  if (gasMedianCount < GAS_MEDIAN_TAPS) gasMedianCount++;
+  int sorted[GAS_MAX_TAPS];
+  for (int i = 0; i < gasMedianCount; i++) {
+    int v = gasMedianBuf[i];
+    int j = i;
+    while (j > 0 && sorted[j - 1] > v) { sorted[j] = sorted[j - 1]; j--; }
+    sorted[j] = v;
+  }
+  return sorted[gasMedianCount / 2];
+}
+
+int gasAverageStage(int x) {
+  if (gasAverageCount == GAS_AVERAGE_TAPS) gasAverageSum -= gasAverageBuf[gasAverageIdx];
+  else gasAverageCount++;
+  gasAverageBuf[gasAverageIdx] = x;
+  gasAverageSum += x;
+  gasAverageIdx = (gasAverageIdx + 1) % GAS_AVERAGE_TAPS;
+  return gasAverageSum / gasAverageCount;
+}
+
+int gasEwmaStage(int x) {
+  if (!gasEwmaPrimed) {
+    gasEwmaState = (long)x << 8;
+    gasEwmaPrimed = true;
+  } else {
+    gasEwmaState += (((long)x << 8) - gasEwmaState) >> GAS_EWMA_SHIFT;
+  }
+  return (gasEwmaState + 128) >> 8;
+}
+
+// One filtered gas sample: oversampled burst through the enabled filter stages
+int sampleGas() {
+  gasRaw = readGasBurst();
+  int x = gasRaw;
+  if (GAS_MEDIAN_TAPS > 1) x = gasMedianStage(x);
+  if (GAS_AVERAGE_TAPS > 1) x = gasAverageStage(x);
+  if (GAS_EWMA_SHIFT > 0) x = gasEwmaStage(x);
+  gasFiltered = x;
+  return x;
+}
+
+void resetGasFilter() {
+  gasMedianIdx = gasMedianCount = 0;
+  gasAverageIdx = gasAverageCount = 0;
+  gasAverageSum = 0;
+  gasEwmaPrimed = false;
+}
+
+String gasFilterState() {
+  return "OS=" + String(GAS_OVERSAMPLE) + ",MEDIAN=" + String(GAS_MEDIAN_TAPS) + ",AVG=" + String(GAS_AVERAGE_TAPS) +
+         ",EWMA=" + String(GAS_EWMA_SHIFT) + ",RAW=" + String(gasRaw) + ",OUT=" + String(gasFiltered);
+}
 
-  if (temp > TEMP_THRESHOLD) client.println("ALERT:TEMP_HIGH");
-  if (gas > GAS_THRESHOLD) client.println("ALERT:GAS_LEAK");
-  if (sound == SOUND_TRIGGER) client.println("ALERT:SOUND_EVENT");
-  if (pir == HIGH) client.println("ALERT:MOTION_PIR");
-  if (ir == LOW) client.println("ALERT:IR_TRIGGERED");
-  if (dist > 0 && dist < PRESENCE_DISTANCE_CM) client.println("ALERT:PRESENCE_DETECTED");
-  if (light < LIGHT_THRESHOLD) client.println("ALERT:ROOM_DARK");
+// ---------------------- Store and Forward -----------------------
+void backlogBegin() {
+#if BACKLOG_FLASH_SPILL
+  // Records are stamped with millis(), so a spill file from before a reboot is meaningless
+  if (LittleFS.begin()) LittleFS.remove(BACKLOG_FILE);
+#endif
+}
 
-  if (dist == -1) {
-    Serial.println("No object detected by ultrasonic sensor.");
+#if BACKLOG_FLASH_SPILL
+bool spillToFlash(const BacklogRecord &rec) {
+  if (flashBacklogWritten >= BACKLOG_FLASH_MAX) return false;
+  File f = LittleFS.open(BACKLOG_FILE, "a");
+  if (!f) return false;
+  bool ok = f.write((const uint8_t *)&rec, sizeof(rec)) == sizeof(rec);
+  f.close();
+  if (ok) flashBacklogWritten++;
+  return ok;
+}
+
+bool readFromFlash(BacklogRecord &rec) {
+  File f = LittleFS.open(BACKLOG_FILE, "r");
+  bool ok = f && f.seek((size_t)flashBacklogRead * sizeof(rec)) && f.read((uint8_t *)&rec, sizeof(rec)) == sizeof(rec);
+  if (f) f.close();
+  flashBacklogRead++;
+  if (flashBacklogRead >= flashBacklogWritten) {
+    LittleFS.remove(BACKLOG_FILE);
+    flashBacklogRead = flashBacklogWritten = 0;
+  }
+  return ok;
+}
+#endif
+
+void backlogPush(unsigned long closedAt, const LgAggregate &agg) {
+  if (backlogCount == BACKLOG_SIZE) {
+    // RAM ring full: the oldest record moves to flash, or is lost
+#if BACKLOG_FLASH_SPILL
+    if (!spillToFlash(backlog[backlogHead])) backlogDropped++;
+#else
+    backlogDropped++;
+#endif
+    backlogHead = (backlogHead + 1) % BACKLOG_SIZE;
+    backlogCount--;
+  }
+  BacklogRecord &rec = backlog[(backlogHead + backlogCount) % BACKLOG_SIZE];
+  rec.closedAt = closedAt;
+  rec.agg = agg;
+  backlogCount++;
+}
+
+// Oldest first: anything spilled to flash predates what is still in RAM
+bool backlogPop(BacklogRecord &rec) {
+#if BACKLOG_FLASH_SPILL
+  while (flashBacklogRead < flashBacklogWritten) {
+    if (readFromFlash(rec)) return true;
+  }
+#endif
+  if (backlogCount == 0) return false;
+  rec = backlog[backlogHead];
+  backlogHead = (backlogHead + 1) % BACKLOG_SIZE;
+  backlogCount--;
+  return true;
+}
+
+unsigned long backlogPending() {
+  return backlogCount + (flashBacklogWritten - flashBacklogRead);
+}
+
+// Link is down: keep the closed window for replay instead of losing it
+void storeWindow() {
+  fillEmptyWindows();
+  LgAggregate agg;
+  buildAggregate(agg, LG_CH_ALL);
+  backlogPush(millis(), agg);
+  heartbeatDue = true;  // The first live report after the outage is a full one
+  resetWindows();
+}
+
+// Replays buffered windows a few at a time so the ESP32 is not swamped.
+// Only a controller that negotiated the binary protocol understands BACKLOG.
+void drainBacklog() {
+  if (!binaryProtocol || backlogPending() == 0) return;
+  if (millis() - lastBacklogDrain < BACKLOG_DRAIN_INTERVAL_MS) return;
+  lastBacklogDrain = millis();
+
+  BacklogRecord rec;
+  for (int i = 0; i < BACKLOG_BATCH && backlogPop(rec); i++) {
+    size_t len = lgEncodeBacklog(txFrame, sizeof(txFrame), txSeq++, millis() - rec.closedAt, rec.agg);
+    client.write(txFrame, len);
+  }
+  if (backlogPending() == 0) {
+    LG_INFO("📤 Backlog replayed (%lu windows lost to overflow)", backlogDropped);
+    backlogDropped = 0;
+  }
+}
+
+// ---------------------- DHT Sensor ------------------------------
+// Blocking read; only called from serviceDHT() and the setup health check
+bool acquireDHT() {
+  lastDhtAttempt = millis();
+  float temp = dht.readTemperature();
+  if (isnan(temp)) {
+    dhtFailures++;
+    return false;
   }
+  dhtTemperature = temp;
+  addSample(tempWindow, lroundf(temp * 100));
+  dhtReadAt = millis();
+  dhtHasReading = true;
+  dhtFailures = 0;
+  return true;
+}
+
+// Scheduler task: reads the DHT, but never in a pass that is about to send or
+// while an ultrasonic echo is being timed (false = try again next tick)
+bool serviceDHT() {
+  if (millis() - lastSendTime > sendInterval) return false;
+  if (ultrasonicState == US_WAIT_ECHO) return false;
+  acquireDHT();
+  return true;
+}
 
-  String data = "DATA:TEMP=" + String(temp) + ",GAS=" + String(gas) + ",SOUND=" + String(sound) + ",PIR=" + String(pir) + ",IR=" + String(ir) + ",LIGHT=" + String(light) + ",DIST=" + String(dist);
-  client.println(data);
+// Age of the cached temperature in ms (ULONG_MAX before the first good read)
+unsigned long dhtAgeMs() {
+  return dhtHasReading ? millis() - dhtReadAt : ULONG_MAX;
 }
 
 // ---------------------- Ultrasonic Sensor -----------------------
-long getUltrasonicDistance() {
+void IRAM_ATTR onEchoEdge() {
+  unsigned long now = micros();
+  if (digitalRead(ECHO_PIN) == HIGH) {
+    echoRiseUs = now;
+    echoStarted = true;
+  } else if (echoStarted && !echoDone) {
+    echoFallUs = now;
+    echoDone = true;
+  }
+}
+
+void startUltrasonicPing() {
+  noInterrupts();
+  echoStarted = false;
+  echoDone = false;
+  interrupts();
   digitalWrite(TRIG_PIN, LOW); delayMicroseconds(2);
   digitalWrite(TRIG_PIN, HIGH); delayMicroseconds(10);
   digitalWrite(TRIG_PIN, LOW);
-  long duration = pulseIn(ECHO_PIN, HIGH, 20000);
-  return (duration == 0) ? -1 : duration * 0.034 / 2;
+  ultrasonicPingUs = micros();
+  lastUltrasonicPing = millis();
+  ultrasonicState = US_WAIT_ECHO;
+}
+
+// Median of the valid samples in the burst, -1 if none echoed
+long ultrasonicBurstMedian() {
+  long sorted[ULTRASONIC_MAX_BURST];
+  int n = 0;
+  for (int i = 0; i < ultrasonicBurstCount; i++) {
+    long v = ultrasonicBurst[i];
+    if (v < 0) continue;
+    int j = n++;
+    while (j > 0 && sorted[j - 1] > v) { sorted[j] = sorted[j - 1]; j--; }
+    sorted[j] = v;
+  }
+  return n == 0 ? -1 : sorted[n / 2];
+}
+
+// Scheduler task: collects a finished ping and starts the next one when due
+void serviceUltrasonic() {
+  if (ultrasonicState == US_WAIT_ECHO) {
+    long sample;
+    if (echoDone) {
+      noInterrupts();
+      unsigned long duration = echoFallUs - echoRiseUs;
+      interrupts();
+      sample = (duration > ULTRASONIC_MAX_ECHO_US) ? -1 : duration * 0.034 / 2;
+    } else if (micros() - ultrasonicPingUs > ULTRASONIC_CYCLE_US) {
+      sample = -1;
+    } else {
+      return;
+    }
+
+    ultrasonicState = US_IDLE;
+    ultrasonicBurst[ultrasonicBurstCount++] = sample;
+    if (ultrasonicBurstCount >= ultrasonicBurstSize) {
+      ultrasonicDistanceCm = ultrasonicBurstMedian();
+      if (ultrasonicDistanceCm >= 0) addSample(distWindow, ultrasonicDistanceCm);
+      ultrasonicUpdatedAt = millis();
+      ultrasonicResults++;
+      ultrasonicBurstCount = 0;
+    }
+  }
+
+  if (ultrasonicState == US_IDLE && millis() - lastUltrasonicPing >= ULTRASONIC_PING_INTERVAL_MS) {
+    startUltrasonicPing();
+  }
+}
+
+// Setup-time helper: spin the state machine until a fresh result is published
+bool waitForUltrasonic(unsigned long timeoutMs) {
+  unsigned long start = millis();
+  unsigned long before = ultrasonicResults;
+  while (millis() - start < timeoutMs) {
+    serviceUltrasonic();
+    if (ultrasonicResults != before) return true;
+    yield();
+  }
+  return false;
+}
+
+// Latest published distance in cm (-1 = no echo); never blocks
+long getUltrasonicDistance() {
+  return ultrasonicDistanceCm;
+}
+
+// ---------------------- Message Helpers -------------------------
+// Writes one text line with the ",SEQ=..,T=..[,AGE=..]" trailer, as a
+// single TCP write. A line the ESP32 would drop is not sent.
+void sendLine(const char* msg, long ageMs) {
+  char line[LG_LINE_MAX + 2];  // Plus CR LF
+  int n = snprintf(line, LG_LINE_MAX, "%s,SEQ=%u,T=%lu", msg, txSeq, millis());
+  if (ageMs >= 0 && n >= 0 && n < LG_LINE_MAX) n += snprintf(line + n, LG_LINE_MAX - n, ",AGE=%ld", ageMs);
+  if (n < 0 || n >= LG_LINE_MAX) {
+    LG_WARN("⚠️ Not sending a line longer than %d bytes: %.24s...", LG_LINE_MAX - 1, msg);
+    return;
+  }
+  txSeq++;
+  line[n++] = '\r';
+  line[n++] = '\n';
+  client.write((const uint8_t*)line, n);
 }
 
 // ---------------------- LED Functions ---------------------------
@@ -269,9 +1375,8 @@ void setLEDs(bool red, bool white, bool green, bool blue) {
   digitalWrite(LED_BLUE, blue ? HIGH : LOW);
 }
 
-void blinkLED(int pin, int times, int delayTime) {
-  for (int i = 0; i < times; i++) {
-    digitalWrite(pin, HIGH); delay(delayTime);
-    digitalWrite(pin, LOW); delay(delayTime);
-  }
+// Red = no Wi-Fi, white = Wi-Fi up, green = Wi-Fi + ESP32 + sensors OK, blue = ESP32 link
+void updateStatusLEDs() {
+  bool wifiUp = wifiState == WIFI_UP;
+  setLEDs(!wifiUp, wifiUp, wifiUp && esp32Ready && sensorReady, esp32Ready);
 }
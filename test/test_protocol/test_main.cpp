@@ -0,0 +1,244 @@
+// LabGuard+ Wire Protocol host tests (pio test -e native)
+// Frames are fed through the same drop-one-byte resync loop the controller
+// runs over its receive buffer.
+
+#include <unity.h>
+#include <LabGuardProtocol.h>
+
+#include <math.h>
+#include <string.h>
+
+void setUp() {}
+void tearDown() {}
+
+// ---------------------- Helpers ---------------------------------
+struct Parsed {
+  size_t count;
+  uint16_t seq[8];
+  size_t errors;   // Bytes dropped to resynchronise
+  size_t left;     // Incomplete tail
+};
+
+static Parsed parseStream(const uint8_t* buf, size_t len) {
+  Parsed p = {};
+  size_t off = 0;
+  while (off < len) {
+    LgFrame frame;
+    size_t used;
+    LgFrameStatus status = lgParseFrame(buf + off, len - off, frame, &used);
+    if (status == LG_FRAME_INCOMPLETE) break;
+    if (status != LG_FRAME_OK) {
+      p.errors++;
+      off++;
+      continue;
+    }
+    if (p.count < 8) p.seq[p.count] = frame.seq;
+    p.count++;
+    off += used;
+  }
+  p.left = len - off;
+  return p;
+}
+
+// A payload full of sync bytes, as a false start inside a frame looks
+static size_t syncHeavyFrame(uint8_t* out, uint16_t seq) {
+  uint8_t payload[12];
+  for (size_t i = 0; i < sizeof(payload); i++) payload[i] = i % 3 ? LG_FRAME_SYNC : LG_PROTO_VERSION;
+  return lgEncodeFrame(out, LG_FRAME_MAX_LEN, LG_MSG_DATA, seq, payload, sizeof(payload));
+}
+
+// ---------------------- CRC -------------------------------------
+void test_crc_check_value() {
+  // CRC-16/CCITT-FALSE check value
+  TEST_ASSERT_EQUAL_HEX16(0x29B1, lgCrc16((const uint8_t*)"123456789", 9));
+  TEST_ASSERT_EQUAL_HEX16(0xFFFF, lgCrc16(nullptr, 0));
+}
+
+// ---------------------- Framing ---------------------------------
+void test_frame_round_trip() {
+  const uint8_t payload[] = {1, 2, 3, LG_FRAME_SYNC, 0xFF, 0};
+  uint8_t buf[LG_FRAME_MAX_LEN];
+  size_t len = lgEncodeFrame(buf, sizeof(buf), LG_MSG_AGGREGATE, 0xBEEF, payload, sizeof(payload));
+  TEST_ASSERT_EQUAL_size_t(LG_FRAME_HEADER_LEN + sizeof(payload) + LG_FRAME_CRC_LEN, len);
+
+  LgFrame frame;
+  size_t used;
+  TEST_ASSERT_EQUAL(LG_FRAME_OK, lgParseFrame(buf, len, frame, &used));
+  TEST_ASSERT_EQUAL_size_t(len, used);
+  TEST_ASSERT_EQUAL_UINT8(LG_PROTO_VERSION, frame.version);
+  TEST_ASSERT_EQUAL_UINT8(LG_MSG_AGGREGATE, frame.type);
+  TEST_ASSERT_EQUAL_UINT8(sizeof(payload), frame.length);
+  TEST_ASSERT_EQUAL_UINT16(0xBEEF, frame.seq);
+  TEST_ASSERT_EQUAL_MEMORY(payload, frame.payload, sizeof(payload));
+}
+
+void test_encode_refuses_what_does_not_fit() {
+  uint8_t payload[LG_FRAME_MAX_PAYLOAD + 1] = {};
+  uint8_t buf[LG_FRAME_MAX_LEN + 8];
+  TEST_ASSERT_EQUAL_size_t(0, lgEncodeFrame(buf, sizeof(buf), LG_MSG_DATA, 1, payload, sizeof(payload)));
+  TEST_ASSERT_EQUAL_size_t(0, lgEncodeFrame(buf, LG_FRAME_HEADER_LEN + 4, LG_MSG_DATA, 1, payload, 4));
+}
+
+void test_truncated_frame_is_incomplete() {
+  uint8_t buf[LG_FRAME_MAX_LEN];
+  size_t len = syncHeavyFrame(buf, 7);
+  for (size_t n = 0; n < len; n++) {
+    LgFrame frame;
+    size_t used = 99;
+    TEST_ASSERT_EQUAL(LG_FRAME_INCOMPLETE, lgParseFrame(buf, n, frame, &used));
+    TEST_ASSERT_EQUAL_size_t(0, used);
+  }
+}
+
+void test_bad_crc_is_rejected() {
+  uint8_t buf[LG_FRAME_MAX_LEN];
+  size_t len = syncHeavyFrame(buf, 7);
+  LgFrame frame;
+  size_t used;
+  for (size_t i = 1; i < len; i++) {
+    buf[i] ^= 0x10;
+    LgFrameStatus status = lgParseFrame(buf, len, frame, &used);
+    TEST_ASSERT_TRUE(status != LG_FRAME_OK);
+    buf[i] ^= 0x10;
+  }
+  TEST_ASSERT_EQUAL(LG_FRAME_OK, lgParseFrame(buf, len, frame, &used));
+  buf[len - 1] ^= 0x01;
+  TEST_ASSERT_EQUAL(LG_FRAME_BAD_CRC, lgParseFrame(buf, len, frame, &used));
+}
+
+void test_bad_header_is_rejected() {
+  uint8_t buf[LG_FRAME_MAX_LEN];
+  size_t len = syncHeavyFrame(buf, 7);
+  LgFrame frame;
+  size_t used;
+  buf[0] = 'D';
+  TEST_ASSERT_EQUAL(LG_FRAME_BAD_SYNC, lgParseFrame(buf, len, frame, &used));
+  buf[0] = LG_FRAME_SYNC;
+  buf[1] = LG_PROTO_VERSION + 1;
+  TEST_ASSERT_EQUAL(LG_FRAME_BAD_VERSION, lgParseFrame(buf, len, frame, &used));
+  buf[1] = LG_PROTO_VERSION;
+  buf[3] = LG_FRAME_MAX_PAYLOAD + 1;
+  TEST_ASSERT_EQUAL(LG_FRAME_BAD_LENGTH, lgParseFrame(buf, len, frame, &used));
+}
+
+void test_resync_after_garbage() {
+  uint8_t buf[3 * LG_FRAME_MAX_LEN];
+  size_t len = 0;
+  const uint8_t garbage[] = {'x', LG_FRAME_SYNC, LG_PROTO_VERSION, 0x01, 0x00, LG_FRAME_SYNC};
+  memcpy(buf, garbage, sizeof(garbage));
+  len += sizeof(garbage);
+  len += syncHeavyFrame(buf + len, 1);
+  len += syncHeavyFrame(buf + len, 2);
+
+  Parsed p = parseStream(buf, len);
+  TEST_ASSERT_EQUAL_size_t(2, p.count);
+  TEST_ASSERT_EQUAL_UINT16(1, p.seq[0]);
+  TEST_ASSERT_EQUAL_UINT16(2, p.seq[1]);
+  TEST_ASSERT_EQUAL_size_t(sizeof(garbage), p.errors);
+  TEST_ASSERT_EQUAL_size_t(0, p.left);
+}
+
+void test_resync_past_false_sync_in_a_corrupt_frame() {
+  // The first frame is corrupt: resynchronising walks through its payload,
+  // where every other byte is a sync byte, and must land on the next frame
+  uint8_t buf[2 * LG_FRAME_MAX_LEN];
+  size_t first = syncHeavyFrame(buf, 1);
+  buf[first - 1] ^= 0xFF;
+  size_t len = first + syncHeavyFrame(buf + first, 2);
+
+  Parsed p = parseStream(buf, len);
+  TEST_ASSERT_EQUAL_size_t(1, p.count);
+  TEST_ASSERT_EQUAL_UINT16(2, p.seq[0]);
+  TEST_ASSERT_EQUAL_size_t(first, p.errors);
+  TEST_ASSERT_EQUAL_size_t(0, p.left);
+}
+
+void test_partial_frame_waits_for_more() {
+  uint8_t buf[2 * LG_FRAME_MAX_LEN];
+  size_t first = syncHeavyFrame(buf, 1);
+  size_t second = syncHeavyFrame(buf + first, 2);
+  Parsed p = parseStream(buf, first + second - 3);
+  TEST_ASSERT_EQUAL_size_t(1, p.count);
+  TEST_ASSERT_EQUAL_size_t(0, p.errors);
+  TEST_ASSERT_EQUAL_size_t(second - 3, p.left);
+}
+
+// ---------------------- Messages --------------------------------
+void test_sensor_data_round_trip() {
+  LgSensorData in = {lgTempToCenti(23.45f), 812, 340, -1, 1, 0, 1, 12};
+  uint8_t buf[LG_FRAME_MAX_LEN];
+  size_t len = lgEncodeSensorData(buf, sizeof(buf), 42, in);
+  LgFrame frame;
+  size_t used;
+  TEST_ASSERT_EQUAL(LG_FRAME_OK, lgParseFrame(buf, len, frame, &used));
+  LgSensorData out;
+  TEST_ASSERT_TRUE(lgDecodeSensorData(frame, out));
+  TEST_ASSERT_EQUAL_INT16(2345, out.tempCenti);
+  TEST_ASSERT_EQUAL_UINT16(812, out.gas);
+  TEST_ASSERT_EQUAL_UINT16(340, out.light);
+  TEST_ASSERT_EQUAL_INT16(-1, out.distCm);
+  TEST_ASSERT_EQUAL_UINT8(12, out.tempAge);
+  TEST_ASSERT_EQUAL_FLOAT(23.45f, lgCentiToTemp(out.tempCenti));
+  TEST_ASSERT_EQUAL_INT16(LG_TEMP_INVALID, lgTempToCenti(NAN));
+  TEST_ASSERT_FLOAT_IS_NAN(lgCentiToTemp(LG_TEMP_INVALID));
+}
+
+void test_aggregate_and_backlog_round_trip() {
+  LgAggregate in = {};
+  in.windowMs = 2000;
+  in.samples = 40;
+  in.temp = {2100, 2250, 2180};
+  in.gas = {300, 900, 450};
+  in.dist = {-1, -1, -1};
+  in.pirEvents = 3;
+  in.pir = 1;
+  in.channels = LG_CH_GAS | LG_CH_PIR;
+  in.pirAt = {120, 1800};
+  in.soundAt = in.irAt = {LG_EVENT_NONE, LG_EVENT_NONE};
+  in.nodeMs = 0xFFFFFF00;
+  in.acquireAgeMs = 1999;
+
+  uint8_t buf[LG_FRAME_MAX_LEN];
+  LgFrame frame;
+  size_t used;
+  LgAggregate out;
+  size_t len = lgEncodeAggregate(buf, sizeof(buf), 9, in);
+  TEST_ASSERT_EQUAL(LG_FRAME_OK, lgParseFrame(buf, len, frame, &used));
+  TEST_ASSERT_TRUE(lgDecodeAggregate(frame, out));
+  TEST_ASSERT_EQUAL_INT16(2250, out.temp.max);
+  TEST_ASSERT_EQUAL_INT16(450, out.gas.mean);
+  TEST_ASSERT_EQUAL_INT16(-1, out.dist.min);
+  TEST_ASSERT_EQUAL_UINT16(3, out.pirEvents);
+  TEST_ASSERT_EQUAL_UINT8(LG_CH_GAS | LG_CH_PIR, out.channels);
+  TEST_ASSERT_EQUAL_UINT16(1800, out.pirAt.lastMs);
+  TEST_ASSERT_EQUAL_UINT16(LG_EVENT_NONE, out.soundAt.firstMs);
+  TEST_ASSERT_EQUAL_UINT32(0xFFFFFF00, out.nodeMs);
+  TEST_ASSERT_EQUAL_UINT16(1999, out.acquireAgeMs);
+
+  uint32_t ageMs = 0;
+  len = lgEncodeBacklog(buf, sizeof(buf), 10, 90000, in);
+  TEST_ASSERT_EQUAL(LG_FRAME_OK, lgParseFrame(buf, len, frame, &used));
+  TEST_ASSERT_EQUAL_UINT8(LG_MSG_BACKLOG, frame.type);
+  TEST_ASSERT_TRUE(lgDecodeBacklog(frame, ageMs, out));
+  TEST_ASSERT_EQUAL_UINT32(90000, ageMs);
+  TEST_ASSERT_EQUAL_UINT16(2000, out.windowMs);
+
+  // The wrong message type does not decode
+  TEST_ASSERT_FALSE(lgDecodeAggregate(frame, out));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_crc_check_value);
+  RUN_TEST(test_frame_round_trip);
+  RUN_TEST(test_encode_refuses_what_does_not_fit);
+  RUN_TEST(test_truncated_frame_is_incomplete);
+  RUN_TEST(test_bad_crc_is_rejected);
+  RUN_TEST(test_bad_header_is_rejected);
+  RUN_TEST(test_resync_after_garbage);
+  RUN_TEST(test_resync_past_false_sync_in_a_corrupt_frame);
+  RUN_TEST(test_partial_frame_waits_for_more);
+  RUN_TEST(test_sensor_data_round_trip);
+  RUN_TEST(test_aggregate_and_backlog_round_trip);
+  return UNITY_END();
+}
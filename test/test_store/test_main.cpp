@@ -0,0 +1,253 @@
+// LabGuard+ Segment Store host tests (pio test -e native)
+// Each test gets a fresh directory under /tmp and drives the store through
+// LgPosixFs; FlakyFs fails appends on demand.
+
+#include <unity.h>
+#include <LabGuardStore.h>
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static char dir[] = "/tmp/lgstoreXXXXXX";
+static LgStore store, reopened;  // Too big for the stack
+
+// Fails every append once failAfter more have succeeded (-1 = never)
+class FlakyFs : public LgPosixFs {
+ public:
+  int failAfter = -1;
+  bool append(const char* path, const uint8_t* data, size_t len) override {
+    if (failAfter == 0) return false;
+    if (failAfter > 0) failAfter--;
+    return LgPosixFs::append(path, data, len);
+  }
+};
+static FlakyFs fs;
+
+// ---------------------- Helpers ---------------------------------
+struct Replay {
+  uint32_t count;
+  uint32_t seen[256];  // Per payload id
+  uint32_t lastTime;
+};
+static Replay replay;
+
+static void collect(const LgStoreRecord& rec, void* ctx) {
+  Replay& r = *(Replay*)ctx;
+  TEST_ASSERT_EQUAL_UINT8(4, rec.len);
+  uint32_t id;
+  memcpy(&id, rec.payload, 4);
+  r.seen[id & 0xFF]++;
+  r.count++;
+  r.lastTime = rec.time;
+}
+
+static void reopen() {
+  memset(&replay, 0, sizeof(replay));
+  TEST_ASSERT_TRUE(lgStoreBegin(reopened, fs, dir, collect, &replay));
+}
+
+static bool appendId(LgStore& s, uint32_t id, uint32_t time) {
+  return lgStoreAppend(s, 1, time, &id, sizeof(id));
+}
+
+static void segmentFile(uint32_t seq, char* out) {
+  snprintf(out, LG_STORE_PATH_MAX, "%s/%08lx.seg", dir, (unsigned long)seq);
+}
+
+static bool exists(uint32_t seq) {
+  char path[LG_STORE_PATH_MAX];
+  segmentFile(seq, path);
+  return access(path, F_OK) == 0;
+}
+
+static bool keepOdd(const LgStoreRecord& rec, void*) {
+  uint32_t id;
+  memcpy(&id, rec.payload, 4);
+  return id & 1;
+}
+
+void setUp() {
+  strcpy(dir, "/tmp/lgstoreXXXXXX");
+  TEST_ASSERT_NOT_NULL(mkdtemp(dir));
+  fs.failAfter = -1;
+  TEST_ASSERT_TRUE(lgStoreBegin(store, fs, dir, nullptr, nullptr));
+}
+
+void tearDown() {
+  DIR* d = opendir(dir);
+  if (!d) return;
+  while (struct dirent* e = readdir(d)) {
+    if (e->d_name[0] == '.') continue;
+    char path[sizeof(dir) + sizeof(e->d_name) + 1];
+    snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+    remove(path);
+  }
+  closedir(d);
+  rmdir(dir);
+}
+
+// ---------------------- Tests -----------------------------------
+void test_append_flush_replay() {
+  for (uint32_t id = 0; id < 20; id++) TEST_ASSERT_TRUE(appendId(store, id, 100 + id));
+  TEST_ASSERT_TRUE(lgStoreFlush(store));
+  TEST_ASSERT_EQUAL_UINT32(119, store.lastTime);
+
+  reopen();
+  TEST_ASSERT_EQUAL_UINT32(20, replay.count);
+  for (uint32_t id = 0; id < 20; id++) TEST_ASSERT_EQUAL_UINT32(1, replay.seen[id]);
+  TEST_ASSERT_EQUAL_UINT32(119, replay.lastTime);
+  TEST_ASSERT_EQUAL_UINT32(119, reopened.lastTime);
+  TEST_ASSERT_EQUAL_UINT8(1, reopened.segmentCount);
+  TEST_ASSERT_EQUAL_UINT32(store.totalBytes, reopened.totalBytes);
+  TEST_ASSERT_EQUAL_UINT32(0, reopened.tornSegments);
+}
+
+void test_unflushed_records_are_not_replayed() {
+  TEST_ASSERT_TRUE(appendId(store, 1, 10));
+  TEST_ASSERT_TRUE(lgStoreFlush(store));
+  TEST_ASSERT_TRUE(appendId(store, 2, 11));  // Lost with the "reset"
+  reopen();
+  TEST_ASSERT_EQUAL_UINT32(1, replay.count);
+}
+
+void test_torn_tail_is_dropped_and_sealed() {
+  for (uint32_t id = 0; id < 5; id++) TEST_ASSERT_TRUE(appendId(store, id, id + 1));
+  TEST_ASSERT_TRUE(lgStoreFlush(store));
+  uint32_t validBytes = store.totalBytes;
+
+  // Half of a record, as a reset during a write leaves it
+  uint8_t partial[LG_STORE_HEADER_LEN] = {1, 4, 9, 0, 0, 0};
+  char path[LG_STORE_PATH_MAX];
+  segmentFile(1, path);
+  TEST_ASSERT_TRUE(fs.LgPosixFs::append(path, partial, sizeof(partial)));
+
+  reopen();
+  TEST_ASSERT_EQUAL_UINT32(5, replay.count);
+  TEST_ASSERT_EQUAL_UINT32(1, reopened.tornSegments);
+  TEST_ASSERT_EQUAL_UINT32(validBytes, reopened.totalBytes);
+  TEST_ASSERT_TRUE(reopened.sealed);
+
+  // Appends go to a new segment, never behind the torn record
+  TEST_ASSERT_TRUE(appendId(reopened, 5, 6));
+  TEST_ASSERT_TRUE(lgStoreFlush(reopened));
+  TEST_ASSERT_EQUAL_UINT8(2, reopened.segmentCount);
+  TEST_ASSERT_EQUAL_UINT32(2, reopened.segments[1].seq);
+  reopen();
+  TEST_ASSERT_EQUAL_UINT32(6, replay.count);
+}
+
+void test_bad_crc_ends_segment() {
+  for (uint32_t id = 0; id < 3; id++) TEST_ASSERT_TRUE(appendId(store, id, id + 1));
+  TEST_ASSERT_TRUE(lgStoreFlush(store));
+  uint8_t bogus[LG_STORE_HEADER_LEN + 4 + LG_STORE_CRC_LEN] = {1, 4, 9, 0, 0, 0, 7, 0, 0, 0, 0x12, 0x34};
+  char path[LG_STORE_PATH_MAX];
+  segmentFile(1, path);
+  TEST_ASSERT_TRUE(fs.LgPosixFs::append(path, bogus, sizeof(bogus)));
+  reopen();
+  TEST_ASSERT_EQUAL_UINT32(3, replay.count);
+  TEST_ASSERT_EQUAL_UINT32(1, reopened.tornSegments);
+}
+
+// Full batches of id n at time n + 1. The native env builds the store with a
+// small LG_STORE_SEGMENT_MAX, so every full batch starts a new segment.
+static void fillSegments(LgStore& s, uint32_t segments, uint32_t first = 0) {
+  for (uint32_t n = first; n < first + segments; n++) {
+    while (appendId(s, n, n + 1)) {}
+    TEST_ASSERT_TRUE(lgStoreFlush(s));
+  }
+}
+
+void test_rotation_stops_at_max_segments() {
+  fillSegments(store, LG_STORE_MAX_SEGMENTS + 3);
+  // A full index keeps growing the newest segment instead of losing data
+  TEST_ASSERT_EQUAL_UINT8(LG_STORE_MAX_SEGMENTS, store.segmentCount);
+  TEST_ASSERT_EQUAL_UINT32(1, store.segments[0].seq);
+  TEST_ASSERT_TRUE(store.segments[LG_STORE_MAX_SEGMENTS - 1].bytes > LG_STORE_SEGMENT_MAX);
+  reopen();
+  TEST_ASSERT_EQUAL_UINT8(LG_STORE_MAX_SEGMENTS, reopened.segmentCount);
+  TEST_ASSERT_EQUAL_UINT32(store.totalBytes, reopened.totalBytes);
+}
+
+void test_mount_deletes_segments_past_the_index() {
+  // More segment files than the index holds, as a larger build may leave
+  uint32_t files = LG_STORE_MAX_SEGMENTS + 5;
+  for (uint32_t seq = files; seq >= 1; seq--) {
+    char path[LG_STORE_PATH_MAX];
+    segmentFile(seq, path);
+    TEST_ASSERT_TRUE(appendId(store, seq, seq));  // Only to encode the record
+    TEST_ASSERT_TRUE(fs.LgPosixFs::append(path, store.batch, store.batchLen));
+    store.batchLen = 0;
+  }
+  reopen();
+  TEST_ASSERT_EQUAL_UINT8(LG_STORE_MAX_SEGMENTS, reopened.segmentCount);
+  TEST_ASSERT_EQUAL_UINT32(6, reopened.segments[0].seq);
+  TEST_ASSERT_EQUAL_UINT32(files, reopened.segments[LG_STORE_MAX_SEGMENTS - 1].seq);
+  TEST_ASSERT_EQUAL_UINT32(5, reopened.segmentsDropped);
+  for (uint32_t seq = 1; seq <= 5; seq++) TEST_ASSERT_FALSE(exists(seq));
+  for (uint32_t seq = 6; seq <= files; seq++) TEST_ASSERT_TRUE(exists(seq));
+  TEST_ASSERT_EQUAL_UINT32(LG_STORE_MAX_SEGMENTS, replay.count);
+}
+
+void test_compaction_drops_oldest_and_carries_kept_records() {
+  fillSegments(store, 3);
+  uint32_t perSegment = store.segments[0].bytes / (LG_STORE_HEADER_LEN + 4 + LG_STORE_CRC_LEN);
+  TEST_ASSERT_FALSE(lgStoreCompact(store, store.totalBytes, 0, nullptr, nullptr));  // Within budget
+
+  // Segment 1 holds id 0; keep nothing of it
+  TEST_ASSERT_TRUE(lgStoreCompact(store, 0, 0, nullptr, nullptr));
+  TEST_ASSERT_FALSE(exists(1));
+  TEST_ASSERT_EQUAL_UINT32(2, store.segments[0].seq);
+  TEST_ASSERT_EQUAL_UINT32(1, store.segmentsDropped);
+
+  // Retention by time: segment 2 (time 2) is older than minTime 3
+  TEST_ASSERT_TRUE(lgStoreCompact(store, UINT32_MAX, 3, keepOdd, nullptr));
+  TEST_ASSERT_FALSE(exists(2));
+  reopen();
+  TEST_ASSERT_EQUAL_UINT32(0, replay.seen[0]);
+  TEST_ASSERT_EQUAL_UINT32(perSegment, replay.seen[1]);  // Carried forward (odd)
+  TEST_ASSERT_EQUAL_UINT32(perSegment, replay.seen[2]);
+
+  // The newest segment is never dropped
+  TEST_ASSERT_TRUE(lgStoreCompact(reopened, 0, 0, nullptr, nullptr));
+  TEST_ASSERT_FALSE(lgStoreCompact(reopened, 0, 0, nullptr, nullptr));
+  TEST_ASSERT_EQUAL_UINT8(1, reopened.segmentCount);
+}
+
+void test_failed_carry_resumes_without_duplicates() {
+  // Segment 1: one full batch of odd ids, all kept; segment 2 makes it compactable
+  uint32_t kept = 0;
+  while (appendId(store, 2 * kept + 1, 1)) kept++;
+  TEST_ASSERT_TRUE(lgStoreFlush(store));
+  fillSegments(store, 1);
+
+  // Unflushed records of the owner share the batch, so the copy needs a
+  // flush partway through; that flush fails
+  const uint32_t pending = 10;
+  for (uint32_t i = 0; i < pending; i++) TEST_ASSERT_TRUE(appendId(store, 2 * kept + 2 + 2 * i, 5));
+  fs.failAfter = 0;
+  TEST_ASSERT_FALSE(lgStoreCompact(store, 0, 0, keepOdd, nullptr));
+  TEST_ASSERT_TRUE(exists(1));
+  fs.failAfter = -1;
+  TEST_ASSERT_TRUE(lgStoreCompact(store, 0, 0, keepOdd, nullptr));
+  TEST_ASSERT_FALSE(exists(1));
+
+  reopen();
+  for (uint32_t i = 0; i < kept; i++) TEST_ASSERT_EQUAL_UINT32(1, replay.seen[2 * i + 1]);
+  for (uint32_t i = 0; i < pending; i++) TEST_ASSERT_EQUAL_UINT32(1, replay.seen[2 * kept + 2 + 2 * i]);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_append_flush_replay);
+  RUN_TEST(test_unflushed_records_are_not_replayed);
+  RUN_TEST(test_torn_tail_is_dropped_and_sealed);
+  RUN_TEST(test_bad_crc_ends_segment);
+  RUN_TEST(test_rotation_stops_at_max_segments);
+  RUN_TEST(test_mount_deletes_segments_past_the_index);
+  RUN_TEST(test_compaction_drops_oldest_and_carries_kept_records);
+  RUN_TEST(test_failed_carry_resumes_without_duplicates);
+  return UNITY_END();
+}
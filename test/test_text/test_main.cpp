@@ -0,0 +1,136 @@
+// LabGuard+ Text Protocol Tokenizer host tests (pio test -e native)
+
+#include <unity.h>
+#include <LabGuardText.h>
+
+#include <math.h>
+#include <string.h>
+
+void setUp() {}
+void tearDown() {}
+
+// The DATA: fields, IR deliberately listed before PIR
+static long ir, pir, gas;
+static float temp;
+static const LgKvField dataFields[] = {
+  {"IR", LG_KV_INT, &ir}, {"PIR", LG_KV_INT, &pir}, {"GAS", LG_KV_INT, &gas}, {"TEMP", LG_KV_FLOAT, &temp},
+};
+static uint32_t seen;
+static const char* errorAt;
+
+static LgKvStatus parseData(const char* body) {
+  ir = pir = gas = -7;
+  temp = -7;
+  errorAt = nullptr;
+  return lgParseKv(body, dataFields, 4, &seen, &errorAt);
+}
+
+// ---------------------- Keys ------------------------------------
+void test_ir_never_matches_inside_pir() {
+  TEST_ASSERT_EQUAL(LG_KV_OK, parseData("PIR=1"));
+  TEST_ASSERT_EQUAL(1, pir);
+  TEST_ASSERT_EQUAL(-7, ir);
+  TEST_ASSERT_EQUAL_UINT32(0x2, seen);
+
+  TEST_ASSERT_EQUAL(LG_KV_OK, parseData("PIR=1,IR=0"));
+  TEST_ASSERT_EQUAL(1, pir);
+  TEST_ASSERT_EQUAL(0, ir);
+  TEST_ASSERT_EQUAL_UINT32(0x3, seen);
+
+  TEST_ASSERT_EQUAL(LG_KV_OK, parseData("IR=1,PIR=0"));
+  TEST_ASSERT_EQUAL(1, ir);
+  TEST_ASSERT_EQUAL(0, pir);
+}
+
+void test_unknown_and_prefixed_keys_are_skipped() {
+  TEST_ASSERT_EQUAL(LG_KV_OK, parseData("XIR=5,IRX=6,GASES=7,GAS=8"));
+  TEST_ASSERT_EQUAL(-7, ir);
+  TEST_ASSERT_EQUAL(8, gas);
+  TEST_ASSERT_EQUAL_UINT32(0x4, seen);
+}
+
+void test_duplicate_key_last_wins() {
+  TEST_ASSERT_EQUAL(LG_KV_OK, parseData("GAS=1,PIR=1,GAS=2"));
+  TEST_ASSERT_EQUAL(2, gas);
+  TEST_ASSERT_EQUAL_UINT32(0x6, seen);
+}
+
+// ---------------------- Pairs -----------------------------------
+void test_empty_body_and_trailing_comma() {
+  TEST_ASSERT_EQUAL(LG_KV_OK, parseData(""));
+  TEST_ASSERT_EQUAL_UINT32(0, seen);
+  TEST_ASSERT_EQUAL(LG_KV_OK, parseData("GAS=3,"));
+  TEST_ASSERT_EQUAL(3, gas);
+  TEST_ASSERT_EQUAL(LG_KV_OK, parseData(",,GAS=4,,"));
+  TEST_ASSERT_EQUAL(4, gas);
+}
+
+void test_empty_value_is_an_error() {
+  TEST_ASSERT_EQUAL(LG_KV_BAD_NUMBER, parseData("PIR=1,GAS=,IR=1"));
+  TEST_ASSERT_EQUAL_STRING("GAS=,IR=1", errorAt);
+  TEST_ASSERT_EQUAL(-7, gas);  // Never written as 0
+  TEST_ASSERT_EQUAL(-7, ir);   // Parsing stopped
+}
+
+void test_malformed_pairs() {
+  TEST_ASSERT_EQUAL(LG_KV_BAD_PAIR, parseData("GAS"));
+  TEST_ASSERT_EQUAL(LG_KV_BAD_PAIR, parseData("=5"));
+  TEST_ASSERT_EQUAL(LG_KV_BAD_NUMBER, parseData("GAS=12abc"));
+  TEST_ASSERT_EQUAL(LG_KV_BAD_NUMBER, parseData("GAS=1.5"));
+  TEST_ASSERT_EQUAL(LG_KV_BAD_NUMBER, parseData("TEMP=warm"));
+  TEST_ASSERT_EQUAL(-7, gas);
+}
+
+// ---------------------- Values ----------------------------------
+void test_numbers() {
+  TEST_ASSERT_EQUAL(LG_KV_OK, parseData("GAS=-40,TEMP=21.5"));
+  TEST_ASSERT_EQUAL(-40, gas);
+  TEST_ASSERT_EQUAL_FLOAT(21.5f, temp);
+  TEST_ASSERT_EQUAL(LG_KV_OK, parseData("TEMP=nan"));
+  TEST_ASSERT_FLOAT_IS_NAN(temp);
+}
+
+void test_out_of_range_int_is_an_error() {
+  TEST_ASSERT_EQUAL(LG_KV_BAD_NUMBER, parseData("GAS=99999999999999999999"));
+  TEST_ASSERT_EQUAL(-7, gas);
+  TEST_ASSERT_EQUAL(LG_KV_BAD_NUMBER, parseData("TEMP=1e99"));
+}
+
+// millis() stamps pass 2^31 after 24.8 days of uptime
+void test_u32_covers_the_whole_millis_range() {
+  uint32_t t = 0;
+  const LgKvField fields[] = {{"T", LG_KV_U32, &t}};
+  TEST_ASSERT_EQUAL(LG_KV_OK, lgParseKv("T=2147483648", fields, 1, &seen));
+  TEST_ASSERT_EQUAL_UINT32(2147483648u, t);
+  TEST_ASSERT_EQUAL(LG_KV_OK, lgParseKv("T=4294967295", fields, 1, &seen));
+  TEST_ASSERT_EQUAL_UINT32(4294967295u, t);
+  TEST_ASSERT_EQUAL(LG_KV_BAD_NUMBER, lgParseKv("T=4294967296", fields, 1, &seen));
+  TEST_ASSERT_EQUAL(LG_KV_BAD_NUMBER, lgParseKv("T=-1", fields, 1, &seen));
+  TEST_ASSERT_EQUAL(LG_KV_BAD_NUMBER, lgParseKv("T=", fields, 1, &seen));
+  TEST_ASSERT_EQUAL_UINT32(4294967295u, t);
+}
+
+// ---------------------- Lines -----------------------------------
+void test_line_helpers() {
+  TEST_ASSERT_EQUAL_STRING("TEMP=1", lgKvBody("DATA:TEMP=1", "DATA:"));
+  TEST_ASSERT_NULL(lgKvBody("ALERT:GAS_LEAK", "DATA:"));
+
+  char line[] = "PING:ESP32,T=5 \r\nxx";
+  TEST_ASSERT_EQUAL_size_t(14, lgTerminateLine(line, 16));
+  TEST_ASSERT_EQUAL_STRING("PING:ESP32,T=5", line);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_ir_never_matches_inside_pir);
+  RUN_TEST(test_unknown_and_prefixed_keys_are_skipped);
+  RUN_TEST(test_duplicate_key_last_wins);
+  RUN_TEST(test_empty_body_and_trailing_comma);
+  RUN_TEST(test_empty_value_is_an_error);
+  RUN_TEST(test_malformed_pairs);
+  RUN_TEST(test_numbers);
+  RUN_TEST(test_out_of_range_int_is_an_error);
+  RUN_TEST(test_u32_covers_the_whole_millis_range);
+  RUN_TEST(test_line_helpers);
+  return UNITY_END();
+}